@@ -1,6 +1,7 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "RCube/Core/Accel/Frustum.h"
 #include "RCube/Core/Arch/Component.h"
 #include "RCube/Core/Graphics/OpenGL/Effect.h"
 #include "RCube/Core/Graphics/OpenGL/Texture.h"
@@ -22,11 +23,6 @@ constexpr glm::vec3 YAXIS_NEGATIVE = glm::vec3(0, -1, 0);
 constexpr glm::vec3 ZAXIS_POSITIVE = glm::vec3(0, 0, +1);
 constexpr glm::vec3 ZAXIS_NEGATIVE = glm::vec3(0, 0, -1);
 
-struct Frustum
-{
-    std::array<glm::vec3, 8> points;
-};
-
 /**
  * Camera is the component to display the world on the screen.
  * To create a valid camera object, add a Camera component (camera's characteristics) and
@@ -68,6 +64,15 @@ class Camera : public Component<Camera>
      */
     Frustum frustum();
 
+    /**
+     * Computes the part of the camera's view frustum under a rectangle on the screen, e.g., for
+     * rubber-band selection
+     * @param ndc_min Lower-left corner of the rectangle in normalized device coordinates
+     * @param ndc_max Upper-right corner of the rectangle in normalized device coordinates
+     * @return Frustum through the rectangle from the near to the far plane
+     */
+    Frustum frustum(const glm::vec2 &ndc_min, const glm::vec2 &ndc_max);
+
     const glm::mat4 &worldToView() const
     {
         return world_to_view;
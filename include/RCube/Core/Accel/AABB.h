@@ -1,12 +1,31 @@
 #pragma once
 
 #include "RCube/Core/Accel/Ray.h"
+#include "RCube/Core/Accel/SIMD.h"
 #include "glm/glm.hpp"
 #include <algorithm>
+#include <limits>
 
 namespace rcube
 {
 
+/**
+ * How a box relates to a query region (box, sphere or frustum)
+ */
+enum class Overlap
+{
+    Outside, /// The box is entirely outside the region
+    Partial, /// The box may cross the boundary of the region
+    Inside   /// The box is entirely inside the region
+};
+
+/**
+ * Factor applied to the distances where a ray exits a box's slabs. It exceeds 1 + 2 * gamma(3)
+ * (Pharr, Jakob, Humphreys, Physically Based Rendering, 3.9.2) so that rounding errors in the
+ * slab test never make a ray miss a box it grazes.
+ */
+constexpr float RAY_BOX_EXIT_SCALE = 1.f + 4.f * std::numeric_limits<float>::epsilon();
+
 class AABB
 {
     glm::vec3 min_ = glm::vec3(0.f, 0.f, 0.f);
@@ -17,6 +36,11 @@ class AABB
 
     AABB(const glm::vec3 &bb_min, const glm::vec3 &bb_max);
 
+    /**
+     * Box that contains nothing: isNull() is true and expanding it by a point gives that point
+     */
+    static AABB null();
+
     const glm::vec3 &min() const;
 
     const glm::vec3 &max() const;
@@ -29,7 +53,118 @@ class AABB
 
     size_t longestAxis() const;
 
-    bool rayIntersect(const Ray &ray);
+    float surfaceArea() const;
+
+    glm::vec3 center() const;
+
+    /**
+     * Squared distance from a point to the box (0 if the point is inside, infinity if null)
+     */
+    float distanceSquared(const glm::vec3 &p) const;
+
+    bool contains(const glm::vec3 &p) const;
+
+    bool overlaps(const AABB &other) const;
+
+    /**
+     * Classifies another box against this one, for range queries
+     * @param box Box to classify
+     * @return Whether box is outside, partially inside or entirely inside this box
+     */
+    Overlap classify(const AABB &box) const;
+
+    /**
+     * Bounding box of this box after an affine transformation
+     * @param m Affine transformation matrix
+     * @return Box containing the transformed box (null if this box is null)
+     */
+    AABB transformed(const glm::mat4 &m) const;
+
+    bool rayIntersect(const Ray &ray) const;
+
+    /**
+     * Intersects a ray with the box using the slab test. The ray's inverse direction and
+     * direction signs pick the entry and exit planes without branching. Rays parallel to an axis
+     * are handled by the infinite inverse direction, including rays that lie in a face of the box.
+     * @param ray Ray
+     * @param t_near Ray parameter where the ray enters the box, clamped to ray.tmin()
+     * @return Whether the ray overlaps the box within [ray.tmin(), ray.tmax()]
+     */
+    bool rayIntersect(const Ray &ray, float &t_near) const;
+};
+
+/**
+ * Overlap test between boxes of two spaces related by an affine transformation, e.g., the nodes
+ * of two BVHs whose meshes are placed by different transforms. Boxes of the second space become
+ * parallelepipeds in the first, which are tested with the separating axis theorem; the up to 15
+ * candidate axes only depend on the transformation, so they are computed once.
+ */
+class TransformedBoxTest
+{
+  public:
+    /**
+     * @param b_to_a Affine transformation from the space of the second boxes to the space of
+     * the first ones
+     */
+    explicit TransformedBoxTest(const glm::mat4 &b_to_a);
+
+    /**
+     * Conservative overlap test: boxes that touch, or are separated by less than the rounding
+     * errors of the test, are reported as overlapping
+     * @param a Box in the first space
+     * @param b Box in the second space
+     * @return Whether b, transformed to the first space, overlaps a
+     */
+    bool overlaps(const AABB &a, const AABB &b) const;
+
+  private:
+    glm::mat3 linear_;
+    glm::vec3 translation_;
+    size_t num_axes_ = 0;
+    glm::vec3 axes_[15];            /// Candidate separating axes in the first space
+    glm::vec3 abs_axes_[15];        /// Absolute values of the components of each axis
+    glm::vec3 abs_projections_[15]; /// |dot(axis, column i of linear_)| for each axis
 };
 
+/**
+ * Intersects a ray with two boxes at once, e.g., both children of a BVH node. Gives the same
+ * results as AABB::rayIntersect() for each box, but the slabs of both boxes are tested together
+ * using SIMD instructions.
+ * @param a First box
+ * @param b Second box
+ * @param ray Ray
+ * @param t_a Ray parameter where the ray enters a, clamped to ray.tmin()
+ * @param t_b Ray parameter where the ray enters b, clamped to ray.tmin()
+ * @return Bitmask with bit 0 set if the ray overlaps a and bit 1 set if it overlaps b within
+ * [ray.tmin(), ray.tmax()]
+ */
+inline int rayIntersect(const AABB &a, const AABB &b, const Ray &ray, float &t_a, float &t_b)
+{
+    using namespace simd;
+    const glm::vec3 &o = ray.origin();
+    const glm::vec3 &inv = ray.inverseDirection();
+    const int signs = ray.directionSigns();
+    const float4 exit_scale(1.f, 1.f, RAY_BOX_EXIT_SCALE, RAY_BOX_EXIT_SCALE);
+    // Lanes hold the entry planes of a and b followed by their exit planes
+    float4 t_enter(ray.tmin());
+    float4 t_exit(ray.tmax());
+    for (int i = 0; i < 3; ++i)
+    {
+        const bool negative = ((signs >> i) & 1) != 0;
+        const float4 planes(negative ? a.max()[i] : a.min()[i], negative ? b.max()[i] : b.min()[i],
+                            negative ? a.min()[i] : a.max()[i], negative ? b.min()[i] : b.max()[i]);
+        const float4 t = (planes - float4(o[i])) * (float4(inv[i]) * exit_scale);
+        // A ray parallel to the slabs that starts on one of their planes gives 0 * inf = NaN,
+        // which max() and min() ignore because the running value is their second operand
+        t_enter = max(t, t_enter);
+        t_exit = min(t, t_exit);
+    }
+    float enter[4], exit[4];
+    t_enter.store(enter);
+    t_exit.store(exit);
+    t_a = enter[0];
+    t_b = enter[1];
+    return (enter[0] <= exit[2] ? 1 : 0) | (enter[1] <= exit[3] ? 2 : 0);
+}
+
 } // namespace rcube
\ No newline at end of file
@@ -1,28 +1,1103 @@
-#include "RCube/Core/Accel/Ray.h"
+#pragma once
+
 #include "RCube/Core/Accel/AABB.h"
+#include "RCube/Core/Accel/MappedFile.h"
 #include "RCube/Core/Accel/Primitive.h"
+#include "RCube/Core/Accel/Ray.h"
+#include "RCube/Core/Accel/RayPacket.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
 #include "glm/glm.hpp"
-#include <memory>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace rcube
 {
 
-// BVH Tree node
-class BVHNode
+/**
+ * Node of a flattened BVH. Nodes are stored in depth-first order so the left child of an
+ * interior node is always the next node in the array; only the right child needs an offset.
+ * At 32 bytes, two nodes fit in a cache line.
+ */
+struct BVHNode
 {
-  public:
     AABB aabb;
-    std::shared_ptr<BVHNode> left;
-    std::shared_ptr<BVHNode> right;
-    std::vector<PrimitivePtr> primitives;
-    bool rayIntersect(const Ray &ray, glm::vec3 &pt, PrimitivePtr &primitive);
+    uint32_t offset = 0; /// Right child index (interior) or first primitive index (leaf)
+    uint32_t count = 0;  /// Number of primitives in a leaf, 0 for interior nodes
+
+    bool isLeaf() const
+    {
+        return count > 0;
+    }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode is saved to disk as is and must be 32 bytes");
+
+constexpr size_t BVH_MAXDEPTH = 64;     /// The SAH builder makes nodes this deep into leaves
+constexpr size_t BVH_STACK_SIZE = 128;  /// Traversal stack entries; LBVHs can be up to 97 deep
+constexpr size_t BVH_NUM_BINS = 16;     /// Number of bins evaluated per axis by the SAH builder
+constexpr size_t BVH_MAX_LEAF_SIZE = 4; /// Ranges at most this size become leaves
+constexpr float BVH_TRAVERSAL_COST = 1.f; /// Cost of a node visit relative to a primitive test
+constexpr float BVH_REFIT_MAX_COST_RATIO = 1.5f; /// SAH cost growth after which refits rebuild
+
+/**
+ * Primitive found by a proximity query
+ */
+struct BVHNeighbor
+{
+    uint32_t prim = 0;       /// Primitive index
+    float distance_sq = 0.f; /// Squared distance from the query point
 };
 
-using BVHNodePtr = std::shared_ptr<BVHNode>;
+/**
+ * Algorithms available to build a BVH
+ */
+enum class BVHBuildMethod
+{
+    BinnedSAH,  /// Top-down binned Surface Area Heuristic (best quality, single-threaded)
+    LBVH,       /// Parallel linear BVH from sorted Morton codes (fastest build)
+    TreeletLBVH /// LBVH followed by parallel treelet restructuring to lower the SAH cost
+};
+
+/**
+ * Bounding Volume Hierarchy stored as a linear array of nodes, built with the binned
+ * Surface Area Heuristic.
+ *
+ * The BVH does not own any primitives: it is built from per-primitive bounds and centroids and
+ * stores a permutation of primitive indices which the leaves refer to. Queries take a callable
+ * that tests a single primitive (by index) against a ray, so the same structure can be used
+ * for any primitive type.
+ */
+class BVH
+{
+  public:
+    BVH() = default;
+
+    /**
+     * Builds the hierarchy
+     * @param bounds Bounding box of each primitive
+     * @param centroids Representative point of each primitive, used to partition them
+     * @param method Build algorithm
+     */
+    void build(const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids,
+               BVHBuildMethod method = BVHBuildMethod::BinnedSAH);
+
+    /**
+     * Builds the hierarchy from a list of primitives
+     * @param prims Primitives, referred to by their position in the list
+     */
+    void build(const std::vector<PrimitivePtr> &prims);
+
+    /**
+     * Removes all nodes
+     */
+    void clear();
+
+    /**
+     * Whether the hierarchy has no nodes
+     */
+    bool empty() const;
+
+    /**
+     * Bounding box of all primitives in the hierarchy
+     */
+    const AABB &bounds() const;
+
+    const MappedArray<BVHNode> &nodes() const;
+
+    /**
+     * Primitive indices in leaf order; a leaf refers to the range [offset, offset + count)
+     */
+    const MappedArray<uint32_t> &primitiveIndices() const;
+
+    /**
+     * Writes the hierarchy to a binary file that load() can map back into memory. The file holds
+     * the nodes and indices exactly as they are laid out in memory (native byte order), so
+     * loading it requires no parsing.
+     * @param path File to write
+     * @param key Identifies the primitives the hierarchy was built over (e.g., a hash of the
+     * geometry); load() only accepts a file saved with the same key
+     */
+    void save(const std::string &path, uint64_t key) const;
+
+    /**
+     * Replaces the hierarchy with one saved by save(), memory-mapping the file instead of
+     * reading it. The mapping is copy-on-write, so the hierarchy can still be refit. Copies of
+     * the BVH do not share the mapping but own their nodes, so refitting one leaves the others
+     * unchanged.
+     * @param path File to load
+     * @param key Expected key of the file
+     * @return Whether the file exists, is valid and has the expected key; if not, the hierarchy
+     * is left unchanged
+     */
+    bool load(const std::string &path, uint64_t key);
+
+    /**
+     * Whether the nodes are memory-mapped from a file loaded with load()
+     */
+    bool mapped() const;
+
+    /**
+     * Expected cost of a ray query according to the Surface Area Heuristic, normalized by the
+     * surface area of the root. Updated by build() and refit().
+     */
+    float sahCost() const;
+
+    /**
+     * SAH cost of the hierarchy right after the last build(); the ratio sahCost() / builtSAHCost()
+     * measures how much refitting has degraded the tree
+     */
+    float builtSAHCost() const;
 
-constexpr size_t BVH_MAXDEPTH = 10;
+    /**
+     * Number that changes whenever the hierarchy does (build(), refit(), load() and clear()),
+     * so that data derived from it, e.g., an instance's bounds in a top-level BVH, is only
+     * recomputed when needed. Revisions are unique across all BVH objects, so switching to a
+     * different hierarchy is noticed too.
+     */
+    uint64_t revision() const;
 
-BVHNodePtr buildBVH(std::vector<PrimitivePtr> &prims, size_t depth = 0);
+    /**
+     * Recomputes the bounds of all nodes bottom-up after primitives moved, keeping the tree
+     * topology. This is much cheaper than build(), but the tree gets worse as primitives drift
+     * away from where they were when it was built, so callers should rebuild once sahCost() has
+     * grown too far above builtSAHCost(). Independent subtrees are refit in parallel.
+     * The number of primitives must not have changed since the last build().
+     * @param bounds Callable with signature AABB(uint32_t prim) returning the new bounding box of
+     * a primitive; called concurrently from several threads
+     */
+    template <typename BoundsFn> void refit(BoundsFn &&bounds)
+    {
+        if (nodes_.empty())
+        {
+            return;
+        }
+        std::vector<uint32_t> top, roots;
+        refitPartition(top, roots);
+        // In depth-first order a subtree occupies a contiguous range of nodes in which children
+        // come after their parent, so walking the range backwards visits children first
+        std::vector<float> subtree_cost(roots.size());
+        ThreadPool::instance().parallelFor(0, roots.size(), [&](size_t k) {
+            float cost = 0.f;
+            for (uint32_t i = subtreeEnd(roots[k]); i-- > roots[k];)
+            {
+                cost += refitNode(i, bounds);
+            }
+            subtree_cost[k] = cost;
+        });
+        float cost = 0.f;
+        for (float c : subtree_cost)
+        {
+            cost += c;
+        }
+        for (auto it = top.rbegin(); it != top.rend(); ++it)
+        {
+            cost += refitNode(*it, bounds);
+        }
+        const float root_area = nodes_[0].aabb.surfaceArea();
+        sah_cost_ = cost / std::max(root_area, std::numeric_limits<float>::min());
+        newRevision();
+    }
+
+    /**
+     * Finds the closest intersection of a ray with the primitives in the hierarchy.
+     * Children are visited front-to-back and the ray's tmax is shrunk after every hit, so
+     * subtrees farther away than the closest hit found so far are skipped.
+     * @param ray Ray
+     * @param intersect Callable with signature bool(uint32_t prim, const Ray &ray, float &t)
+     * which reports hits within [ray.tmin(), ray.tmax()]
+     * @param prim Index of the closest primitive that was hit
+     * @param t Ray parameter of the closest hit
+     * @return Whether a primitive was hit
+     */
+    template <typename Intersector>
+    bool rayIntersect(const Ray &ray, Intersector &&intersect, uint32_t &prim, float &t) const
+    {
+        return rayIntersectLeaves(
+            ray,
+            [&](uint32_t first, uint32_t count, const Ray &r, uint32_t &position, float &t_hit) {
+                Ray leaf_ray = r;
+                bool hit = false;
+                for (uint32_t i = first; i < first + count; ++i)
+                {
+                    float t_prim;
+                    if (intersect(indices_[i], leaf_ray, t_prim) && t_prim <= leaf_ray.tmax())
+                    {
+                        hit = true;
+                        position = i;
+                        t_hit = t_prim;
+                        leaf_ray.setTmax(t_prim);
+                    }
+                }
+                return hit;
+            },
+            prim, t);
+    }
+
+    /**
+     * Finds the closest intersection of a ray like rayIntersect(), but hands whole leaves to
+     * the callable so that it can test their primitives together, e.g., with SIMD over data
+     * stored in leaf order (see TriangleSoA)
+     * @param ray Ray
+     * @param intersect Callable with signature
+     * bool(uint32_t first, uint32_t count, const Ray &ray, uint32_t &position, float &t) which
+     * finds the closest hit within [ray.tmin(), ray.tmax()] among the primitives at positions
+     * [first, first + count) of primitiveIndices()
+     * @param prim Index of the closest primitive that was hit
+     * @param t Ray parameter of the closest hit
+     * @return Whether a primitive was hit
+     */
+    template <typename LeafIntersector>
+    bool rayIntersectLeaves(const Ray &ray, LeafIntersector &&intersect, uint32_t &prim,
+                            float &t) const
+    {
+        float t_root;
+        if (nodes_.empty() || !nodes_[0].aabb.rayIntersect(ray, t_root))
+        {
+            return false;
+        }
+        struct StackEntry
+        {
+            uint32_t node;
+            float t_near;
+        };
+        std::array<StackEntry, BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = {0, t_root};
+        Ray r = ray;
+        bool hit = false;
+        while (stack_size > 0)
+        {
+            const StackEntry entry = stack[--stack_size];
+            // A closer hit was found after this node was pushed
+            if (entry.t_near > r.tmax())
+            {
+                continue;
+            }
+            const BVHNode &node = nodes_[entry.node];
+            if (node.isLeaf())
+            {
+                uint32_t position;
+                float t_leaf;
+                if (intersect(node.offset, node.count, r, position, t_leaf) &&
+                    t_leaf <= r.tmax())
+                {
+                    hit = true;
+                    prim = indices_[position];
+                    t = t_leaf;
+                    r.setTmax(t_leaf);
+                }
+                continue;
+            }
+            uint32_t near_child = entry.node + 1;
+            uint32_t far_child = node.offset;
+            float t_near, t_far;
+            const int hits = rcube::rayIntersect(nodes_[near_child].aabb, nodes_[far_child].aabb,
+                                                 r, t_near, t_far);
+            const bool hit_near = (hits & 1) != 0;
+            const bool hit_far = (hits & 2) != 0;
+            if (hit_near && hit_far)
+            {
+                if (t_far < t_near)
+                {
+                    std::swap(near_child, far_child);
+                    std::swap(t_near, t_far);
+                }
+                // Push the farther child first so that the nearer one is visited next
+                stack[stack_size++] = {far_child, t_far};
+                stack[stack_size++] = {near_child, t_near};
+            }
+            else if (hit_near)
+            {
+                stack[stack_size++] = {near_child, t_near};
+            }
+            else if (hit_far)
+            {
+                stack[stack_size++] = {far_child, t_far};
+            }
+        }
+        return hit;
+    }
+
+    /**
+     * Finds the closest intersection of each ray in a packet with the primitives in the
+     * hierarchy. The packet descends into a node if any of its rays overlaps the node, and
+     * nodes are skipped once every ray has found a closer hit.
+     * @param packet Rays
+     * @param intersect Callable with signature
+     * int(uint32_t prim, const RayPacket4 &packet, int mask, simd::float4 &t) which tests the
+     * lanes in mask and returns the bitmask of lanes that hit within [tmin, tmax], writing their
+     * ray parameters to t
+     * @param prim Per-lane index of the closest primitive that was hit
+     * @param t Per-lane ray parameter of the closest hit
+     * @return Bitmask of lanes that hit a primitive
+     */
+    template <typename PacketIntersector>
+    int rayIntersect(const RayPacket4 &packet, PacketIntersector &&intersect,
+                     uint32_t prim[RAY_PACKET_SIZE], float t[RAY_PACKET_SIZE]) const
+    {
+        return rayIntersectLeaves(
+            packet,
+            [&](uint32_t first, uint32_t count, const RayPacket4 &p, int mask, simd::float4 &t_hit,
+                uint32_t position[RAY_PACKET_SIZE]) {
+                RayPacket4 leaf_packet = p;
+                int hit = 0;
+                for (uint32_t i = first; i < first + count; ++i)
+                {
+                    simd::float4 t_prim = leaf_packet.tmax;
+                    const int prim_hit = intersect(indices_[i], leaf_packet, mask, t_prim);
+                    if (prim_hit == 0)
+                    {
+                        continue;
+                    }
+                    hit |= prim_hit;
+                    leaf_packet.tmax =
+                        simd::select(simd::laneMask(prim_hit), t_prim, leaf_packet.tmax);
+                    for (size_t k = 0; k < RAY_PACKET_SIZE; ++k)
+                    {
+                        if (prim_hit & (1 << k))
+                        {
+                            position[k] = i;
+                        }
+                    }
+                }
+                t_hit = leaf_packet.tmax;
+                return hit;
+            },
+            prim, t);
+    }
+
+    /**
+     * Finds the closest intersection of each ray in a packet like rayIntersect(), but hands
+     * whole leaves to the callable so that it can read primitives stored in leaf order (see
+     * TriangleSoA)
+     * @param packet Rays
+     * @param intersect Callable with signature int(uint32_t first, uint32_t count,
+     * const RayPacket4 &packet, int mask, simd::float4 &t, uint32_t position[RAY_PACKET_SIZE])
+     * which finds, for the lanes in mask, the closest hit within [tmin, tmax] among the
+     * primitives at positions [first, first + count) of primitiveIndices(), and returns the
+     * bitmask of lanes that hit, writing their ray parameters to t and positions to position
+     * @param prim Per-lane index of the closest primitive that was hit
+     * @param t Per-lane ray parameter of the closest hit
+     * @return Bitmask of lanes that hit a primitive
+     */
+    template <typename LeafIntersector>
+    int rayIntersectLeaves(const RayPacket4 &packet, LeafIntersector &&intersect,
+                           uint32_t prim[RAY_PACKET_SIZE], float t[RAY_PACKET_SIZE]) const
+    {
+        simd::float4 t_root;
+        int root_mask = nodes_.empty() ? 0 : rcube::rayIntersect(nodes_[0].aabb, packet, t_root);
+        if (root_mask == 0)
+        {
+            return 0;
+        }
+        struct StackEntry
+        {
+            simd::float4 t_near;
+            uint32_t node;
+            int mask;
+        };
+        std::array<StackEntry, BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = {t_root, 0, root_mask};
+        RayPacket4 p = packet;
+        int hit = 0;
+        while (stack_size > 0)
+        {
+            const StackEntry entry = stack[--stack_size];
+            // Only lanes that have not found a closer hit since the node was pushed
+            const int mask = simd::movemask(entry.t_near <= p.tmax) & entry.mask;
+            if (mask == 0)
+            {
+                continue;
+            }
+            const BVHNode &node = nodes_[entry.node];
+            if (node.isLeaf())
+            {
+                simd::float4 t_leaf = p.tmax;
+                uint32_t position[RAY_PACKET_SIZE];
+                const int leaf_hit =
+                    intersect(node.offset, node.count, p, mask, t_leaf, position) & mask;
+                if (leaf_hit != 0)
+                {
+                    hit |= leaf_hit;
+                    p.tmax = simd::select(simd::laneMask(leaf_hit), t_leaf, p.tmax);
+                    for (size_t k = 0; k < RAY_PACKET_SIZE; ++k)
+                    {
+                        if (leaf_hit & (1 << k))
+                        {
+                            prim[k] = indices_[position[k]];
+                        }
+                    }
+                }
+                continue;
+            }
+            const uint32_t near_child = entry.node + 1;
+            const uint32_t far_child = node.offset;
+            simd::float4 t_near, t_far;
+            const int mask_near = rcube::rayIntersect(nodes_[near_child].aabb, p, t_near) & mask;
+            const int mask_far = rcube::rayIntersect(nodes_[far_child].aabb, p, t_far) & mask;
+            if (mask_near != 0 && mask_far != 0)
+            {
+                // Order children by the closest entry distance over the lanes that hit them
+                const simd::float4 inf(std::numeric_limits<float>::infinity());
+                if (horizontalMin(simd::select(simd::laneMask(mask_far), t_far, inf)) <
+                    horizontalMin(simd::select(simd::laneMask(mask_near), t_near, inf)))
+                {
+                    stack[stack_size++] = {t_near, near_child, mask_near};
+                    stack[stack_size++] = {t_far, far_child, mask_far};
+                }
+                else
+                {
+                    stack[stack_size++] = {t_far, far_child, mask_far};
+                    stack[stack_size++] = {t_near, near_child, mask_near};
+                }
+            }
+            else if (mask_near != 0)
+            {
+                stack[stack_size++] = {t_near, near_child, mask_near};
+            }
+            else if (mask_far != 0)
+            {
+                stack[stack_size++] = {t_far, far_child, mask_far};
+            }
+        }
+        p.tmax.store(t);
+        return hit;
+    }
+
+    /**
+     * Checks whether a ray hits any primitive within [ray.tmin(), ray.tmax()], e.g., for shadow
+     * or visibility rays. Traversal stops at the first hit found, which need not be the closest.
+     * @param ray Ray
+     * @param intersect Callable with signature bool(uint32_t prim, const Ray &ray, float &t)
+     * @return Whether any primitive was hit
+     */
+    template <typename Intersector> bool occluded(const Ray &ray, Intersector &&intersect) const
+    {
+        return occludedLeaves(ray, [&](uint32_t first, uint32_t count, const Ray &r) {
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                float t_prim;
+                if (intersect(indices_[i], r, t_prim))
+                {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    /**
+     * Checks whether a ray hits any primitive like occluded(), but hands whole leaves to the
+     * callable (see rayIntersectLeaves())
+     * @param ray Ray
+     * @param intersect Callable with signature bool(uint32_t first, uint32_t count,
+     * const Ray &ray) which checks whether any of the primitives at positions
+     * [first, first + count) of primitiveIndices() is hit within [ray.tmin(), ray.tmax()]
+     * @return Whether any primitive was hit
+     */
+    template <typename LeafIntersector>
+    bool occludedLeaves(const Ray &ray, LeafIntersector &&intersect) const
+    {
+        if (nodes_.empty() || !nodes_[0].aabb.rayIntersect(ray))
+        {
+            return false;
+        }
+        std::array<uint32_t, BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0)
+        {
+            const uint32_t index = stack[--stack_size];
+            const BVHNode &node = nodes_[index];
+            if (node.isLeaf())
+            {
+                if (intersect(node.offset, node.count, ray))
+                {
+                    return true;
+                }
+                continue;
+            }
+            // No ordering: any hit ends the query
+            float t_left, t_right;
+            const int hits = rcube::rayIntersect(nodes_[index + 1].aabb, nodes_[node.offset].aabb,
+                                                 ray, t_left, t_right);
+            if (hits & 2)
+            {
+                stack[stack_size++] = node.offset;
+            }
+            if (hits & 1)
+            {
+                stack[stack_size++] = index + 1;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Checks which rays of a packet hit any primitive within their [tmin, tmax]. Rays drop out
+     * of the traversal as soon as they hit something.
+     * @param packet Rays
+     * @param intersect Callable with signature
+     * int(uint32_t prim, const RayPacket4 &packet, int mask, simd::float4 &t), as for
+     * rayIntersect()
+     * @return Bitmask of lanes that hit a primitive
+     */
+    template <typename PacketIntersector>
+    int occluded(const RayPacket4 &packet, PacketIntersector &&intersect) const
+    {
+        return occludedLeaves(
+            packet, [&](uint32_t first, uint32_t count, const RayPacket4 &p, int mask) {
+                int hit = 0;
+                for (uint32_t i = first; i < first + count; ++i)
+                {
+                    simd::float4 t_prim = p.tmax;
+                    hit |= intersect(indices_[i], p, mask & ~hit, t_prim);
+                    if ((mask & ~hit) == 0)
+                    {
+                        break;
+                    }
+                }
+                return hit;
+            });
+    }
+
+    /**
+     * Checks which rays of a packet hit any primitive like occluded(), but hands whole leaves to
+     * the callable (see rayIntersectLeaves())
+     * @param packet Rays
+     * @param intersect Callable with signature
+     * int(uint32_t first, uint32_t count, const RayPacket4 &packet, int mask) which returns the
+     * bitmask of lanes in mask that hit any of the primitives at positions [first, first + count)
+     * of primitiveIndices() within [tmin, tmax]
+     * @return Bitmask of lanes that hit a primitive
+     */
+    template <typename LeafIntersector>
+    int occludedLeaves(const RayPacket4 &packet, LeafIntersector &&intersect) const
+    {
+        simd::float4 t_near;
+        const int root_mask =
+            nodes_.empty() ? 0 : rcube::rayIntersect(nodes_[0].aabb, packet, t_near);
+        if (root_mask == 0)
+        {
+            return 0;
+        }
+        struct StackEntry
+        {
+            uint32_t node;
+            int mask;
+        };
+        std::array<StackEntry, BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = {0, root_mask};
+        int hit = 0;
+        while (stack_size > 0)
+        {
+            const StackEntry entry = stack[--stack_size];
+            const int mask = entry.mask & ~hit;
+            if (mask == 0)
+            {
+                continue;
+            }
+            const BVHNode &node = nodes_[entry.node];
+            if (node.isLeaf())
+            {
+                hit |= intersect(node.offset, node.count, packet, mask) & mask;
+                if (hit == packet.active)
+                {
+                    return hit;
+                }
+                continue;
+            }
+            const uint32_t left = entry.node + 1;
+            const uint32_t right = node.offset;
+            const int mask_right = rcube::rayIntersect(nodes_[right].aabb, packet, t_near) & mask;
+            if (mask_right != 0)
+            {
+                stack[stack_size++] = {right, mask_right};
+            }
+            const int mask_left = rcube::rayIntersect(nodes_[left].aabb, packet, t_near) & mask;
+            if (mask_left != 0)
+            {
+                stack[stack_size++] = {left, mask_left};
+            }
+        }
+        return hit;
+    }
+
+    /**
+     * Finds every intersection of a ray with the primitives within [ray.tmin(), ray.tmax()].
+     * Hits are reported in traversal order, not sorted.
+     * @param ray Ray
+     * @param intersect Callable with signature bool(uint32_t prim, const Ray &ray, float &t)
+     * @param on_hit Callable with signature void(uint32_t prim, float t) called for every hit
+     */
+    template <typename Intersector, typename HitCallback>
+    void rayIntersectAll(const Ray &ray, Intersector &&intersect, HitCallback &&on_hit) const
+    {
+        if (nodes_.empty() || !nodes_[0].aabb.rayIntersect(ray))
+        {
+            return;
+        }
+        std::array<uint32_t, BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0)
+        {
+            const uint32_t index = stack[--stack_size];
+            const BVHNode &node = nodes_[index];
+            if (node.isLeaf())
+            {
+                for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+                {
+                    float t_prim;
+                    if (intersect(indices_[i], ray, t_prim))
+                    {
+                        on_hit(indices_[i], t_prim);
+                    }
+                }
+                continue;
+            }
+            float t_left, t_right;
+            const int hits = rcube::rayIntersect(nodes_[index + 1].aabb, nodes_[node.offset].aabb,
+                                                 ray, t_left, t_right);
+            if (hits & 2)
+            {
+                stack[stack_size++] = node.offset;
+            }
+            if (hits & 1)
+            {
+                stack[stack_size++] = index + 1;
+            }
+        }
+    }
+
+    /**
+     * Finds the primitive closest to a point by branch-and-bound traversal: children are
+     * visited nearest-box first, and boxes farther than the closest primitive so far are skipped.
+     * @param p Query point
+     * @param distance_sq Callable with signature float(uint32_t prim) returning the squared
+     * distance from p to a primitive
+     * @param prim Index of the closest primitive
+     * @param dist_sq Squared distance to the closest primitive
+     * @param max_dist_sq Primitives farther than this squared distance are ignored
+     * @return Whether a primitive was found within max_dist_sq
+     */
+    template <typename DistanceFn>
+    bool nearest(const glm::vec3 &p, DistanceFn &&distance_sq, uint32_t &prim, float &dist_sq,
+                 float max_dist_sq = std::numeric_limits<float>::infinity()) const
+    {
+        float best = max_dist_sq;
+        bool found = false;
+        traverseByDistance(p, [&]() { return best; },
+                           [&](uint32_t i) {
+                               const float d = distance_sq(i);
+                               if (d < best || (!found && d <= best))
+                               {
+                                   best = d;
+                                   prim = i;
+                                   found = true;
+                               }
+                           });
+        if (found)
+        {
+            dist_sq = best;
+        }
+        return found;
+    }
+
+    /**
+     * Finds the k primitives closest to a point by branch-and-bound traversal
+     * @param p Query point
+     * @param k Maximum number of primitives to return
+     * @param distance_sq Callable with signature float(uint32_t prim) returning the squared
+     * distance from p to a primitive
+     * @param neighbors Closest primitives sorted by increasing distance
+     * @param max_dist_sq Primitives farther than this squared distance are ignored
+     */
+    template <typename DistanceFn>
+    void kNearest(const glm::vec3 &p, size_t k, DistanceFn &&distance_sq,
+                  std::vector<BVHNeighbor> &neighbors,
+                  float max_dist_sq = std::numeric_limits<float>::infinity()) const
+    {
+        neighbors.clear();
+        if (k == 0)
+        {
+            return;
+        }
+        // Max-heap on distance holding the k closest primitives found so far
+        auto farther = [](const BVHNeighbor &a, const BVHNeighbor &b) {
+            return a.distance_sq < b.distance_sq;
+        };
+        traverseByDistance(
+            p,
+            [&]() {
+                return neighbors.size() < k ? max_dist_sq : neighbors.front().distance_sq;
+            },
+            [&](uint32_t i) {
+                const float d = distance_sq(i);
+                if (neighbors.size() < k)
+                {
+                    if (d <= max_dist_sq)
+                    {
+                        neighbors.push_back({i, d});
+                        std::push_heap(neighbors.begin(), neighbors.end(), farther);
+                    }
+                }
+                else if (d < neighbors.front().distance_sq)
+                {
+                    std::pop_heap(neighbors.begin(), neighbors.end(), farther);
+                    neighbors.back() = {i, d};
+                    std::push_heap(neighbors.begin(), neighbors.end(), farther);
+                }
+            });
+        std::sort_heap(neighbors.begin(), neighbors.end(), farther);
+    }
+
+    /**
+     * Finds all primitives within a given distance of a point
+     * @param p Query point
+     * @param max_dist_sq Squared search radius
+     * @param distance_sq Callable with signature float(uint32_t prim) returning the squared
+     * distance from p to a primitive
+     * @param neighbors Primitives within the radius sorted by increasing distance
+     */
+    template <typename DistanceFn>
+    void radiusSearch(const glm::vec3 &p, float max_dist_sq, DistanceFn &&distance_sq,
+                      std::vector<BVHNeighbor> &neighbors) const
+    {
+        neighbors.clear();
+        traverseByDistance(p, [&]() { return max_dist_sq; },
+                           [&](uint32_t i) {
+                               const float d = distance_sq(i);
+                               if (d <= max_dist_sq)
+                               {
+                                   neighbors.push_back({i, d});
+                               }
+                           });
+        std::sort(neighbors.begin(), neighbors.end(),
+                  [](const BVHNeighbor &a, const BVHNeighbor &b) {
+                      return a.distance_sq < b.distance_sq;
+                  });
+    }
+
+    /**
+     * Finds all primitives that overlap a query region such as a box, sphere or frustum.
+     * Subtrees whose boxes are entirely inside the region are reported without testing their
+     * primitives.
+     * @param classify Callable with signature Overlap(const AABB &box) classifying a node's box
+     * against the region; returning Partial for boxes that are actually outside is allowed
+     * @param overlaps Callable with signature bool(uint32_t prim) testing whether a primitive
+     * overlaps the region
+     * @param prims Indices of the overlapping primitives, in no particular order
+     */
+    template <typename Classifier, typename PrimTest>
+    void rangeQuery(Classifier &&classify, PrimTest &&overlaps, std::vector<uint32_t> &prims) const
+    {
+        prims.clear();
+        if (nodes_.empty())
+        {
+            return;
+        }
+        std::array<uint32_t, BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0)
+        {
+            const uint32_t index = stack[--stack_size];
+            const Overlap overlap = classify(nodes_[index].aabb);
+            if (overlap == Overlap::Outside)
+            {
+                continue;
+            }
+            if (overlap == Overlap::Inside)
+            {
+                // The subtree's nodes are contiguous in depth-first order
+                const uint32_t end = subtreeEnd(index);
+                for (uint32_t n = index; n < end; ++n)
+                {
+                    const BVHNode &node = nodes_[n];
+                    if (node.isLeaf())
+                    {
+                        prims.insert(prims.end(), indices_.begin() + node.offset,
+                                     indices_.begin() + node.offset + node.count);
+                    }
+                }
+                continue;
+            }
+            const BVHNode &node = nodes_[index];
+            if (node.isLeaf())
+            {
+                for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+                {
+                    if (overlaps(indices_[i]))
+                    {
+                        prims.push_back(indices_[i]);
+                    }
+                }
+                continue;
+            }
+            stack[stack_size++] = node.offset;
+            stack[stack_size++] = index + 1;
+        }
+    }
+
+    /**
+     * Finds all pairs of overlapping primitives between this hierarchy and another one, e.g.,
+     * the faces of two meshes in contact. Both trees are traversed simultaneously and only
+     * pairs of leaves whose boxes overlap are tested. The traversal is split into independent
+     * subproblems that run as tasks of the shared ThreadPool.
+     * @param other Hierarchy over the other primitives
+     * @param other_to_this Affine transformation from the space of other's primitives to the
+     * space of this hierarchy's primitives
+     * @param overlap Callable with signature bool(uint32_t prim, uint32_t other_prim) testing
+     * whether a primitive of this hierarchy overlaps one of other; called concurrently from
+     * several threads
+     * @param pairs Overlapping pairs (prim, other_prim), in no particular order
+     */
+    template <typename PairTest>
+    void overlapPairs(const BVH &other, const glm::mat4 &other_to_this, PairTest &&overlap,
+                      std::vector<std::pair<uint32_t, uint32_t>> &pairs) const
+    {
+        pairs.clear();
+        traverseOverlaps(other, other_to_this, overlap, false, pairs);
+    }
+
+    /**
+     * Checks whether any primitive of this hierarchy overlaps one of another hierarchy, like
+     * overlapPairs(), but all threads stop as soon as an overlapping pair is found
+     * @param other Hierarchy over the other primitives
+     * @param other_to_this Affine transformation from the space of other's primitives to the
+     * space of this hierarchy's primitives
+     * @param overlap Callable with signature bool(uint32_t prim, uint32_t other_prim); called
+     * concurrently from several threads
+     * @return Whether an overlapping pair exists
+     */
+    template <typename PairTest>
+    bool overlaps(const BVH &other, const glm::mat4 &other_to_this, PairTest &&overlap) const
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> pairs;
+        return traverseOverlaps(other, other_to_this, overlap, true, pairs);
+    }
+
+  private:
+    // Simultaneous traversal behind overlapPairs() and overlaps(). Node pairs are expanded
+    // breadth-first until there are enough of them to keep all workers busy, then each is
+    // traversed depth-first by its own task. Returns whether any pair was found.
+    template <typename PairTest>
+    bool traverseOverlaps(const BVH &other, const glm::mat4 &other_to_this, PairTest &overlap,
+                          bool first_only, std::vector<std::pair<uint32_t, uint32_t>> &pairs) const
+    {
+        using NodePair = std::pair<uint32_t, uint32_t>;
+        if (nodes_.empty() || other.nodes_.empty())
+        {
+            return false;
+        }
+        const TransformedBoxTest boxes(other_to_this);
+        auto nodesOverlap = [&](uint32_t a, uint32_t b) {
+            return boxes.overlaps(nodes_[a].aabb, other.nodes_[b].aabb);
+        };
+        // Areas of other's boxes are compared after scaling them like the transformation does
+        const float area_scale =
+            std::pow(std::abs(glm::determinant(glm::mat3(other_to_this))), 2.f / 3.f);
+        // Opens the interior node of a pair, or the larger one if both are interior, and hands
+        // the overlapping child pairs to push(); returns false for pairs of leaves
+        auto expand = [&](const NodePair &p, auto &&push) {
+            const BVHNode &a = nodes_[p.first];
+            const BVHNode &b = other.nodes_[p.second];
+            if (a.isLeaf() && b.isLeaf())
+            {
+                return false;
+            }
+            const bool open_a =
+                !a.isLeaf() &&
+                (b.isLeaf() || a.aabb.surfaceArea() >= area_scale * b.aabb.surfaceArea());
+            const NodePair children[2] = {
+                open_a ? NodePair(p.first + 1, p.second) : NodePair(p.first, p.second + 1),
+                open_a ? NodePair(a.offset, p.second) : NodePair(p.first, b.offset)};
+            for (const NodePair &c : children)
+            {
+                if (nodesOverlap(c.first, c.second))
+                {
+                    push(c);
+                }
+            }
+            return true;
+        };
+
+        std::vector<NodePair> frontier;
+        if (nodesOverlap(0, 0))
+        {
+            frontier.push_back({0, 0});
+        }
+        const size_t target_size = 16 * ThreadPool::instance().size();
+        bool expanded = true;
+        while (expanded && !frontier.empty() && frontier.size() < target_size)
+        {
+            std::vector<NodePair> next;
+            next.reserve(2 * frontier.size());
+            expanded = false;
+            for (const NodePair &p : frontier)
+            {
+                if (expand(p, [&](const NodePair &c) { next.push_back(c); }))
+                {
+                    expanded = true;
+                }
+                else
+                {
+                    next.push_back(p);
+                }
+            }
+            frontier.swap(next);
+        }
+
+        std::atomic<bool> found(false);
+        std::vector<std::vector<NodePair>> task_pairs(frontier.size());
+        ThreadPool::instance().parallelFor(0, frontier.size(), [&](size_t k) {
+            // Every step pops one pair and pushes at most two, one level deeper in either tree
+            std::array<NodePair, 2 * BVH_STACK_SIZE> stack;
+            size_t stack_size = 0;
+            stack[stack_size++] = frontier[k];
+            auto push = [&](const NodePair &c) { stack[stack_size++] = c; };
+            while (stack_size > 0)
+            {
+                if (first_only && found.load(std::memory_order_relaxed))
+                {
+                    return;
+                }
+                const NodePair p = stack[--stack_size];
+                if (expand(p, push))
+                {
+                    continue;
+                }
+                const BVHNode &a = nodes_[p.first];
+                const BVHNode &b = other.nodes_[p.second];
+                for (uint32_t i = a.offset; i < a.offset + a.count; ++i)
+                {
+                    for (uint32_t j = b.offset; j < b.offset + b.count; ++j)
+                    {
+                        if (!overlap(indices_[i], other.indices_[j]))
+                        {
+                            continue;
+                        }
+                        found.store(true, std::memory_order_relaxed);
+                        if (first_only)
+                        {
+                            return;
+                        }
+                        task_pairs[k].push_back({indices_[i], other.indices_[j]});
+                    }
+                }
+            }
+        });
+        for (const std::vector<NodePair> &tp : task_pairs)
+        {
+            pairs.insert(pairs.end(), tp.begin(), tp.end());
+        }
+        return found.load();
+    }
+
+    // Recomputes the box of a node from its primitives or children; returns its unnormalized
+    // SAH cost contribution
+    template <typename BoundsFn> float refitNode(uint32_t index, BoundsFn &bounds)
+    {
+        BVHNode &node = nodes_[index];
+        AABB aabb = AABB::null();
+        if (node.isLeaf())
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            {
+                aabb.expandBy(bounds(indices_[i]));
+            }
+            node.aabb = aabb;
+            return aabb.surfaceArea() * node.count;
+        }
+        aabb.expandBy(nodes_[index + 1].aabb);
+        aabb.expandBy(nodes_[node.offset].aabb);
+        node.aabb = aabb;
+        return aabb.surfaceArea() * BVH_TRAVERSAL_COST;
+    }
+
+    // Visits the leaves whose boxes are within bound() of p, nearest box first, calling
+    // visit(prim) for their primitives. bound() is re-evaluated as the search narrows.
+    template <typename BoundFn, typename VisitFn>
+    void traverseByDistance(const glm::vec3 &p, BoundFn &&bound, VisitFn &&visit) const
+    {
+        if (nodes_.empty())
+        {
+            return;
+        }
+        struct StackEntry
+        {
+            uint32_t node;
+            float dist_sq;
+        };
+        std::array<StackEntry, BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = {0, nodes_[0].aabb.distanceSquared(p)};
+        while (stack_size > 0)
+        {
+            const StackEntry entry = stack[--stack_size];
+            if (entry.dist_sq > bound())
+            {
+                continue;
+            }
+            const BVHNode &node = nodes_[entry.node];
+            if (node.isLeaf())
+            {
+                for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+                {
+                    visit(indices_[i]);
+                }
+                continue;
+            }
+            StackEntry near_child{entry.node + 1, nodes_[entry.node + 1].aabb.distanceSquared(p)};
+            StackEntry far_child{node.offset, nodes_[node.offset].aabb.distanceSquared(p)};
+            if (far_child.dist_sq < near_child.dist_sq)
+            {
+                std::swap(near_child, far_child);
+            }
+            const float b = bound();
+            if (far_child.dist_sq <= b)
+            {
+                stack[stack_size++] = far_child;
+            }
+            if (near_child.dist_sq <= b)
+            {
+                stack[stack_size++] = near_child;
+            }
+        }
+    }
+
+    // Splits the tree into independent subtrees for parallel refitting: roots receives the
+    // subtree roots and top the nodes above them, parents before children
+    void refitPartition(std::vector<uint32_t> &top, std::vector<uint32_t> &roots) const;
+
+    // One past the last node of the subtree rooted at the given node
+    uint32_t subtreeEnd(uint32_t index) const;
+
+    float computeSAHCost() const;
+
+    // Gives the hierarchy a revision that no BVH had before
+    void newRevision();
+
+    static float horizontalMin(const simd::float4 &x)
+    {
+        return std::min(std::min(x[0], x[1]), std::min(x[2], x[3]));
+    }
+
+    MappedArray<BVHNode> nodes_;
+    MappedArray<uint32_t> indices_;
+    float sah_cost_ = 0.f;
+    float built_sah_cost_ = 0.f;
+    uint64_t revision_ = 0;
+};
 
-} // namespace rcube
\ No newline at end of file
+} // namespace rcube
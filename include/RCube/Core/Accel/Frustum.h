@@ -0,0 +1,41 @@
+#pragma once
+
+#include "RCube/Core/Accel/AABB.h"
+#include "glm/glm.hpp"
+#include <array>
+
+namespace rcube
+{
+
+/**
+ * A frustum (e.g., a camera's view volume, or the part of it under a selection rectangle)
+ * given by its eight corners. The planes of its six faces are computed on construction and
+ * used for containment and overlap tests.
+ */
+struct Frustum
+{
+    /// Corners: near top-left, top-right, bottom-left, bottom-right, then the same on the far plane
+    std::array<glm::vec3, 8> points = {};
+    /// Face planes as (inward normal, offset): a point p is inside if dot(n, p) + offset >= 0
+    std::array<glm::vec4, 6> planes = {};
+
+    Frustum() = default;
+
+    /**
+     * Creates a frustum from its corners, ordered as in points
+     * @param corners Corner points
+     */
+    explicit Frustum(const std::array<glm::vec3, 8> &corners);
+
+    bool contains(const glm::vec3 &p) const;
+
+    /**
+     * Classifies a box against the frustum, for range queries. Boxes near the frustum's edges
+     * may be reported as Partial even though they are outside.
+     * @param box Box to classify
+     * @return Whether the box is outside, partially inside or entirely inside the frustum
+     */
+    Overlap classify(const AABB &box) const;
+};
+
+} // namespace rcube
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rcube
+{
+
+/**
+ * 64-bit non-cryptographic hash of a byte buffer, e.g., to detect whether geometry changed.
+ * Large buffers are hashed in fixed-size blocks on all threads; the result does not depend on
+ * the number of threads.
+ * @param data Bytes to hash
+ * @param size Number of bytes
+ * @param seed Initial value, e.g., the hash of preceding data to combine buffers
+ * @return Hash value
+ */
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 0);
+
+} // namespace rcube
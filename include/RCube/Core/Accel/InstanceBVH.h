@@ -0,0 +1,188 @@
+#pragma once
+
+#include "RCube/Core/Accel/AABB.h"
+#include "RCube/Core/Accel/BVH.h"
+#include "RCube/Core/Accel/Ray.h"
+#include "RCube/Core/Accel/RayPacket.h"
+#include "glm/glm.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace rcube
+{
+
+/**
+ * Top level of a two-level acceleration structure: a BVH over the world-space bounds of
+ * instances, each of which places a bottom-level hierarchy (typically a Mesh's BVH) in the world
+ * with an affine transformation. Instances of the same geometry share its bottom-level BVH, and
+ * only the top level has to be updated when instances move.
+ *
+ * Inverse transforms and world bounds are cached per instance and recomputed only for instances
+ * whose transform or local bounds changed since the last update(). Callers that already know
+ * which instances moved can instead change them one by one with setInstance() and call refit().
+ */
+class InstanceBVH
+{
+  public:
+    InstanceBVH() = default;
+
+    /**
+     * Updates the instances. The top-level tree is refit if only transforms or bounds changed,
+     * and rebuilt if the number of instances changed or refitting degraded it too much.
+     * @param transforms Model to world transformation of each instance
+     * @param local_bounds Model-space bounds of each instance's geometry; null boxes are never hit
+     */
+    void update(const std::vector<glm::mat4> &transforms, const std::vector<AABB> &local_bounds);
+
+    /**
+     * Changes one instance. The tree is only brought up to date by the next refit(), so that
+     * several instances can be changed for the cost of one refit.
+     * @param instance Instance index, less than size()
+     * @param transform Model to world transformation
+     * @param local_bounds Model-space bounds of the instance's geometry
+     */
+    void setInstance(uint32_t instance, const glm::mat4 &transform, const AABB &local_bounds);
+
+    /**
+     * Refits the top-level tree to the instances changed by setInstance() since the last
+     * update() or refit(), or rebuilds it if refitting degraded it too much. Does nothing if no
+     * instance changed.
+     */
+    void refit();
+
+    void clear();
+
+    size_t size() const;
+
+    /**
+     * World to model transformation of an instance
+     */
+    const glm::mat4 &inverseTransform(uint32_t instance) const;
+
+    /**
+     * Finds the closest intersection of a world-space ray with the instances.
+     * The ray is transformed into the model space of every instance whose world bounds it
+     * overlaps; ray parameters are converted so that tmax keeps shrinking across instances.
+     * @param ray Ray in world space
+     * @param intersect Callable with signature bool(uint32_t instance, const Ray &ray, float &t)
+     * which finds the closest hit of a model-space ray within [ray.tmin(), ray.tmax()]
+     * @param instance Index of the closest instance that was hit
+     * @param t World-space ray parameter of the closest hit
+     * @return Whether an instance was hit
+     */
+    template <typename Intersector>
+    bool rayIntersect(const Ray &ray, Intersector &&intersect, uint32_t &instance, float &t) const
+    {
+        return bvh_.rayIntersect(
+            ray,
+            [&](uint32_t i, const Ray &r, float &t_hit) {
+                Ray model_ray = r;
+                float scale;
+                float t_model;
+                if (!modelRay(i, r, model_ray, scale) || !intersect(i, model_ray, t_model))
+                {
+                    return false;
+                }
+                // Guard against rounding so that every reported hit is accepted
+                t_hit = std::min(t_model / scale, r.tmax());
+                return true;
+            },
+            instance, t);
+    }
+
+    /**
+     * Finds the closest intersection of each ray in a world-space packet with the instances.
+     * The rays descend the top level together, and for every instance that some of them
+     * overlap, those rays are transformed into the instance's model space as a new packet.
+     * @param packet Rays in world space
+     * @param intersect Callable with signature
+     * int(uint32_t instance, const RayPacket4 &packet, int mask, simd::float4 &t) which finds
+     * the closest hits of the model-space rays in mask within their [tmin, tmax], and returns
+     * the bitmask of lanes that hit, writing their ray parameters to t
+     * @param instance Per-lane index of the closest instance that was hit
+     * @param t Per-lane world-space ray parameter of the closest hit
+     * @return Bitmask of lanes that hit an instance
+     */
+    template <typename PacketIntersector>
+    int rayIntersect(const RayPacket4 &packet, PacketIntersector &&intersect,
+                     uint32_t instance[RAY_PACKET_SIZE], float t[RAY_PACKET_SIZE]) const
+    {
+        return bvh_.rayIntersect(
+            packet,
+            [&](uint32_t i, const RayPacket4 &p, int mask, simd::float4 &t_hit) {
+                RayPacket4 model_packet;
+                simd::float4 scale;
+                const int model_mask = modelPacket(i, p, mask, model_packet, scale);
+                simd::float4 t_model = model_packet.tmax;
+                const int hit =
+                    model_mask != 0 ? intersect(i, model_packet, model_mask, t_model) & model_mask
+                                    : 0;
+                // Guard against rounding so that every reported hit is accepted
+                t_hit = simd::select(simd::laneMask(hit), simd::min(t_model / scale, p.tmax),
+                                     t_hit);
+                return hit;
+            },
+            instance, t);
+    }
+
+    /**
+     * Checks whether a world-space ray hits any instance within [ray.tmin(), ray.tmax()].
+     * Traversal stops at the first hit found, e.g., for shadow rays.
+     * @param ray Ray in world space
+     * @param any_hit Callable with signature bool(uint32_t instance, const Ray &ray) which
+     * checks whether a model-space ray hits the instance's geometry within its [tmin, tmax]
+     * @return Whether any instance was hit
+     */
+    template <typename AnyHit> bool occluded(const Ray &ray, AnyHit &&any_hit) const
+    {
+        return bvh_.occluded(ray, [&](uint32_t i, const Ray &r, float &) {
+            Ray model_ray = r;
+            float scale;
+            return modelRay(i, r, model_ray, scale) && any_hit(i, model_ray);
+        });
+    }
+
+  private:
+    /**
+     * Transforms a world-space ray into the model space of an instance. Rays have unit
+     * directions, so ray parameters scale by the length of the transformed direction.
+     * @param instance Instance index
+     * @param ray Ray in world space
+     * @param model_ray Ray in model space with its [tmin, tmax] scaled accordingly
+     * @param scale Model-space distance per unit of world-space distance along the ray
+     * @return False if the transformation collapses the ray's direction
+     */
+    bool modelRay(uint32_t instance, const Ray &ray, Ray &model_ray, float &scale) const;
+
+    /**
+     * Transforms the rays of a world-space packet into the model space of an instance, like
+     * modelRay()
+     * @param instance Instance index
+     * @param packet Rays in world space
+     * @param mask Lanes to transform
+     * @param model_packet Rays in model space, active in the returned lanes
+     * @param scale Per-lane model-space distance per unit of world-space distance
+     * @return Bitmask of the lanes in mask whose direction the transformation does not collapse
+     */
+    int modelPacket(uint32_t instance, const RayPacket4 &packet, int mask,
+                    RayPacket4 &model_packet, simd::float4 &scale) const;
+
+    // Refits the tree to the cached world bounds, or rebuilds it if rebuild is set or the
+    // refit tree is too costly
+    void refitOrRebuild(bool rebuild);
+
+    struct Instance
+    {
+        glm::mat4 transform;
+        glm::mat4 inverse_transform;
+        AABB local_bounds;
+        AABB world_bounds;
+    };
+
+    std::vector<Instance> instances_;
+    BVH bvh_;
+    bool outdated_ = false; /// Instances were changed by setInstance() since the last refit
+};
+
+} // namespace rcube
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "RCube/Core/Accel/BVH.h"
+#include <vector>
+
+namespace rcube
+{
+namespace internal
+{
+
+/**
+ * Builds a BVH in parallel by sorting primitives along a Morton curve and emitting the
+ * corresponding binary radix tree (Karras 2012), optionally followed by a treelet
+ * restructuring pass (Karras and Aila 2013). Use BVH::build() rather than calling this directly.
+ * @param bounds Bounding box of each primitive
+ * @param centroids Representative point of each primitive
+ * @param optimize_treelets Whether to run treelet restructuring
+ * @param nodes Output nodes, in the same depth-first layout as the binned SAH builder
+ * @param indices Output primitive indices in leaf order
+ */
+void buildLBVH(const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids,
+               bool optimize_treelets, std::vector<BVHNode> &nodes,
+               std::vector<uint32_t> &indices);
+
+} // namespace internal
+} // namespace rcube
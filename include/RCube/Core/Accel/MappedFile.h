@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rcube
+{
+
+/**
+ * Read-only file mapped into memory. The mapping is private (copy-on-write): the mapped memory
+ * may be modified, but changes are never written back to the file.
+ */
+class MappedFile
+{
+  public:
+    MappedFile(const MappedFile &other) = delete;
+
+    MappedFile &operator=(const MappedFile &other) = delete;
+
+    ~MappedFile();
+
+    /**
+     * Maps a file into memory
+     * @param path Path to the file
+     * @return Mapped file, or nullptr if it cannot be opened or is empty
+     */
+    static std::shared_ptr<MappedFile> open(const std::string &path);
+
+    char *data();
+
+    size_t size() const;
+
+  private:
+    MappedFile() = default;
+
+    char *data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void *file_ = nullptr;
+    void *mapping_ = nullptr;
+#endif
+};
+
+/**
+ * Contiguous array that either owns its elements or refers to memory in a MappedFile, which it
+ * keeps alive. Both kinds are accessed the same way, so data structures can be built in memory
+ * or loaded from disk without copying.
+ *
+ * Copies always own their elements, even when copied from a mapped array: the mapping is
+ * writable (see MappedFile), so sharing it would let a change made through one copy, e.g., a BVH
+ * refit, show up in the other. Moving keeps the mapping.
+ */
+template <typename T> class MappedArray
+{
+  public:
+    MappedArray() = default;
+
+    MappedArray(const MappedArray &other)
+    {
+        *this = other;
+    }
+
+    MappedArray(MappedArray &&other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    MappedArray &operator=(const MappedArray &other)
+    {
+        if (this != &other)
+        {
+            *this = std::vector<T>(other.data_, other.data_ + other.size_);
+        }
+        return *this;
+    }
+
+    MappedArray &operator=(MappedArray &&other) noexcept
+    {
+        owned_ = std::move(other.owned_);
+        file_ = std::move(other.file_);
+        data_ = other.data_;
+        size_ = other.size_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        return *this;
+    }
+
+    /**
+     * Takes ownership of the elements of a vector
+     */
+    MappedArray &operator=(std::vector<T> &&elements)
+    {
+        owned_ = std::move(elements);
+        file_.reset();
+        data_ = owned_.data();
+        size_ = owned_.size();
+        return *this;
+    }
+
+    /**
+     * Refers to elements stored in a mapped file
+     * @param file Mapped file, kept alive as long as this array refers to it
+     * @param data First element, inside the file's mapped memory
+     * @param size Number of elements
+     */
+    void map(std::shared_ptr<MappedFile> file, T *data, size_t size)
+    {
+        owned_.clear();
+        owned_.shrink_to_fit();
+        file_ = std::move(file);
+        data_ = data;
+        size_ = size;
+    }
+
+    void clear()
+    {
+        *this = std::vector<T>();
+    }
+
+    /**
+     * Whether the elements are stored in a mapped file rather than owned
+     */
+    bool mapped() const
+    {
+        return file_ != nullptr;
+    }
+
+    T &operator[](size_t i)
+    {
+        return data_[i];
+    }
+
+    const T &operator[](size_t i) const
+    {
+        return data_[i];
+    }
+
+    T *data()
+    {
+        return data_;
+    }
+
+    const T *data() const
+    {
+        return data_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    T *begin()
+    {
+        return data_;
+    }
+
+    T *end()
+    {
+        return data_ + size_;
+    }
+
+    const T *begin() const
+    {
+        return data_;
+    }
+
+    const T *end() const
+    {
+        return data_ + size_;
+    }
+
+  private:
+    std::vector<T> owned_;
+    std::shared_ptr<MappedFile> file_;
+    T *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+} // namespace rcube
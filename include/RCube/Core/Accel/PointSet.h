@@ -0,0 +1,166 @@
+#pragma once
+
+#include "RCube/Core/Accel/BVH.h"
+#include "RCube/Core/Accel/Frustum.h"
+#include "RCube/Core/Accel/Sphere.h"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace rcube
+{
+
+/**
+ * A set of points with a BVH for proximity queries: nearest neighbour, k nearest neighbours
+ * and radius search. The points are stored by value; call build() again after changing them.
+ *
+ * Points can be given a radius, shared by all points or one per point, so that rays can hit
+ * them as spheres, e.g., to pick points of a point cloud. This works on the points directly and
+ * needs no triangulated proxy geometry.
+ */
+class PointSet
+{
+  public:
+    PointSet() = default;
+
+    /**
+     * Stores the points and builds the BVH over them
+     * @param points Point positions, referred to by their index in queries
+     * @param method BVH build algorithm
+     */
+    explicit PointSet(std::vector<glm::vec3> points,
+                      BVHBuildMethod method = BVHBuildMethod::BinnedSAH);
+
+    /**
+     * Stores points that share a radius and builds the BVH over the spheres they span
+     * @param points Point positions, referred to by their index in queries
+     * @param radius Radius of every point, used by ray queries
+     * @param method BVH build algorithm
+     */
+    PointSet(std::vector<glm::vec3> points, float radius,
+             BVHBuildMethod method = BVHBuildMethod::BinnedSAH);
+
+    /**
+     * Stores points with individual radii and builds the BVH over the spheres they span
+     * @param points Point positions, referred to by their index in queries
+     * @param radii Radius of each point, used by ray queries (same size as points)
+     * @param method BVH build algorithm
+     */
+    PointSet(std::vector<glm::vec3> points, std::vector<float> radii,
+             BVHBuildMethod method = BVHBuildMethod::BinnedSAH);
+
+    /**
+     * Replaces the points and rebuilds the BVH
+     * @param points Point positions, referred to by their index in queries
+     * @param method BVH build algorithm
+     */
+    void build(std::vector<glm::vec3> points, BVHBuildMethod method = BVHBuildMethod::BinnedSAH);
+
+    /**
+     * Replaces the points, giving all of them the same radius, and rebuilds the BVH
+     * @param points Point positions, referred to by their index in queries
+     * @param radius Radius of every point, used by ray queries
+     * @param method BVH build algorithm
+     */
+    void build(std::vector<glm::vec3> points, float radius,
+               BVHBuildMethod method = BVHBuildMethod::BinnedSAH);
+
+    /**
+     * Replaces the points and their radii and rebuilds the BVH
+     * @param points Point positions, referred to by their index in queries
+     * @param radii Radius of each point, used by ray queries (same size as points)
+     * @param method BVH build algorithm
+     */
+    void build(std::vector<glm::vec3> points, std::vector<float> radii,
+               BVHBuildMethod method = BVHBuildMethod::BinnedSAH);
+
+    const std::vector<glm::vec3> &points() const;
+
+    /**
+     * Radius of a point (0 for points built without a radius)
+     */
+    float radius(uint32_t index) const;
+
+    const BVH &bvh() const;
+
+    size_t size() const;
+
+    /**
+     * Finds the point closest to p
+     * @param p Query point
+     * @param index Index of the closest point
+     * @param distance Distance to the closest point
+     * @param max_distance Points farther than this are ignored
+     * @return Whether a point was found within max_distance
+     */
+    bool nearest(const glm::vec3 &p, uint32_t &index, float &distance,
+                 float max_distance = std::numeric_limits<float>::infinity()) const;
+
+    /**
+     * Finds the k points closest to p
+     * @param p Query point
+     * @param k Maximum number of points to return
+     * @param neighbors Closest points sorted by increasing distance (squared distances)
+     * @param max_distance Points farther than this are ignored
+     */
+    void kNearest(const glm::vec3 &p, size_t k, std::vector<BVHNeighbor> &neighbors,
+                  float max_distance = std::numeric_limits<float>::infinity()) const;
+
+    /**
+     * Finds all points within a radius of p
+     * @param p Query point
+     * @param radius Search radius
+     * @param neighbors Points within the radius sorted by increasing distance (squared
+     * distances)
+     */
+    void radiusSearch(const glm::vec3 &p, float radius, std::vector<BVHNeighbor> &neighbors) const;
+
+    /**
+     * Finds all points inside a box
+     * @param box Query box
+     * @param indices Indices of the points inside, in no particular order
+     */
+    void rangeQuery(const AABB &box, std::vector<uint32_t> &indices) const;
+
+    /**
+     * Finds all points inside a sphere
+     * @param sphere Query sphere
+     * @param indices Indices of the points inside, in no particular order
+     */
+    void rangeQuery(const Sphere &sphere, std::vector<uint32_t> &indices) const;
+
+    /**
+     * Finds all points inside a frustum, e.g., Camera::frustum() for the area under a
+     * selection rectangle
+     * @param frustum Query frustum
+     * @param indices Indices of the points inside, in no particular order
+     */
+    void rangeQuery(const Frustum &frustum, std::vector<uint32_t> &indices) const;
+
+    /**
+     * Finds the closest point hit by a ray, treating each point as a sphere of its radius
+     * @param ray Ray
+     * @param index Index of the closest point that was hit
+     * @param t Ray parameter of the hit
+     * @return Whether a point was hit within [ray.tmin(), ray.tmax()]
+     */
+    bool rayIntersect(const Ray &ray, uint32_t &index, float &t) const;
+
+    /**
+     * Checks whether a ray hits any point, treating each point as a sphere of its radius
+     * @param ray Ray
+     * @return Whether a point was hit within [ray.tmin(), ray.tmax()]
+     */
+    bool occluded(const Ray &ray) const;
+
+  private:
+    void buildBVH(BVHBuildMethod method);
+
+    std::vector<glm::vec3> points_;
+    std::vector<float> radii_; /// Radius of each point; empty if all points share radius_
+    float radius_ = 0.f;
+    BVH bvh_;
+};
+
+} // namespace rcube
@@ -1,6 +1,11 @@
+#pragma once
+
 #include "RCube/Core/Accel/AABB.h"
+#include "RCube/Core/Accel/Frustum.h"
 #include "RCube/Core/Accel/Ray.h"
+#include "RCube/Core/Accel/Sphere.h"
 #include "glm/glm.hpp"
+#include <limits>
 #include <memory>
 
 namespace rcube
@@ -21,7 +26,6 @@ class Point : public Primitive
     glm::vec3 pos_;
     size_t id_;
     float radius_ = 1.f;
-    float radius_sq_ = 1.f;
 
   public:
     Point(size_t id, const glm::vec3 &pos, float radius);
@@ -52,4 +56,107 @@ class Triangle : public Primitive
     AABB aabb() const override;
 };
 
+/**
+ * Intersects a ray with a sphere, e.g., a point with a radius
+ * @param center Center of the sphere
+ * @param radius Radius of the sphere
+ * @param ray Ray
+ * @param t Ray parameter of the closest hit within [ray.tmin(), ray.tmax()]; the exit point if
+ * the ray starts inside the sphere
+ * @return Whether the ray hits the sphere within [ray.tmin(), ray.tmax()]
+ */
+bool rayIntersect(const glm::vec3 &center, float radius, const Ray &ray, float &t);
+
+/**
+ * Per-ray constants of the watertight ray-triangle test (Woop, Benthin and Wald 2013), which
+ * maps triangles into a space where the ray starts at the origin and points along +z. Computing
+ * this once per ray keeps the division out of the per-triangle test.
+ */
+struct WatertightRay
+{
+    int kx, ky, kz;   /// Axes permuted so that kz is the dominant axis of the direction
+    float sx, sy, sz; /// Shear taking the direction to (0, 0, 1)
+
+    explicit WatertightRay(const Ray &ray);
+};
+
+/**
+ * Intersects a ray with a triangle given by its vertices. The test is watertight: a ray through
+ * an edge or vertex shared by several triangles hits at least one of them, and there is no
+ * epsilon, so tiny triangles are not dropped. Both sides of the triangle are hit.
+ * @param v0 First vertex
+ * @param v1 Second vertex
+ * @param v2 Third vertex
+ * @param ray Ray
+ * @param t Ray parameter of the hit
+ * @return Whether the ray hits the triangle within [ray.tmin(), ray.tmax()]
+ */
+bool rayIntersect(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const Ray &ray,
+                  float &t);
+
+/**
+ * Watertight ray-triangle test with the ray's constants precomputed, for testing many
+ * triangles against the same ray
+ * @param v0 First vertex
+ * @param v1 Second vertex
+ * @param v2 Third vertex
+ * @param ray Ray
+ * @param wray Constants of ray
+ * @param t Ray parameter of the hit
+ * @return Whether the ray hits the triangle within [ray.tmin(), ray.tmax()]
+ */
+bool rayIntersect(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const Ray &ray,
+                  const WatertightRay &wray, float &t);
+
+/**
+ * Finds the point on a triangle closest to a given point
+ * @param p Query point
+ * @param v0 First vertex
+ * @param v1 Second vertex
+ * @param v2 Third vertex
+ * @param barycentrics Weights of v0, v1 and v2 at the closest point
+ * @return Closest point on the triangle
+ */
+glm::vec3 closestPoint(const glm::vec3 &p, const glm::vec3 &v0, const glm::vec3 &v1,
+                       const glm::vec3 &v2, glm::vec3 &barycentrics);
+
+/**
+ * Exact triangle-box overlap test (separating axis theorem)
+ */
+bool overlaps(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const AABB &box);
+
+/**
+ * Exact triangle-sphere overlap test
+ */
+bool overlaps(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2,
+              const Sphere &sphere);
+
+/**
+ * Conservative triangle-frustum overlap test: only rejects triangles whose vertices are all
+ * outside the same face plane, so triangles just outside an edge of the frustum may pass
+ */
+bool overlaps(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2,
+              const Frustum &frustum);
+
+/**
+ * Triangle-triangle overlap test: whether two triangles share at least one point, including
+ * touching edges and vertices and overlapping coplanar triangles. Orientations are evaluated in
+ * double precision, so only configurations within rounding error of a degenerate one (e.g.,
+ * nearly touching triangles) can be misclassified.
+ */
+bool overlaps(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const glm::vec3 &u0,
+              const glm::vec3 &u1, const glm::vec3 &u2);
+
+/**
+ * Result of a closest-point query against a mesh
+ */
+struct ClosestPointHit
+{
+    bool found = false;                                       /// Whether a face was in range
+    float distance = std::numeric_limits<float>::infinity(); /// Distance to the closest point
+    glm::vec3 point = glm::vec3(0.f, 0.f, 0.f);               /// Closest point on the mesh
+    glm::vec3 barycentrics = glm::vec3(0.f, 0.f, 0.f);        /// Vertex weights at the point
+    size_t id = 0;                                            /// Index of the closest face
+};
+
 } // namespace rcube
\ No newline at end of file
@@ -12,6 +12,7 @@ class Ray
     float tmax_ = std::numeric_limits<float>::infinity();
     glm::vec3 orig, dir;
     glm::vec3 inv_dir;
+    int dir_signs = 0;
 
   public:
     Ray(const glm::vec3 o, const glm::vec3 d, float tmin = 0.f,
@@ -21,11 +22,38 @@ class Ray
 
     const glm::vec3 &direction() const;
 
+    /**
+     * Componentwise reciprocal of the direction, computed once for box tests. Components are
+     * infinite for directions parallel to an axis.
+     */
     const glm::vec3 &inverseDirection() const;
 
+    /**
+     * Sign bits of the inverse direction: bit i is set if the ray runs towards -infinity along
+     * axis i, so box tests know which slab plane the ray enters through without comparing
+     */
+    int directionSigns() const;
+
     float tmin() const;
 
     float tmax() const;
+
+    /**
+     * Sets the far end of the ray; used to shrink the search interval as closer hits are found
+     * @param t Ray parameter
+     */
+    void setTmax(float t);
+};
+
+/**
+ * Result of a ray query against a mesh
+ */
+struct RayHit
+{
+    bool hit = false;                                   /// Whether anything was hit
+    float t = std::numeric_limits<float>::infinity();   /// Ray parameter of the hit
+    glm::vec3 point = glm::vec3(0.f, 0.f, 0.f);         /// Hit point
+    size_t id = 0;                                      /// Index of the primitive that was hit
 };
 
 } // namespace rcube
\ No newline at end of file
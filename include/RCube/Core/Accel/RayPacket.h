@@ -0,0 +1,191 @@
+#pragma once
+
+#include "RCube/Core/Accel/AABB.h"
+#include "RCube/Core/Accel/Primitive.h"
+#include "RCube/Core/Accel/Ray.h"
+#include "RCube/Core/Accel/SIMD.h"
+#include "glm/glm.hpp"
+#include <cstddef>
+
+namespace rcube
+{
+
+constexpr size_t RAY_PACKET_SIZE = 4;
+
+/**
+ * Up to four rays stored in structure-of-arrays layout so that they can be intersected
+ * with boxes and triangles together using SIMD instructions.
+ * Lanes beyond the number of rays given are marked inactive.
+ */
+struct RayPacket4
+{
+    simd::vec3x4 origin;
+    simd::vec3x4 direction;
+    simd::vec3x4 inv_direction;
+    simd::vec3x4 negative_direction; /// Lane masks of rays whose inverse direction is negative
+    simd::float4 tmin;
+    simd::float4 tmax;
+    int active = 0; /// Bitmask of lanes holding a ray
+    /// Per-lane constants of the watertight ray-triangle test (see WatertightRay): lane masks
+    /// of rays whose dominant axis is x or y (z otherwise), and the shear of each ray
+    simd::float4 dominant_x, dominant_y;
+    simd::vec3x4 shear;
+
+    RayPacket4() = default;
+
+    /**
+     * Gathers rays into a packet
+     * @param rays Pointer to the first ray
+     * @param count Number of rays to gather (at most RAY_PACKET_SIZE)
+     */
+    RayPacket4(const Ray *rays, size_t count);
+};
+
+namespace internal
+{
+
+/**
+ * Narrows the per-lane interval [t_enter, t_exit] to a box's slab along one axis. The entry and
+ * exit planes are picked by the sign of the direction, so that NaN from a ray parallel to the
+ * slab that starts on one of its planes (0 * inf) leaves the interval unchanged, as in
+ * AABB::rayIntersect().
+ */
+inline void clipSlab(float lo, float hi, const simd::float4 &origin,
+                     const simd::float4 &inv_direction, const simd::float4 &negative,
+                     simd::float4 &t_enter, simd::float4 &t_exit)
+{
+    using namespace simd;
+    const float4 t0 = (select(negative, float4(hi), float4(lo)) - origin) * inv_direction;
+    const float4 t1 = (select(negative, float4(lo), float4(hi)) - origin) * inv_direction *
+                      float4(RAY_BOX_EXIT_SCALE);
+    t_enter = max(t0, t_enter);
+    t_exit = min(t1, t_exit);
+}
+
+} // namespace internal
+
+/**
+ * Intersects a ray packet with a box
+ * @param box Box
+ * @param packet Rays
+ * @param t_near Per-lane ray parameter where the ray enters the box
+ * @return Bitmask of active lanes whose rays overlap the box within [tmin, tmax]
+ */
+inline int rayIntersect(const AABB &box, const RayPacket4 &packet, simd::float4 &t_near)
+{
+    using namespace simd;
+    float4 t_enter = packet.tmin;
+    float4 t_exit = packet.tmax;
+    internal::clipSlab(box.min().x, box.max().x, packet.origin.x, packet.inv_direction.x,
+                       packet.negative_direction.x, t_enter, t_exit);
+    internal::clipSlab(box.min().y, box.max().y, packet.origin.y, packet.inv_direction.y,
+                       packet.negative_direction.y, t_enter, t_exit);
+    internal::clipSlab(box.min().z, box.max().z, packet.origin.z, packet.inv_direction.z,
+                       packet.negative_direction.z, t_enter, t_exit);
+    t_near = t_enter;
+    return movemask(t_enter <= t_exit) & packet.active;
+}
+
+namespace internal
+{
+
+/**
+ * Permutes vector components per lane so that the ray's dominant axis comes last, like the axes
+ * kx, ky, kz of WatertightRay
+ */
+inline simd::vec3x4 permuteAxes(const RayPacket4 &packet, const simd::vec3x4 &a)
+{
+    using namespace simd;
+    return vec3x4{select(packet.dominant_x, a.y, select(packet.dominant_y, a.z, a.x)),
+                  select(packet.dominant_x, a.z, select(packet.dominant_y, a.x, a.y)),
+                  select(packet.dominant_x, a.x, select(packet.dominant_y, a.y, a.z))};
+}
+
+} // namespace internal
+
+/**
+ * Intersects a ray packet with a single triangle (one triangle against four rays) using the
+ * watertight test of rcube::rayIntersect()
+ * @param v0 First vertex
+ * @param v1 Second vertex
+ * @param v2 Third vertex
+ * @param packet Rays
+ * @param mask Bitmask of lanes to test
+ * @param t Per-lane ray parameter of the hit, only written in lanes that hit
+ * @return Bitmask of lanes that hit the triangle within [tmin, tmax]
+ */
+inline int rayIntersect(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2,
+                        const RayPacket4 &packet, int mask, simd::float4 &t)
+{
+    using namespace simd;
+    const vec3x4 a = internal::permuteAxes(
+        packet, vec3x4{float4(v0.x), float4(v0.y), float4(v0.z)} - packet.origin);
+    const vec3x4 b = internal::permuteAxes(
+        packet, vec3x4{float4(v1.x), float4(v1.y), float4(v1.z)} - packet.origin);
+    const vec3x4 c = internal::permuteAxes(
+        packet, vec3x4{float4(v2.x), float4(v2.y), float4(v2.z)} - packet.origin);
+    const float4 ax = a.x - packet.shear.x * a.z;
+    const float4 ay = a.y - packet.shear.y * a.z;
+    const float4 bx = b.x - packet.shear.x * b.z;
+    const float4 by = b.y - packet.shear.y * b.z;
+    const float4 cx = c.x - packet.shear.x * c.z;
+    const float4 cy = c.y - packet.shear.y * c.z;
+    const float4 u = cx * by - cy * bx;
+    const float4 v = ax * cy - ay * cx;
+    const float4 w = bx * ay - by * ax;
+
+    const float4 zero(0.f);
+    // Lanes with an edge function of exactly zero are redone by the scalar test, which falls
+    // back to double precision
+    const int exact = mask & ~movemask((abs(u) > zero) & (abs(v) > zero) & (abs(w) > zero));
+    const int negative = movemask((u < zero) | (v < zero) | (w < zero));
+    const int positive = movemask((u > zero) | (v > zero) | (w > zero));
+    const float4 az = packet.shear.z * a.z;
+    const float4 bz = packet.shear.z * b.z;
+    const float4 cz = packet.shear.z * c.z;
+    const float4 det = u + v + w;
+    const float4 t_hit = (u * az + v * bz + w * cz) / det;
+    const int valid = movemask((abs(det) > zero) & (t_hit >= packet.tmin) &
+                               (t_hit <= packet.tmax));
+    int hits = mask & ~exact & ~(negative & positive) & valid;
+    t = select(laneMask(hits), t_hit, t);
+    if (exact != 0)
+    {
+        alignas(16) float lanes[4];
+        t.store(lanes);
+        for (int i = 0; i < 4; ++i)
+        {
+            if (((exact >> i) & 1) == 0)
+            {
+                continue;
+            }
+            // Same as the scalar test, on the sheared coordinates computed above: rebuilding a
+            // Ray from the lanes would renormalize its direction and could change the result
+            const float ue = static_cast<float>(double(cx[i]) * double(by[i]) -
+                                                double(cy[i]) * double(bx[i]));
+            const float ve = static_cast<float>(double(ax[i]) * double(cy[i]) -
+                                                double(ay[i]) * double(cx[i]));
+            const float we = static_cast<float>(double(bx[i]) * double(ay[i]) -
+                                                double(by[i]) * double(ax[i]));
+            if ((ue < 0.f || ve < 0.f || we < 0.f) && (ue > 0.f || ve > 0.f || we > 0.f))
+            {
+                continue;
+            }
+            const float det_e = ue + ve + we;
+            if (det_e == 0.f)
+            {
+                continue;
+            }
+            const float t_e = (ue * az[i] + ve * bz[i] + we * cz[i]) / det_e;
+            if (t_e >= packet.tmin[i] && t_e <= packet.tmax[i])
+            {
+                lanes[i] = t_e;
+                hits |= 1 << i;
+            }
+        }
+        t = float4::load(lanes);
+    }
+    return hits;
+}
+
+} // namespace rcube
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RCUBE_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace rcube
+{
+namespace simd
+{
+
+/**
+ * Four packed floats, backed by an SSE register when available and by a plain array otherwise.
+ * Comparisons return lane masks (all bits set in true lanes) which can be combined with
+ * &, | and select(), and converted to an integer bitmask with movemask().
+ */
+struct float4
+{
+#ifdef RCUBE_SSE
+    __m128 v;
+
+    float4() = default;
+
+    float4(float s) : v(_mm_set1_ps(s))
+    {
+    }
+
+    float4(__m128 x) : v(x)
+    {
+    }
+
+    float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d))
+    {
+    }
+
+    static float4 load(const float *ptr)
+    {
+        return float4(_mm_loadu_ps(ptr));
+    }
+
+    /// Converts four consecutive unsigned bytes to floats
+    static float4 loadBytes(const uint8_t *ptr)
+    {
+        int32_t packed;
+        std::memcpy(&packed, ptr, sizeof(packed));
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i bytes = _mm_cvtsi32_si128(packed);
+        const __m128i ints = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+        return float4(_mm_cvtepi32_ps(ints));
+    }
+
+    void store(float *ptr) const
+    {
+        _mm_storeu_ps(ptr, v);
+    }
+
+    float operator[](int i) const
+    {
+        alignas(16) float tmp[4];
+        _mm_store_ps(tmp, v);
+        return tmp[i];
+    }
+#else
+    float v[4];
+
+    float4() = default;
+
+    float4(float s) : v{s, s, s, s}
+    {
+    }
+
+    float4(float a, float b, float c, float d) : v{a, b, c, d}
+    {
+    }
+
+    static float4 load(const float *ptr)
+    {
+        return float4(ptr[0], ptr[1], ptr[2], ptr[3]);
+    }
+
+    /// Converts four consecutive unsigned bytes to floats
+    static float4 loadBytes(const uint8_t *ptr)
+    {
+        return float4(ptr[0], ptr[1], ptr[2], ptr[3]);
+    }
+
+    void store(float *ptr) const
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            ptr[i] = v[i];
+        }
+    }
+
+    float operator[](int i) const
+    {
+        return v[i];
+    }
+#endif
+};
+
+#ifdef RCUBE_SSE
+
+inline float4 operator+(const float4 &a, const float4 &b)
+{
+    return _mm_add_ps(a.v, b.v);
+}
+inline float4 operator-(const float4 &a, const float4 &b)
+{
+    return _mm_sub_ps(a.v, b.v);
+}
+inline float4 operator*(const float4 &a, const float4 &b)
+{
+    return _mm_mul_ps(a.v, b.v);
+}
+inline float4 operator/(const float4 &a, const float4 &b)
+{
+    return _mm_div_ps(a.v, b.v);
+}
+inline float4 operator<(const float4 &a, const float4 &b)
+{
+    return _mm_cmplt_ps(a.v, b.v);
+}
+inline float4 operator<=(const float4 &a, const float4 &b)
+{
+    return _mm_cmple_ps(a.v, b.v);
+}
+inline float4 operator>(const float4 &a, const float4 &b)
+{
+    return _mm_cmpgt_ps(a.v, b.v);
+}
+inline float4 operator>=(const float4 &a, const float4 &b)
+{
+    return _mm_cmpge_ps(a.v, b.v);
+}
+inline float4 operator&(const float4 &a, const float4 &b)
+{
+    return _mm_and_ps(a.v, b.v);
+}
+inline float4 operator|(const float4 &a, const float4 &b)
+{
+    return _mm_or_ps(a.v, b.v);
+}
+/// Lane-wise minimum; returns b in lanes where either operand is NaN
+inline float4 min(const float4 &a, const float4 &b)
+{
+    return _mm_min_ps(a.v, b.v);
+}
+/// Lane-wise maximum; returns b in lanes where either operand is NaN
+inline float4 max(const float4 &a, const float4 &b)
+{
+    return _mm_max_ps(a.v, b.v);
+}
+inline float4 abs(const float4 &a)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v);
+}
+/// Picks a in lanes where mask is set, b elsewhere
+inline float4 select(const float4 &mask, const float4 &a, const float4 &b)
+{
+    return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+/// Lane mask with lanes set where the corresponding bit of the integer mask is set
+inline float4 laneMask(int bits)
+{
+    const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128i m = _mm_and_si128(_mm_set1_epi32(bits), lanes);
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(m, lanes));
+}
+/// Integer bitmask with bit i set if lane i of the mask is set
+inline int movemask(const float4 &mask)
+{
+    return _mm_movemask_ps(mask.v);
+}
+
+#else
+
+namespace internal
+{
+
+template <typename Op> inline float4 lanewise(const float4 &a, const float4 &b, Op op)
+{
+    float4 r;
+    for (int i = 0; i < 4; ++i)
+    {
+        r.v[i] = op(a.v[i], b.v[i]);
+    }
+    return r;
+}
+
+inline float maskValue(bool flag)
+{
+    // All bits set, like an SSE comparison result
+    unsigned int bits = flag ? 0xFFFFFFFFu : 0u;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+inline bool maskBit(float f)
+{
+    unsigned int bits;
+    std::memcpy(&bits, &f, sizeof(f));
+    return (bits & 0x80000000u) != 0;
+}
+
+} // namespace internal
+
+inline float4 operator+(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return x + y; });
+}
+inline float4 operator-(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return x - y; });
+}
+inline float4 operator*(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return x * y; });
+}
+inline float4 operator/(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return x / y; });
+}
+inline float4 operator<(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return internal::maskValue(x < y); });
+}
+inline float4 operator<=(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return internal::maskValue(x <= y); });
+}
+inline float4 operator>(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return internal::maskValue(x > y); });
+}
+inline float4 operator>=(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return internal::maskValue(x >= y); });
+}
+inline float4 operator&(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) {
+        return internal::maskValue(internal::maskBit(x) && internal::maskBit(y));
+    });
+}
+inline float4 operator|(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) {
+        return internal::maskValue(internal::maskBit(x) || internal::maskBit(y));
+    });
+}
+/// Lane-wise minimum; returns b in lanes where either operand is NaN
+inline float4 min(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return x < y ? x : y; });
+}
+/// Lane-wise maximum; returns b in lanes where either operand is NaN
+inline float4 max(const float4 &a, const float4 &b)
+{
+    return internal::lanewise(a, b, [](float x, float y) { return x > y ? x : y; });
+}
+inline float4 abs(const float4 &a)
+{
+    return internal::lanewise(a, a, [](float x, float) { return std::abs(x); });
+}
+/// Picks a in lanes where mask is set, b elsewhere
+inline float4 select(const float4 &mask, const float4 &a, const float4 &b)
+{
+    float4 r;
+    for (int i = 0; i < 4; ++i)
+    {
+        r.v[i] = internal::maskBit(mask.v[i]) ? a.v[i] : b.v[i];
+    }
+    return r;
+}
+/// Lane mask with lanes set where the corresponding bit of the integer mask is set
+inline float4 laneMask(int bits)
+{
+    float4 r;
+    for (int i = 0; i < 4; ++i)
+    {
+        r.v[i] = internal::maskValue((bits >> i) & 1);
+    }
+    return r;
+}
+/// Integer bitmask with bit i set if lane i of the mask is set
+inline int movemask(const float4 &mask)
+{
+    int bits = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        bits |= internal::maskBit(mask.v[i]) ? (1 << i) : 0;
+    }
+    return bits;
+}
+
+#endif
+
+/**
+ * Three float4s representing a 3D vector in each of four lanes (structure-of-arrays)
+ */
+struct vec3x4
+{
+    float4 x, y, z;
+};
+
+inline vec3x4 operator-(const vec3x4 &a, const vec3x4 &b)
+{
+    return vec3x4{a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+inline float4 dot(const vec3x4 &a, const vec3x4 &b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline vec3x4 cross(const vec3x4 &a, const vec3x4 &b)
+{
+    return vec3x4{a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+} // namespace simd
+} // namespace rcube
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "RCube/Core/Accel/AABB.h"
+#include "glm/glm.hpp"
+
+namespace rcube
+{
+
+/**
+ * Sphere used as a region for range queries
+ */
+struct Sphere
+{
+    glm::vec3 center = glm::vec3(0.f, 0.f, 0.f);
+    float radius = 1.f;
+
+    Sphere() = default;
+
+    Sphere(const glm::vec3 &c, float r);
+
+    bool contains(const glm::vec3 &p) const;
+
+    /**
+     * Classifies a box against the sphere, for range queries
+     * @param box Box to classify
+     * @return Whether the box is outside, partially inside or entirely inside the sphere
+     */
+    Overlap classify(const AABB &box) const;
+};
+
+} // namespace rcube
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include <cstddef>
+
+namespace rcube
+{
+
+/**
+ * Non-owning view of the triangles of a mesh, referring directly to its vertex positions and
+ * (optionally) its index buffer. With indices, face f is made of the vertices at
+ * indices[3f], indices[3f + 1] and indices[3f + 2]; without, every three consecutive vertices
+ * form a face.
+ */
+struct TriangleMeshView
+{
+    const glm::vec3 *positions = nullptr;
+    const unsigned int *indices = nullptr;
+    size_t num_faces = 0;
+
+    /**
+     * Indices of a face's vertices, e.g., to look up per-vertex attributes such as normals
+     */
+    void vertexIndices(size_t face, size_t &i0, size_t &i1, size_t &i2) const
+    {
+        const size_t i = 3 * face;
+        if (indices != nullptr)
+        {
+            i0 = indices[i];
+            i1 = indices[i + 1];
+            i2 = indices[i + 2];
+        }
+        else
+        {
+            i0 = i;
+            i1 = i + 1;
+            i2 = i + 2;
+        }
+    }
+
+    void vertices(size_t face, glm::vec3 &v0, glm::vec3 &v1, glm::vec3 &v2) const
+    {
+        size_t i0, i1, i2;
+        vertexIndices(face, i0, i1, i2);
+        v0 = positions[i0];
+        v1 = positions[i1];
+        v2 = positions[i2];
+    }
+};
+
+} // namespace rcube
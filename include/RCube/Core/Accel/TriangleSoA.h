@@ -0,0 +1,179 @@
+#pragma once
+
+#include "RCube/Core/Accel/BVH.h"
+#include "RCube/Core/Accel/Primitive.h"
+#include "RCube/Core/Accel/Ray.h"
+#include "RCube/Core/Accel/RayPacket.h"
+#include "RCube/Core/Accel/TriangleMeshView.h"
+#include "RCube/Core/Accel/WideBVH.h"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace rcube
+{
+
+/**
+ * Copy of a mesh's triangle vertices in structure-of-arrays layout, ordered like the primitive
+ * indices of its BVH so that the triangles of a leaf are contiguous. Leaves are tested four
+ * triangles at a time with a SIMD version of the watertight ray-triangle test, loading
+ * coordinates straight from the arrays instead of gathering vertices through the index buffer.
+ *
+ * The copy costs 36 bytes per triangle and must be rebuilt whenever the vertices or the BVH
+ * change.
+ */
+class TriangleSoA
+{
+  public:
+    TriangleSoA() = default;
+
+    /**
+     * Copies the triangles in the BVH's leaf order
+     * @param triangles Triangles of the mesh
+     * @param bvh Hierarchy built over the triangles
+     */
+    void build(const TriangleMeshView &triangles, const BVH &bvh);
+
+    void clear();
+
+    /**
+     * Number of triangles
+     */
+    size_t size() const;
+
+    bool empty() const;
+
+    /**
+     * Finds the closest hit among the triangles at positions [first, first + count) of the
+     * BVH's primitive indices; usable as the leaf intersector of BVH::rayIntersectLeaves()
+     * @param first First position
+     * @param count Number of triangles
+     * @param ray Ray
+     * @param wray Constants of ray for the watertight test
+     * @param position Position of the closest triangle that was hit
+     * @param t Ray parameter of the closest hit
+     * @return Whether a triangle was hit within [ray.tmin(), ray.tmax()]
+     */
+    bool rayIntersect(uint32_t first, uint32_t count, const Ray &ray, const WatertightRay &wray,
+                      uint32_t &position, float &t) const;
+
+    /**
+     * Checks whether any of the triangles at positions [first, first + count) is hit; usable as
+     * the leaf intersector of BVH::occludedLeaves()
+     * @param first First position
+     * @param count Number of triangles
+     * @param ray Ray
+     * @param wray Constants of ray for the watertight test
+     * @return Whether a triangle was hit within [ray.tmin(), ray.tmax()]
+     */
+    bool occluded(uint32_t first, uint32_t count, const Ray &ray, const WatertightRay &wray) const;
+
+    /**
+     * Finds, for each lane in mask, the closest hit among the triangles at positions
+     * [first, first + count) of the BVH's primitive indices; usable as the leaf intersector of
+     * BVH::rayIntersectLeaves() for packets
+     * @param first First position
+     * @param count Number of triangles
+     * @param packet Rays
+     * @param mask Lanes to test
+     * @param t Per-lane ray parameter of the closest hit
+     * @param position Per-lane position of the closest triangle that was hit
+     * @return Bitmask of lanes that hit a triangle within [tmin, tmax]
+     */
+    int rayIntersect(uint32_t first, uint32_t count, const RayPacket4 &packet, int mask,
+                     simd::float4 &t, uint32_t position[RAY_PACKET_SIZE]) const;
+
+    /**
+     * Checks, for each lane in mask, whether any of the triangles at positions
+     * [first, first + count) is hit; usable as the leaf intersector of BVH::occludedLeaves() for
+     * packets
+     * @param first First position
+     * @param count Number of triangles
+     * @param packet Rays
+     * @param mask Lanes to test
+     * @return Bitmask of lanes that hit a triangle within [tmin, tmax]
+     */
+    int occluded(uint32_t first, uint32_t count, const RayPacket4 &packet, int mask) const;
+
+    /**
+     * Finds the closest triangle hit by a ray, traversing the BVH the triangles were built with
+     * @param bvh Hierarchy passed to build()
+     * @param ray Ray
+     * @param face Index of the closest face that was hit
+     * @param t Ray parameter of the closest hit
+     * @return Whether a triangle was hit
+     */
+    bool rayIntersect(const BVH &bvh, const Ray &ray, uint32_t &face, float &t) const;
+
+    /**
+     * Finds the closest triangle hit by each ray in a packet, traversing the BVH the triangles
+     * were built with
+     * @param bvh Hierarchy passed to build()
+     * @param packet Rays
+     * @param face Per-lane index of the closest face that was hit
+     * @param t Per-lane ray parameter of the closest hit
+     * @return Bitmask of lanes that hit a triangle
+     */
+    int rayIntersect(const BVH &bvh, const RayPacket4 &packet, uint32_t face[RAY_PACKET_SIZE],
+                     float t[RAY_PACKET_SIZE]) const;
+
+    /**
+     * Checks whether a ray hits any triangle, traversing the BVH the triangles were built with
+     * @param bvh Hierarchy passed to build()
+     * @param ray Ray
+     * @return Whether a triangle was hit
+     */
+    bool occluded(const BVH &bvh, const Ray &ray) const;
+
+    /**
+     * Checks which rays of a packet hit any triangle, traversing the BVH the triangles were built
+     * with
+     * @param bvh Hierarchy passed to build()
+     * @param packet Rays
+     * @return Bitmask of lanes that hit a triangle
+     */
+    int occluded(const BVH &bvh, const RayPacket4 &packet) const;
+
+    /**
+     * Finds the closest triangle hit by a ray, traversing a WideBVH collapsed from the BVH the
+     * triangles were built with
+     * @param bvh Hierarchy passed to build(), which maps positions to faces
+     * @param wide_bvh Hierarchy collapsed from bvh
+     * @param ray Ray
+     * @param face Index of the closest face that was hit
+     * @param t Ray parameter of the closest hit
+     * @return Whether a triangle was hit
+     */
+    bool rayIntersect(const BVH &bvh, const WideBVH &wide_bvh, const Ray &ray, uint32_t &face,
+                      float &t) const;
+
+    /**
+     * Checks whether a ray hits any triangle, traversing a WideBVH collapsed from the BVH the
+     * triangles were built with
+     * @param wide_bvh Hierarchy collapsed from the BVH passed to build()
+     * @param ray Ray
+     * @return Whether a triangle was hit
+     */
+    bool occluded(const WideBVH &wide_bvh, const Ray &ray) const;
+
+  private:
+    /**
+     * Bitmask of the lanes hit among the four triangles starting at a position
+     */
+    int intersectBlock(uint32_t position, int lanes, const Ray &ray, const WatertightRay &wray,
+                       float t[4]) const;
+
+    glm::vec3 vertex(uint32_t position, int k) const
+    {
+        return glm::vec3(coords_[(3 * k) * stride_ + position],
+                         coords_[(3 * k + 1) * stride_ + position],
+                         coords_[(3 * k + 2) * stride_ + position]);
+    }
+
+    /// Coordinate c of vertex k of the triangle at position i is at coords_[(3k + c) * stride_ + i]
+    std::vector<float> coords_;
+    size_t size_ = 0;
+    size_t stride_ = 0; /// size_ rounded up so that blocks of four never read past an array
+};
+
+} // namespace rcube
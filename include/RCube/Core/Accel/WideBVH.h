@@ -0,0 +1,277 @@
+#pragma once
+
+#include "RCube/Core/Accel/AABB.h"
+#include "RCube/Core/Accel/BVH.h"
+#include "RCube/Core/Accel/Ray.h"
+#include "RCube/Core/Accel/SIMD.h"
+#include "glm/glm.hpp"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rcube
+{
+
+constexpr size_t WIDE_BVH_WIDTH = 4;            /// Children per node, one per SIMD lane
+constexpr uint32_t WIDE_BVH_MAX_LEAF_SIZE = 255; /// Primitives per leaf child (8-bit counts)
+/// Traversal stack entries; visiting a node pops one entry and pushes at most four
+constexpr size_t WIDE_BVH_STACK_SIZE = (WIDE_BVH_WIDTH - 1) * BVH_STACK_SIZE;
+
+/**
+ * Node of a WideBVH. The children's boxes are stored as 8-bit offsets from the minimum corner
+ * of the node's box, in steps of a power of two along each axis and rounded outwards, so the
+ * dequantized boxes always contain the original ones. A node with four children fits in one
+ * 64-byte cache line, where the three binary nodes it replaces take one and a half.
+ */
+struct alignas(64) WideBVHNode
+{
+    glm::vec3 origin;                /// Minimum corner of the node's box
+    int8_t exponent[3];              /// Quantization step along axis i is 2^exponent[i]
+    uint8_t num_children;            /// Number of children in use
+    uint8_t lo[3][WIDE_BVH_WIDTH];   /// Quantized minima of the children's boxes, per axis
+    uint8_t hi[3][WIDE_BVH_WIDTH];   /// Quantized maxima of the children's boxes, per axis
+    uint32_t child[WIDE_BVH_WIDTH];  /// Node index (interior) or first primitive position (leaf)
+    uint8_t count[WIDE_BVH_WIDTH];   /// Number of primitives of a leaf child, 0 for interior ones
+
+    /**
+     * Quantization step along an axis
+     */
+    float step(int axis) const
+    {
+        // 2^e assembled from its exponent bits; exponents are kept within [-126, 127]
+        const uint32_t bits = static_cast<uint32_t>(exponent[axis] + 127) << 23;
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    /**
+     * Dequantized bounding box of a child, which contains the child's exact box
+     */
+    AABB childBounds(int i) const;
+};
+
+static_assert(sizeof(WideBVHNode) == 64, "WideBVHNode must fill exactly one cache line");
+
+/**
+ * Four-wide BVH with quantized child bounds, collapsed from a binary BVH to cut the memory
+ * traffic of ray traversal on large meshes. Each node holds the bounds of up to four children,
+ * which are tested against a ray at once using SIMD instructions, and the nodes take about half
+ * the memory of the binary tree's.
+ *
+ * Leaves are the leaves of the binary BVH and refer to the same ranges of its primitive
+ * indices, so the binary BVH must outlive the queries that map positions to primitives, and
+ * primitive data stored in leaf order (see TriangleSoA) can be used with either tree. Binary
+ * leaves with more than WIDE_BVH_MAX_LEAF_SIZE primitives are split over several children.
+ * Rebuild after the binary BVH is rebuilt or refit.
+ */
+class WideBVH
+{
+  public:
+    WideBVH() = default;
+
+    /**
+     * Collapses a binary BVH. At each node, the interior child with the largest surface area
+     * is replaced by its children until the node has four children or only leaves remain.
+     * @param bvh Binary BVH
+     */
+    void build(const BVH &bvh);
+
+    void clear();
+
+    bool empty() const;
+
+    /**
+     * Bounding box of all primitives in the hierarchy
+     */
+    const AABB &bounds() const;
+
+    /**
+     * Nodes in depth-first order, with the root first
+     */
+    const std::vector<WideBVHNode> &nodes() const;
+
+    /**
+     * Finds the closest intersection of a ray with the primitives in the hierarchy, like
+     * BVH::rayIntersectLeaves(). Hit children are visited nearest first, and nodes farther than
+     * the closest hit so far are skipped.
+     * @param ray Ray
+     * @param intersect Callable with signature
+     * bool(uint32_t first, uint32_t count, const Ray &ray, uint32_t &position, float &t) which
+     * finds the closest hit within [ray.tmin(), ray.tmax()] among the primitives at positions
+     * [first, first + count) of the binary BVH's primitiveIndices()
+     * @param position Position of the closest primitive that was hit
+     * @param t Ray parameter of the closest hit
+     * @return Whether a primitive was hit
+     */
+    template <typename LeafIntersector>
+    bool rayIntersectLeaves(const Ray &ray, LeafIntersector &&intersect, uint32_t &position,
+                            float &t) const
+    {
+        if (nodes_.empty())
+        {
+            return false;
+        }
+        struct StackEntry
+        {
+            uint32_t index; /// Node index, or first primitive position if count > 0
+            uint32_t count;
+            float t_near;
+        };
+        std::array<StackEntry, WIDE_BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = {0, 0, ray.tmin()};
+        const RayLanes lanes(ray);
+        Ray r = ray;
+        bool hit = false;
+        while (stack_size > 0)
+        {
+            const StackEntry entry = stack[--stack_size];
+            // A closer hit was found after this entry was pushed
+            if (entry.t_near > r.tmax())
+            {
+                continue;
+            }
+            if (entry.count > 0)
+            {
+                uint32_t p;
+                float t_leaf;
+                if (intersect(entry.index, entry.count, r, p, t_leaf) && t_leaf <= r.tmax())
+                {
+                    hit = true;
+                    position = p;
+                    t = t_leaf;
+                    r.setTmax(t_leaf);
+                }
+                continue;
+            }
+            const WideBVHNode &node = nodes_[entry.index];
+            float t_near[WIDE_BVH_WIDTH];
+            const int mask = intersectChildren(node, lanes, r.tmax(), t_near);
+            // Push the children that were hit farthest first so that the nearest is visited next
+            const size_t first = stack_size;
+            for (uint32_t i = 0; i < WIDE_BVH_WIDTH; ++i)
+            {
+                if ((mask >> i) & 1)
+                {
+                    StackEntry e{node.child[i], node.count[i], t_near[i]};
+                    size_t j = stack_size++;
+                    for (; j > first && stack[j - 1].t_near < e.t_near; --j)
+                    {
+                        stack[j] = stack[j - 1];
+                    }
+                    stack[j] = e;
+                }
+            }
+        }
+        return hit;
+    }
+
+    /**
+     * Checks whether a ray hits any primitive within [ray.tmin(), ray.tmax()], like
+     * BVH::occludedLeaves(). Traversal stops at the first hit found.
+     * @param ray Ray
+     * @param intersect Callable with signature bool(uint32_t first, uint32_t count,
+     * const Ray &ray) which checks whether any primitive at positions [first, first + count) of
+     * the binary BVH's primitiveIndices() is hit within [ray.tmin(), ray.tmax()]
+     * @return Whether any primitive was hit
+     */
+    template <typename LeafIntersector>
+    bool occludedLeaves(const Ray &ray, LeafIntersector &&intersect) const
+    {
+        if (nodes_.empty())
+        {
+            return false;
+        }
+        std::array<uint32_t, WIDE_BVH_STACK_SIZE> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+        const RayLanes lanes(ray);
+        while (stack_size > 0)
+        {
+            const WideBVHNode &node = nodes_[stack[--stack_size]];
+            float t_near[WIDE_BVH_WIDTH];
+            const int mask = intersectChildren(node, lanes, ray.tmax(), t_near);
+            // No ordering: any hit ends the query, so leaves are tested right away
+            for (uint32_t i = 0; i < WIDE_BVH_WIDTH; ++i)
+            {
+                if (((mask >> i) & 1) == 0)
+                {
+                    continue;
+                }
+                if (node.count[i] == 0)
+                {
+                    stack[stack_size++] = node.child[i];
+                }
+                else if (intersect(node.child[i], node.count[i], ray))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+  private:
+    /**
+     * Ray origin and inverse direction broadcast to all lanes, set up once per traversal
+     */
+    struct RayLanes
+    {
+        simd::float4 origin[3];
+        simd::float4 inv_direction[3];
+        int signs;
+        float tmin;
+
+        explicit RayLanes(const Ray &ray)
+            : origin{simd::float4(ray.origin().x), simd::float4(ray.origin().y),
+                     simd::float4(ray.origin().z)},
+              inv_direction{simd::float4(ray.inverseDirection().x),
+                            simd::float4(ray.inverseDirection().y),
+                            simd::float4(ray.inverseDirection().z)},
+              signs(ray.directionSigns()), tmin(ray.tmin())
+        {
+        }
+    };
+
+    /**
+     * Slab test of a ray against all children of a node, as in AABB::rayIntersect()
+     * @return Bitmask of children overlapped by the ray within [tmin, tmax]
+     */
+    static int intersectChildren(const WideBVHNode &node, const RayLanes &ray, float tmax,
+                                 float t_near[WIDE_BVH_WIDTH])
+    {
+        using namespace simd;
+        const float4 exit_scale(RAY_BOX_EXIT_SCALE);
+        float4 t_enter(ray.tmin);
+        float4 t_exit(tmax);
+        for (int a = 0; a < 3; ++a)
+        {
+            const bool negative = ((ray.signs >> a) & 1) != 0;
+            const float4 origin(node.origin[a]);
+            const float4 step(node.step(a));
+            const uint8_t *q_entry = negative ? node.hi[a] : node.lo[a];
+            const uint8_t *q_exit = negative ? node.lo[a] : node.hi[a];
+            // q * step is exact, so these are the planes the builder checked
+            const float4 entry = origin + float4::loadBytes(q_entry) * step;
+            const float4 exit = origin + float4::loadBytes(q_exit) * step;
+            // NaN from 0 * inf is ignored because the running value is the second operand
+            t_enter = max((entry - ray.origin[a]) * ray.inv_direction[a], t_enter);
+            t_exit = min((exit - ray.origin[a]) * ray.inv_direction[a] * exit_scale, t_exit);
+        }
+        t_enter.store(t_near);
+        return movemask(t_enter <= t_exit) & ((1 << node.num_children) - 1);
+    }
+
+    uint32_t collapse(const MappedArray<BVHNode> &binary, uint32_t index);
+
+    // Spreads a binary leaf with more than WIDE_BVH_MAX_LEAF_SIZE primitives over the children
+    // of new nodes, all bounded by the leaf's box, and returns the index of their root
+    uint32_t splitLeaf(const BVHNode &leaf, uint32_t first, uint32_t count);
+
+    std::vector<WideBVHNode> nodes_;
+    AABB bounds_ = AABB::null();
+};
+
+} // namespace rcube
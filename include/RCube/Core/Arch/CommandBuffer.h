@@ -0,0 +1,159 @@
+#ifndef COMMANDBUFFER_H
+#define COMMANDBUFFER_H
+
+#include "RCube/Core/Arch/Entity.h"
+#include "RCube/Core/Arch/World.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace rcube
+{
+
+/**
+ * Entity that will be created when a CommandBuffer is applied
+ */
+struct PendingEntity
+{
+    uint32_t index; /// Position of the entity in the list returned by CommandBuffer::apply()
+};
+
+/**
+ * Records structural changes to a World (entity creation and removal, component addition and
+ * removal) to apply them later in one batch, e.g., between two World::update() calls.
+ *
+ * Changing the world directly updates the systems' entity lists after every single change.
+ * apply() instead updates the component storage for all commands first, then works out the
+ * resulting change of every entity's components once and updates each system's entity lists in
+ * bulk, with removals done in a single sorted pass per list.
+ *
+ * Commands can be recorded concurrently from several threads, e.g., from systems running on the
+ * ThreadPool: each worker records into its own list. Commands are applied in the order in which
+ * they were recorded.
+ */
+class CommandBuffer
+{
+  public:
+    CommandBuffer();
+
+    CommandBuffer(const CommandBuffer &other) = delete;
+
+    CommandBuffer &operator=(const CommandBuffer &other) = delete;
+
+    /**
+     * Records the creation of an entity
+     * @return Placeholder for the entity, which components can be added to
+     */
+    PendingEntity create();
+
+    /**
+     * Records the removal of an entity and all its components. Later commands on the entity are
+     * ignored.
+     * @param entity Entity to remove
+     */
+    void destroy(Entity entity);
+
+    /**
+     * Records the addition of a component to an existing entity
+     * @param entity Entity
+     * @param component Component, copied when the command is recorded
+     */
+    template <typename ComponentType> void add(Entity entity, ComponentType component)
+    {
+        record(Command{0, CommandType::Add, ComponentType::family(), entity, NO_PENDING_ENTITY,
+                       makeAdd(std::move(component))});
+    }
+
+    /**
+     * Records the addition of a component to an entity created by this buffer
+     * @param entity Entity returned by create()
+     * @param component Component, copied when the command is recorded
+     */
+    template <typename ComponentType> void add(PendingEntity entity, ComponentType component)
+    {
+        record(Command{0, CommandType::Add, ComponentType::family(), Entity(), entity.index,
+                       makeAdd(std::move(component))});
+    }
+
+    /**
+     * Records the removal of a component from an entity
+     * @param entity Entity
+     */
+    template <typename ComponentType> void remove(Entity entity)
+    {
+        record(Command{0, CommandType::Remove, ComponentType::family(), entity,
+                       NO_PENDING_ENTITY, nullptr});
+    }
+
+    /**
+     * Number of recorded commands
+     */
+    size_t size() const;
+
+    /**
+     * Discards all recorded commands
+     */
+    void clear();
+
+    /**
+     * Applies all recorded commands to a world and clears the buffer. Must not be called
+     * concurrently with recording or with World::update().
+     * @param world World to modify
+     * @return Entities created by create(), indexed by PendingEntity::index
+     */
+    std::vector<EntityHandle> apply(World &world);
+
+  private:
+    static constexpr uint32_t NO_PENDING_ENTITY = UINT32_MAX;
+
+    enum class CommandType
+    {
+        Destroy,
+        Add,
+        Remove
+    };
+
+    struct Command
+    {
+        uint64_t sequence;   /// Recording order across all threads
+        CommandType type;
+        unsigned int family; /// Component family for Add and Remove
+        Entity entity;       /// Target, unless pending is set
+        uint32_t pending;    /// PendingEntity::index of the target, or NO_PENDING_ENTITY
+        // Adds the recorded component to the target, for Add commands
+        std::function<void(World &world, Entity entity)> add;
+    };
+
+    /**
+     * Commands recorded by one thread
+     */
+    struct alignas(64) Lane
+    {
+        std::mutex mutex;
+        std::vector<Command> commands;
+    };
+
+    template <typename ComponentType>
+    static std::function<void(World &, Entity)> makeAdd(ComponentType component)
+    {
+        return [component](World &world, Entity entity) {
+            world.getComponentManager<ComponentType>()->add(entity, component);
+        };
+    }
+
+    void record(Command command);
+
+    // One lane per ThreadPool worker plus one shared by all other threads
+    std::unique_ptr<Lane[]> lanes_;
+    size_t num_lanes_;
+    std::atomic<uint64_t> sequence_{0};
+    std::atomic<uint32_t> num_pending_{0};
+};
+
+} // namespace rcube
+
+#endif // COMMANDBUFFER_H
@@ -3,12 +3,127 @@
 
 #include "RCube/Core/Arch/Entity.h"
 #include <array>
-#include <iostream>
-#include <map>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 namespace rcube
 {
 
+constexpr size_t COMPONENT_INDEX_PAGE_SIZE = 4096; /// Entity ids per page of the sparse index
+constexpr size_t COMPONENT_POOL_PAGE_SIZE = 16384; /// Components per page of a ComponentPool
+
+/**
+ * Array of components stored in fixed-size pages, whose slots never move: growing only allocates
+ * a new page, and removing a component frees its slot for the next insertion. Pointers to a
+ * component stay valid until that component is removed. Pages are allocated as the pool grows,
+ * and slots are only constructed when used.
+ */
+template <typename T> class ComponentPool
+{
+  public:
+    ComponentPool() = default;
+
+    ComponentPool(const ComponentPool &other) = delete;
+
+    ComponentPool &operator=(const ComponentPool &other) = delete;
+
+    ~ComponentPool()
+    {
+        clear();
+    }
+
+    /**
+     * Number of components
+     */
+    size_t size() const
+    {
+        return size_;
+    }
+
+    T &operator[](size_t i)
+    {
+        return *slot(i);
+    }
+
+    /**
+     * Stores a component in a free slot, allocating a new page if all slots are in use
+     * @param component Component to copy
+     * @return Index of the component's slot
+     */
+    size_t insert(const T &component)
+    {
+        if (!free_slots_.empty())
+        {
+            const size_t i = free_slots_.back();
+            new (slot(i)) T(component);
+            free_slots_.pop_back();
+            used_[i] = true;
+            ++size_;
+            return i;
+        }
+        const size_t i = used_.size();
+        if (i == pages_.size() * COMPONENT_POOL_PAGE_SIZE)
+        {
+            // Default-initialized, so the page's memory is not touched before it is used
+            pages_.push_back(std::unique_ptr<Slot[]>(new Slot[COMPONENT_POOL_PAGE_SIZE]));
+        }
+        new (slot(i)) T(component);
+        used_.push_back(true);
+        ++size_;
+        return i;
+    }
+
+    /**
+     * Destroys the component in a slot and frees the slot
+     * @param i Index of the slot returned by insert()
+     */
+    void erase(size_t i)
+    {
+        slot(i)->~T();
+        used_[i] = false;
+        free_slots_.push_back(i);
+        --size_;
+    }
+
+    /**
+     * Destroys all components and releases all pages
+     */
+    void clear()
+    {
+        for (size_t i = 0; i < used_.size(); ++i)
+        {
+            if (used_[i])
+            {
+                slot(i)->~T();
+            }
+        }
+        used_.clear();
+        free_slots_.clear();
+        pages_.clear();
+        size_ = 0;
+    }
+
+  private:
+    struct Slot
+    {
+        alignas(T) unsigned char bytes[sizeof(T)];
+    };
+
+    T *slot(size_t i)
+    {
+        return reinterpret_cast<T *>(
+            &pages_[i / COMPONENT_POOL_PAGE_SIZE][i % COMPONENT_POOL_PAGE_SIZE]);
+    }
+
+    std::vector<std::unique_ptr<Slot[]>> pages_;
+    std::vector<bool> used_;         /// Whether each slot holds a component
+    std::vector<size_t> free_slots_; /// Slots freed by erase(), reused first
+    size_t size_ = 0;
+};
+
 /**
  * Base class for all component managers.
  * For internal use only.
@@ -22,44 +137,69 @@ class BaseComponentManager
 };
 
 /**
- * ComponentManager stores the component of type T corresponding to all entities created
+ * ComponentManager stores the component of type T corresponding to all entities created.
+ *
+ * Components live in the slots of a ComponentPool, where they stay until they are removed, so
+ * pointers to a component (e.g., Transform parents and children) are never invalidated by adding
+ * or removing other components. A sparse set indexes them: a packed array of the entities owning
+ * components, a parallel array of their slots, and a sparse index from entity id to position in
+ * the packed arrays. Lookups are O(1), removal moves the last packed entry into the freed
+ * position so the arrays stay packed, and iterating over [0, size()) visits all components. The
+ * sparse index is split into pages of COMPONENT_INDEX_PAGE_SIZE ids that are only allocated once
+ * an entity in their range gets a component.
  */
 template <typename T> class ComponentManager : public BaseComponentManager
 {
   public:
     typedef unsigned int ComponentIndex;
+    static constexpr ComponentIndex INVALID_INDEX = ~ComponentIndex(0);
     virtual ~ComponentManager() = default;
-    ComponentManager()
-    {
-        component_data_.data.resize(1024);
-    }
+    ComponentManager() = default;
     /**
-     * Add a component of type T to the given entity
+     * Add a component of type T to the given entity. Replaces the entity's component if it
+     * already has one.
      * @param e Entity to add component to
      * @param component Component to be added
      */
     void add(Entity e, const T &component)
     {
-        ComponentIndex new_index = ComponentIndex{component_data_.size};
-        component_data_.size += 1;
-        entity_map_[e] = new_index;
-        component_data_.data[new_index] = component;
-        // return new_index;
+        ComponentIndex &index = sparseIndex(e);
+        if (index != INVALID_INDEX)
+        {
+            if (!(entities_[index] == e))
+            {
+                throw std::runtime_error("Entity was removed and its ID reused");
+            }
+            components_[slots_[index]] = component;
+            return;
+        }
+        const ComponentIndex slot = static_cast<ComponentIndex>(components_.insert(component));
+        index = static_cast<ComponentIndex>(entities_.size());
+        entities_.push_back(e);
+        slots_.push_back(slot);
     }
     /**
-     * Remove the component of type T from the given entity
-     * @param e Entity to add component to
+     * Remove the component of type T from the given entity. Other components stay in place.
+     * @param e Entity to remove component from
      */
     void remove(Entity e) override
     {
-        if (entity_map_.find(e) == entity_map_.end())
+        const ComponentIndex index = find(e);
+        if (index == INVALID_INDEX)
         {
             return;
         }
-        ComponentIndex to_remove = entity_map_[e];
-        component_data_.data[to_remove] = component_data_.data[component_data_.size - 1];
-        entity_map_.erase(e);
-        component_data_.size -= 1;
+        components_.erase(slots_[index]);
+        sparseIndex(e) = INVALID_INDEX;
+        const ComponentIndex last = static_cast<ComponentIndex>(entities_.size() - 1);
+        if (index != last)
+        {
+            entities_[index] = entities_[last];
+            slots_[index] = slots_[last];
+            sparseIndex(entities_[index]) = index;
+        }
+        entities_.pop_back();
+        slots_.pop_back();
     }
 
     /**
@@ -69,16 +209,17 @@ template <typename T> class ComponentManager : public BaseComponentManager
      */
     bool has(Entity e) const override
     {
-        return entity_map_.find(e) != entity_map_.end();
+        return find(e) != INVALID_INDEX;
     }
     /**
      * Clears all components and entities from the manager
      */
     void clear()
     {
-        entity_map_.clear();
-        component_data_.data.clear();
-        component_data_.size = 0;
+        components_.clear();
+        entities_.clear();
+        slots_.clear();
+        pages_.clear();
     }
     /**
      * Get a pointer to the component of type T in the given entity
@@ -87,37 +228,84 @@ template <typename T> class ComponentManager : public BaseComponentManager
      */
     T *get(Entity e)
     {
-        if (entity_map_.find(e) == entity_map_.end())
+        const ComponentIndex index = find(e);
+        if (index == INVALID_INDEX)
         {
             throw std::runtime_error("Entity does not have requested component");
-            /*std::cerr << "Entity does not have requested component" << std::endl;
-            return nullptr;*/
         }
-        return &(component_data_.data[entity_map_[e]]);
+        return &components_[slots_[index]];
     }
     /**
      * Get a pointer to the component of type T in the given entity
      * @param e Entity
-     * @return Pointer to component of type T
+     * @return Pointer to component of type T, or nullptr if the entity does not have one
      */
     T *getUnsafe(Entity e)
     {
-        if (entity_map_.find(e) == entity_map_.end())
+        const ComponentIndex index = find(e);
+        return index != INVALID_INDEX ? &components_[slots_[index]] : nullptr;
+    }
+
+    /**
+     * Number of components
+     */
+    size_t size() const
+    {
+        return entities_.size();
+    }
+    /**
+     * Entities owning the components, in the same order as component()
+     */
+    const std::vector<Entity> &entities() const
+    {
+        return entities_;
+    }
+    /**
+     * Component at a position of the packed arrays
+     * @param i Position in [0, size())
+     * @return Component owned by entities()[i]
+     */
+    T &component(size_t i)
+    {
+        return components_[slots_[i]];
+    }
+
+  private:
+    typedef std::array<ComponentIndex, COMPONENT_INDEX_PAGE_SIZE> IndexPage;
+
+    // Position of an entity's component in the packed arrays, or INVALID_INDEX. Stale entities,
+    // whose ID now belongs to a newer generation, have no components.
+    ComponentIndex find(Entity e) const
+    {
+        const size_t page = e.id() / COMPONENT_INDEX_PAGE_SIZE;
+        if (page >= pages_.size() || pages_[page] == nullptr)
         {
-            return nullptr;
+            return INVALID_INDEX;
         }
-        return &(component_data_.data[entity_map_[e]]);
+        const ComponentIndex index = (*pages_[page])[e.id() % COMPONENT_INDEX_PAGE_SIZE];
+        return index != INVALID_INDEX && entities_[index] == e ? index : INVALID_INDEX;
     }
 
-  private:
-    struct ComponentData
+    // Entry of the sparse index for an entity, allocating its page if needed
+    ComponentIndex &sparseIndex(Entity e)
     {
-        unsigned int size = 1;
-        // std::array<T, 1024> data;
-        std::vector<T> data;
-    };
-    std::map<Entity, ComponentIndex> entity_map_;
-    ComponentData component_data_;
+        const size_t page = e.id() / COMPONENT_INDEX_PAGE_SIZE;
+        if (page >= pages_.size())
+        {
+            pages_.resize(page + 1);
+        }
+        if (pages_[page] == nullptr)
+        {
+            pages_[page] = std::make_unique<IndexPage>();
+            pages_[page]->fill(INVALID_INDEX);
+        }
+        return (*pages_[page])[e.id() % COMPONENT_INDEX_PAGE_SIZE];
+    }
+
+    ComponentPool<T> components_;                   /// Components in stable slots
+    std::vector<Entity> entities_;                  /// Packed owners of the components
+    std::vector<ComponentIndex> slots_;             /// Slot of each packed owner's component
+    std::vector<std::unique_ptr<IndexPage>> pages_; /// Sparse index from entity id to position
 };
 
 } // namespace rcube
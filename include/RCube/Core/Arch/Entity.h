@@ -6,30 +6,37 @@ namespace rcube
 
 /**
  * Entity is some object in the virtual world
- * Internally it just stores a unique unsigned int ID.
+ * Internally it stores an ID, which is the index of the entity's slot in the EntityManager, and
+ * a generation. IDs of removed entities are reused, but with a new generation, so handles to a
+ * removed entity never refer to the entity that takes its slot.
  */
 struct Entity
 {
     Entity() = default;
-    Entity(unsigned int id) : id_(id)
+    Entity(unsigned int id, unsigned int generation = 0) : id_(id), generation_(generation)
     {
     }
     unsigned int id() const
     {
         return id_;
     }
+    unsigned int generation() const
+    {
+        return generation_;
+    }
     bool operator==(const Entity &other) const
     {
-        return id_ == other.id_;
+        return id_ == other.id_ && generation_ == other.generation_;
     }
 
     bool operator<(const Entity &other) const
     {
-        return id_ < other.id_;
+        return id_ < other.id_ || (id_ == other.id_ && generation_ < other.generation_);
     }
 
   private:
-    unsigned int id_; /// Unique id of each entity
+    unsigned int id_;         /// Index of the entity, unique among existing entities
+    unsigned int generation_; /// Number of times the index was reused before this entity
 };
 
 } // namespace rcube
@@ -2,8 +2,8 @@
 #define ENTITYMANAGER_H
 
 #include "RCube/Core/Arch/Entity.h"
-#include <algorithm>
-#include <unordered_set>
+#include <cstdint>
+#include <functional>
 #include <vector>
 
 namespace std
@@ -12,7 +12,7 @@ template <> struct hash<rcube::Entity>
 {
     size_t operator()(const rcube::Entity &ent) const
     {
-        return hash<unsigned int>()(ent.id());
+        return hash<uint64_t>()((uint64_t(ent.generation()) << 32) | ent.id());
     }
 };
 } // namespace std
@@ -23,51 +23,64 @@ namespace rcube
 /**
  * EntityManager manages the lifetime of entities.
  * It supports creation of new entities while ensuring that each one has a unique ID,
- * removal of entities (which are later reused), and iteration through existing entities.
+ * removal of entities (whose IDs are later reused with a new generation), and iteration through
+ * existing entities.
+ *
+ * Every ID has a slot holding its current generation and the position of its entity in a dense
+ * list of existing entities, so checking whether an entity exists is a single array lookup and
+ * iteration visits a contiguous array.
  */
 class EntityManager
 {
   public:
-    EntityManager() : last_id(0)
-    {
-    }
+    EntityManager() = default;
     /**
      * Create a new entity with a unique ID
      * @return A new entity
      */
     Entity createEntity()
     {
-        // Reuse deleted entities if there are any
-        if (deleted_entities.size() > 0)
+        // Reuse the IDs of deleted entities if there are any
+        uint32_t id;
+        if (free_ids_.size() > 0)
+        {
+            id = free_ids_.back();
+            free_ids_.pop_back();
+        }
+        // Otherwise, create a new slot
+        else
         {
-            Entity ent = deleted_entities[deleted_entities.size() - 1];
-            deleted_entities.pop_back();
-            return ent;
+            id = static_cast<uint32_t>(slots_.size());
+            slots_.push_back(Slot{0, NO_ENTITY});
         }
-        // Otherwise, create a new entity
-        Entity ent = Entity(last_id++);
-        entities.insert(ent);
+        Slot &slot = slots_[id];
+        slot.dense = static_cast<uint32_t>(entities_.size());
+        Entity ent = Entity(id, slot.generation);
+        entities_.push_back(ent);
         return ent;
     }
 
     /**
      * Remove the given entity.
-     * This entity will be reused in future.
+     * Its ID will be reused in future, and handles to it become invalid.
      * @param ent Entity to be removed
      */
     void removeEntity(const Entity &ent)
     {
-        // Check if entity exists
-        auto ent_iter = entities.find(ent);
         // Return if entity does not exist
-        if (ent_iter == entities.end())
+        if (!hasEntity(ent))
         {
             return;
         }
-        // Move entity to deleted list for reusing in future
-        deleted_entities.push_back(*ent_iter);
-        // Delete entity from entities list
-        entities.erase(ent_iter);
+        Slot &slot = slots_[ent.id()];
+        // Move the last entity into the removed one's place in the dense list
+        const Entity last = entities_.back();
+        entities_[slot.dense] = last;
+        slots_[last.id()].dense = slot.dense;
+        entities_.pop_back();
+        slot.dense = NO_ENTITY;
+        ++slot.generation;
+        free_ids_.push_back(ent.id());
     }
 
     /**
@@ -77,18 +90,35 @@ class EntityManager
      */
     bool hasEntity(const Entity &ent) const
     {
-        return entities.find(ent) != entities.end();
+        return ent.id() < slots_.size() && slots_[ent.id()].generation == ent.generation() &&
+               slots_[ent.id()].dense != NO_ENTITY;
     }
 
     size_t count() const
     {
-        return entities.size();
+        return entities_.size();
     }
 
-  public:
-    std::unordered_set<Entity> entities;  /// Set of active entities
-    unsigned int last_id;                 /// Keep track of last assigned id to entity
-    std::vector<Entity> deleted_entities; /// List of deleted entities
+    /**
+     * Existing entities, in no particular order
+     */
+    const std::vector<Entity> &entities() const
+    {
+        return entities_;
+    }
+
+  private:
+    static constexpr uint32_t NO_ENTITY = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t generation; /// Generation of the current or next entity with this ID
+        uint32_t dense;      /// Position of the entity in entities_, or NO_ENTITY
+    };
+
+    std::vector<Slot> slots_;        /// Indexed by entity ID
+    std::vector<Entity> entities_;   /// Dense list of existing entities
+    std::vector<uint32_t> free_ids_; /// IDs of deleted entities
 };
 
 } // namespace rcube
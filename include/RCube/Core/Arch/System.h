@@ -2,6 +2,7 @@
 #define SYSTEM_H
 
 #include "RCube/Core/Arch/Entity.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
 #include <algorithm>
 #include <bitset>
 #include <functional>
@@ -11,6 +12,9 @@
 namespace rcube
 {
 
+/// Number of component types a ComponentMask can hold
+constexpr size_t MAX_COMPONENT_TYPES = 8;
+
 /**
  * ComponentMask is a bitset where bits at a particular position (from Component::family())
  * representing a component can be set. This is used to filter entities based on components of
@@ -28,11 +32,11 @@ struct ComponentMask
             set(x);
         }
     }
-    std::bitset<8> bits;
+    std::bitset<MAX_COMPONENT_TYPES> bits;
     void set(size_t pos, bool flag = true);
     void reset(size_t pos);
-    bool match(const ComponentMask &other);
-    bool equal(const ComponentMask &other);
+    bool match(const ComponentMask &other) const;
+    bool equal(const ComponentMask &other) const;
     std::string to_string() const;
 };
 
@@ -49,7 +53,7 @@ template <> struct hash<rcube::ComponentMask>
     typedef std::size_t result_type;
     result_type operator()(argument_type const &cm) const noexcept
     {
-        return std::hash<std::bitset<8>>{}(cm.bits);
+        return std::hash<std::bitset<rcube::MAX_COMPONENT_TYPES>>{}(cm.bits);
     }
 };
 } // namespace std
@@ -130,6 +134,32 @@ class System
                                          [&](const Entity &ent) { return ent.id() == e.id(); }),
                           entity_list.end());
     }
+    /**
+     * Registers several entities at once, like calling registerEntity() for each of them
+     * @param entities Entities
+     * @param sign Signature to classify these entities
+     */
+    virtual void registerEntities(const std::vector<Entity> &entities, ComponentMask sign)
+    {
+        std::vector<Entity> &entity_list = registered_entities_[sign];
+        entity_list.insert(entity_list.end(), entities.begin(), entities.end());
+    }
+    /**
+     * Unregisters several entities at once in a single pass over the registered entities, like
+     * calling unregisterEntity() for each of them
+     * @param entities Entities, sorted by id
+     * @param sign Signature to classify these entities
+     */
+    virtual void unregisterEntities(const std::vector<Entity> &entities, ComponentMask sign)
+    {
+        std::vector<Entity> &entity_list = registered_entities_[sign];
+        entity_list.erase(std::remove_if(entity_list.begin(), entity_list.end(),
+                                         [&](const Entity &ent) {
+                                             return std::binary_search(entities.begin(),
+                                                                       entities.end(), ent);
+                                         }),
+                          entity_list.end());
+    }
     /**
      * List of filters that are used to handle entities with varying combinations of
      * components
@@ -142,10 +172,130 @@ class System
 
     virtual unsigned int priority() const = 0;
 
+    /**
+     * Whether update() must run on the main thread, e.g., because it issues OpenGL calls. Other
+     * systems may run on worker threads of the ThreadPool, concurrently with systems that do not
+     * access the same components (see readsComponents() and writesComponents()).
+     */
+    virtual bool mainThreadOnly() const
+    {
+        return true;
+    }
+
+    /**
+     * Whether the system declared the components it accesses with declareReads() and
+     * declareWrites(). Systems that did not are assumed to read and write all components.
+     */
+    bool declaresAccess() const
+    {
+        return declares_access_;
+    }
+
+    /**
+     * Components read by update()
+     */
+    const ComponentMask &readsComponents() const
+    {
+        return reads_;
+    }
+
+    /**
+     * Components written by update()
+     */
+    const ComponentMask &writesComponents() const
+    {
+        return writes_;
+    }
+
   protected:
+    /**
+     * Calls a function for every entity registered under a filter, in parallel: the entities
+     * are split into chunks of grain entities that run as tasks of the shared ThreadPool. The
+     * function must only modify data of the entity it is given.
+     * @param filter Component mask filter passed to addFilter()
+     * @param fn Callable with signature void(Entity e)
+     * @param grain Number of consecutive entities per task
+     */
+    template <typename Fn>
+    void parallelForEach(const ComponentMask &filter, Fn &&fn, size_t grain = 256)
+    {
+        const std::vector<Entity> &entities = getFilteredEntities(filter);
+        ThreadPool::instance().parallelFor(
+            0, entities.size(), [&](size_t i) { fn(entities[i]); }, grain);
+    }
+
+    /**
+     * Like parallelForEach(filter, fn, grain), but gives the function scratch data owned by the
+     * calling thread, e.g., to accumulate statistics or bounds without locking. Every thread
+     * starts from a copy of init, and the copies of the threads that processed entities are
+     * combined at the end. Which entities end up in which copy depends on scheduling, so reduce
+     * should be associative and commutative.
+     * @param filter Component mask filter passed to addFilter()
+     * @param init Initial value of the scratch data and of the result
+     * @param fn Callable with signature void(Entity e, Scratch &scratch)
+     * @param reduce Callable with signature void(Scratch &result, const Scratch &scratch) that
+     * merges one thread's scratch data into the result
+     * @param grain Number of consecutive entities per task
+     * @return init merged with the scratch data of all threads
+     */
+    template <typename Scratch, typename Fn, typename Reduce>
+    Scratch parallelForEach(const ComponentMask &filter, const Scratch &init, Fn &&fn,
+                            Reduce &&reduce, size_t grain = 256)
+    {
+        ThreadPool &pool = ThreadPool::instance();
+        // One slot per worker plus one for a caller that is not a worker (see workerIndex());
+        // slots are cache-line aligned so threads do not write to the same line
+        struct alignas(64) Slot
+        {
+            Scratch scratch;
+            bool used;
+        };
+        std::vector<Slot> slots(pool.size() + 1, Slot{init, false});
+        parallelForEach(
+            filter,
+            [&](Entity e) {
+                Slot &slot = slots[pool.workerIndex()];
+                slot.used = true;
+                fn(e, slot.scratch);
+            },
+            grain);
+        Scratch result = init;
+        for (const Slot &slot : slots)
+        {
+            if (slot.used)
+            {
+                reduce(result, slot.scratch);
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Declares component types read by update(), e.g., declareReads<Transform, Camera>()
+     */
+    template <typename... ComponentTypes> void declareReads()
+    {
+        (reads_.set(ComponentTypes::family()), ...);
+        declares_access_ = true;
+    }
+
+    /**
+     * Declares component types written by update(), e.g., declareWrites<Camera>()
+     */
+    template <typename... ComponentTypes> void declareWrites()
+    {
+        (writes_.set(ComponentTypes::family()), ...);
+        declares_access_ = true;
+    }
+
     std::unordered_map<ComponentMask, std::vector<Entity>> registered_entities_;
     std::vector<ComponentMask> filters_;
     World *world_;
+
+  private:
+    ComponentMask reads_;
+    ComponentMask writes_;
+    bool declares_access_ = false;
 };
 
 } // namespace rcube
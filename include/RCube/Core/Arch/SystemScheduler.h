@@ -0,0 +1,55 @@
+#ifndef SYSTEMSCHEDULER_H
+#define SYSTEMSCHEDULER_H
+
+#include "RCube/Core/Arch/System.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include <cstdint>
+#include <vector>
+
+namespace rcube
+{
+
+/**
+ * Runs the update() of a list of systems, in parallel where their declared component accesses
+ * allow it.
+ *
+ * Two systems conflict if one writes a component type that the other reads or writes; systems
+ * that do not declare their accesses conflict with every other system. Conflicting systems run
+ * in the order of the list (i.e., by priority), while the others may run concurrently: systems
+ * that are not mainThreadOnly() run as tasks of a ThreadPool, and the rest run on the thread
+ * calling run() as soon as the systems they depend on are done.
+ */
+class SystemScheduler
+{
+  public:
+    SystemScheduler() = default;
+
+    /**
+     * Builds the dependency graph
+     * @param systems Systems in the order in which conflicting ones must run
+     */
+    void build(const std::vector<System *> &systems);
+
+    /**
+     * Runs update(false) once for every system and waits for all of them. Exceptions thrown by
+     * the systems are rethrown once all systems are done; the systems depending on a system
+     * that threw still run.
+     * @param pool Pool running the systems that are not pinned to the main thread
+     */
+    void run(ThreadPool &pool);
+
+    /**
+     * Indices of the systems that must wait for a system
+     * @param i Index of the system in the list passed to build()
+     */
+    const std::vector<uint32_t> &dependents(size_t i) const;
+
+  private:
+    std::vector<System *> systems_;
+    std::vector<std::vector<uint32_t>> dependents_;
+    std::vector<uint32_t> num_dependencies_;
+};
+
+} // namespace rcube
+
+#endif // SYSTEMSCHEDULER_H
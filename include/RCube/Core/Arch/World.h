@@ -4,18 +4,98 @@
 #include "RCube/Core/Arch/ComponentManager.h"
 #include "RCube/Core/Arch/EntityManager.h"
 #include "RCube/Core/Arch/System.h"
+#include "RCube/Core/Arch/SystemScheduler.h"
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <tuple>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace rcube
 {
 
 struct EntityHandle;
 
+class CommandBuffer;
+
 template <typename Container> class EntityHandleIterator;
 
+/**
+ * Group of entities that have exactly the same set of components
+ */
+struct Archetype
+{
+    ComponentMask mask;           /// Components of the entities
+    std::vector<Entity> entities; /// Entities in no particular order
+};
+
+/**
+ * Typed view over all entities that have a given set of components, obtained from
+ * World::view(). Only the archetypes that contain all the components are visited, so entities
+ * are never checked one by one, and their components are found through the O(1) sparse index of
+ * each ComponentManager.
+ *
+ * A view must not be used after components or entities are added or removed.
+ */
+template <typename... Ts> class View
+{
+  public:
+    View(const std::vector<Archetype> &archetypes, ComponentManager<Ts> *... managers)
+        : archetypes_(&archetypes), managers_(managers...)
+    {
+        (mask_.set(Ts::family()), ...);
+    }
+
+    /**
+     * Calls a function for every entity in the view
+     * @param fn Callable with signature void(Entity entity, Ts &... components); it may modify
+     * the components but must not add or remove components or entities
+     */
+    template <typename Fn> void forEach(Fn &&fn) const
+    {
+        for (const Archetype &archetype : *archetypes_)
+        {
+            if (!archetype.mask.match(mask_))
+            {
+                continue;
+            }
+            for (Entity e : archetype.entities)
+            {
+                fn(e, *std::get<ComponentManager<Ts> *>(managers_)->getUnsafe(e)...);
+            }
+        }
+    }
+
+    /**
+     * Number of entities in the view
+     */
+    size_t size() const
+    {
+        size_t count = 0;
+        for (const Archetype &archetype : *archetypes_)
+        {
+            if (archetype.mask.match(mask_))
+            {
+                count += archetype.entities.size();
+            }
+        }
+        return count;
+    }
+
+  private:
+    const std::vector<Archetype> *archetypes_;
+    std::tuple<ComponentManager<Ts> *...> managers_;
+    ComponentMask mask_;
+};
+
 /**
  * World is the primary interface and allows the user to create entities,
  * add/remove components to entities, and add/remove systems to process components.
@@ -50,6 +130,10 @@ class World
     template <typename ComponentType>
     void addComponent(Entity entity, ComponentType comp = ComponentType())
     {
+        if (!entity_mgr_.hasEntity(entity))
+        {
+            throw std::runtime_error("Cannot add a component to an entity that does not exist");
+        }
         ComponentManager<ComponentType> *manager = getComponentManager<ComponentType>();
         manager->add(entity, comp);
         updateEntityToSystem(entity, ComponentType::family(), true);
@@ -63,6 +147,10 @@ class World
      */
     template <typename ComponentType> void removeComponent(Entity entity)
     {
+        if (!entity_mgr_.hasEntity(entity))
+        {
+            return;
+        }
         ComponentManager<ComponentType> *manager = getComponentManager<ComponentType>();
         manager->remove(entity);
         updateEntityToSystem(entity, ComponentType::family(), false);
@@ -90,6 +178,25 @@ class World
         return manager->getUnsafe(entity);
     }
 
+    /**
+     * Typed view over all entities that have at least the given components, e.g.,
+     * world.view<Transform, Drawable>().forEach([](Entity e, Transform &tr, Drawable &dr) {...})
+     * @return View over the matching entities
+     */
+    template <typename... ComponentTypes> View<ComponentTypes...> view()
+    {
+        return View<ComponentTypes...>(archetypes_, getComponentManager<ComponentTypes>()...);
+    }
+
+    /**
+     * Entities grouped by their set of components. Archetypes are created as new combinations of
+     * components appear and are never removed, so indices into this list stay valid.
+     */
+    const std::vector<Archetype> &archetypes() const
+    {
+        return archetypes_;
+    }
+
     /**
      * Adds a system that will process certain components
      */
@@ -116,7 +223,7 @@ class World
      * Iterate through all existing entities using a range for loop
      * @return Proxy iterator for entities that will work with a range for loop
      */
-    EntityHandleIterator<std::unordered_set<Entity>> entities();
+    EntityHandleIterator<std::vector<Entity>> entities();
 
     /**
      * Number of entities in the world
@@ -137,29 +244,72 @@ class World
     }
 
     /**
-     * Update the world (usually called in the game loop)
+     * Update the world (usually called in the game loop). Systems run in priority order, except
+     * that systems which declared non-conflicting component accesses may run concurrently on the
+     * shared ThreadPool (see SystemScheduler).
      */
     void update();
 
   protected:
+    friend class CommandBuffer;
+
+    /**
+     * Position of an entity in the archetypes
+     */
+    struct EntityLocation
+    {
+        uint32_t archetype = UINT32_MAX; /// Index in archetypes_, UINT32_MAX if no components
+        uint32_t row = 0;                /// Index in the archetype's entities
+    };
+
     void updateEntityToSystem(Entity ent, int component_family, bool flag);
 
+    // Registers or unregisters an entity with the systems whose filters it starts or stops
+    // matching when its components change from old_mask to new_mask
+    void updateSystems(Entity ent, const ComponentMask &old_mask, const ComponentMask &new_mask);
+
+    ComponentMask entityMask(Entity ent) const;
+
+    // Moves an entity to the archetype of the given components
+    void moveToArchetype(Entity ent, const ComponentMask &mask);
+
     template <typename ComponentType> ComponentManager<ComponentType> *getComponentManager()
     {
-        auto it = component_mgrs_.find(ComponentType::family());
-        if (it == component_mgrs_.end())
+        // Safe to call from systems running in parallel: existing managers are found without
+        // locking, and creating a missing one is serialized by component_mgrs_mutex_
+        const unsigned int family = ComponentType::family();
+        if (family >= MAX_COMPONENT_TYPES)
         {
-            component_mgrs_[ComponentType::family()] =
-                std::make_unique<ComponentManager<ComponentType>>();
+            throw std::runtime_error("More than " + std::to_string(MAX_COMPONENT_TYPES) +
+                                     " component types are not supported");
+        }
+        BaseComponentManager *mgr = component_mgr_lookup_[family].load(std::memory_order_acquire);
+        if (mgr == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(component_mgrs_mutex_);
+            mgr = component_mgr_lookup_[family].load(std::memory_order_relaxed);
+            if (mgr == nullptr)
+            {
+                auto it = component_mgrs_.emplace(
+                    family, std::make_unique<ComponentManager<ComponentType>>());
+                mgr = it.first->second.get();
+                component_mgr_lookup_[family].store(mgr, std::memory_order_release);
+            }
         }
-        const auto &mgr = component_mgrs_[ComponentType::family()];
-        return static_cast<ComponentManager<ComponentType> *>(mgr.get());
+        return static_cast<ComponentManager<ComponentType> *>(mgr);
     }
 
     std::vector<std::unique_ptr<System>> systems_;
+    SystemScheduler scheduler_;
+    bool scheduler_outdated_ = true; /// Systems were added since the scheduler was built
     std::map<int, std::unique_ptr<BaseComponentManager>> component_mgrs_;
+    /// Managers in component_mgrs_ by family, for lookups that do not lock
+    std::array<std::atomic<BaseComponentManager *>, MAX_COMPONENT_TYPES> component_mgr_lookup_{};
+    std::mutex component_mgrs_mutex_; /// Serializes the creation of managers
     EntityManager entity_mgr_;
-    std::map<Entity, ComponentMask> entity_masks_;
+    std::vector<Archetype> archetypes_;
+    std::unordered_map<ComponentMask, uint32_t> archetype_indices_;
+    std::vector<EntityLocation> entity_locations_; /// Indexed by entity id
 };
 
 /**
@@ -212,7 +362,8 @@ struct EntityHandle
     }
 
     /**
-     * Check whether this handle is valid
+     * Check whether this handle is valid, i.e., its entity has not been removed. Handles to a
+     * removed entity stay invalid after its ID is reused.
      * @return Whether valid
      */
     bool valid() const
@@ -228,11 +379,11 @@ struct EntityHandle
 template <typename Container> class EntityHandleIterator
 {
   public:
-    EntityHandleIterator(World *world, Container &cnt)
+    EntityHandleIterator(World *world, const Container &cnt)
     {
         world_ = world;
-        curr_ = cnt.begin();
-        end_ = cnt.end();
+        curr_ = cnt.cbegin();
+        end_ = cnt.cend();
     }
     EntityHandle next()
     {
@@ -245,7 +396,7 @@ template <typename Container> class EntityHandleIterator
 
   private:
     World *world_;
-    typename Container::iterator curr_, end_;
+    typename Container::const_iterator curr_, end_;
 };
 
 } // namespace rcube
@@ -1,11 +1,15 @@
 #pragma once
 
 #include "RCube/Core/Accel/BVH.h"
+#include "RCube/Core/Accel/TriangleMeshView.h"
+#include "RCube/Core/Accel/TriangleSoA.h"
+#include "RCube/Core/Accel/WideBVH.h"
 #include "RCube/Core/Graphics/OpenGL/AttributeBuffer.h"
 #include "RCube/Core/Graphics/OpenGL/Buffer.h"
 #include "RCube/Core/Graphics/OpenGL/GLDataType.h"
 #include "glad/glad.h"
 #include "glm/glm.hpp"
+#include <limits>
 #include <map>
 #include <memory>
 #include <string>
@@ -64,7 +68,10 @@ class Mesh
     std::shared_ptr<AttributeIndexBuffer> indices_;
     std::map<std::string, bool> attributes_enabled_; 
     bool init_ = false;
-    BVHNodePtr bvh_;  // Bounding Volume Hierarchy for intersection queries
+    BVH bvh_;  // Bounding Volume Hierarchy over faces for intersection queries
+    BVHBuildMethod bvh_method_ = BVHBuildMethod::BinnedSAH;  // Used again when refits rebuild
+    TriangleSoA bvh_triangles_;  // Faces in BVH leaf order for SIMD ray queries
+    WideBVH wide_bvh_;  // bvh_ collapsed to four-wide nodes for single-ray queries
 
   public:
     Mesh() = default;
@@ -132,15 +139,180 @@ class Mesh
 
     size_t numIndexData() const;
 
-    void updateBVH();
+    /**
+     * Rebuilds the Bounding Volume Hierarchy over the mesh's triangles, used by rayIntersect().
+     * Call this after changing the positions or indices.
+     * @param method Build algorithm: BinnedSAH gives the fastest queries, LBVH/TreeletLBVH build
+     * in parallel and are much faster to build for large meshes
+     * @param cache_dir Optional directory for cached BVHs. A BVH previously saved there for the
+     * same positions, indices and build method is memory-mapped instead of being rebuilt; a newly
+     * built one is saved there if possible; failing to save it is reported but not an error.
+     */
+    void updateBVH(BVHBuildMethod method = BVHBuildMethod::BinnedSAH,
+                   const std::string &cache_dir = "");
+
+    /**
+     * Updates the BVH for deforming meshes, where positions change but the faces stay the same:
+     * node bounds are recomputed in parallel while the tree topology is kept. Falls back to a
+     * full updateBVH() with the last build method if there is no tree for the current faces, or
+     * if refitting has made the tree's SAH cost more than max_cost_ratio times its cost when it
+     * was built.
+     * @param max_cost_ratio Tolerated growth of the SAH cost before rebuilding
+     * @return Whether the tree was refit (true) or rebuilt (false)
+     */
+    bool refitBVH(float max_cost_ratio = BVH_REFIT_MAX_COST_RATIO);
+
+    /**
+     * Bounding Volume Hierarchy over the faces (empty until updateBVH() is called)
+     */
+    const BVH &bvh() const
+    {
+        return bvh_;
+    }
+
+    /**
+     * Face vertices in the BVH's leaf order, for fast ray queries through
+     * TriangleSoA::rayIntersect(bvh(), ...) (empty until updateBVH() is called)
+     */
+    const TriangleSoA &bvhTriangles() const
+    {
+        return bvh_triangles_;
+    }
+
+    /**
+     * The BVH collapsed to a four-wide tree with quantized bounds, which rayIntersect(const Ray &,
+     * ...) and occluded(const Ray &) traverse together with bvhTriangles() (empty until
+     * updateBVH() is called)
+     */
+    const WideBVH &wideBVH() const
+    {
+        return wide_bvh_;
+    }
 
     bool rayIntersect(const Ray &ray, glm::vec3 &pt, size_t &id);
 
+    /**
+     * Finds the closest intersection of each ray with the mesh. Rays are traced in packets of
+     * RAY_PACKET_SIZE through the BVH, distributed over all threads, so coherent rays (e.g., a
+     * tile of camera rays) should be adjacent in the list. Hits match rayIntersect(const Ray &,
+     * glm::vec3 &, size_t &). updateBVH() must have been called.
+     * @param rays Rays in model space
+     * @param hits Closest hit for every ray (resized to rays.size())
+     */
+    void rayIntersect(const std::vector<Ray> &rays, std::vector<RayHit> &hits);
+
+    /**
+     * Checks whether a ray hits the mesh anywhere within [ray.tmin(), ray.tmax()]. Cheaper than
+     * rayIntersect() since traversal stops at the first hit found. updateBVH() must have been
+     * called.
+     * @param ray Ray in model space
+     * @return Whether any face was hit
+     */
+    bool occluded(const Ray &ray);
+
+    /**
+     * Checks whether each ray hits the mesh within its [tmin, tmax]. Rays are traced in packets
+     * of RAY_PACKET_SIZE, distributed over all threads.
+     * @param rays Rays in model space
+     * @param occluded 1 for rays that hit the mesh, 0 otherwise (resized to rays.size())
+     */
+    void occluded(const std::vector<Ray> &rays, std::vector<uint8_t> &occluded);
+
+    /**
+     * Finds every intersection of a ray with the mesh within [ray.tmin(), ray.tmax()].
+     * updateBVH() must have been called.
+     * @param ray Ray in model space
+     * @param hits All hits, sorted by increasing ray parameter
+     */
+    void rayIntersectAll(const Ray &ray, std::vector<RayHit> &hits);
+
+    /**
+     * Finds every intersection of each ray with the mesh, distributing the rays over all threads
+     * @param rays Rays in model space
+     * @param hits Hits of every ray sorted by increasing ray parameter (resized to rays.size())
+     */
+    void rayIntersectAll(const std::vector<Ray> &rays, std::vector<std::vector<RayHit>> &hits);
+
+    /**
+     * Finds the point on the mesh closest to a given point. updateBVH() must have been called.
+     * @param p Query point in model space
+     * @param hit Closest point, its face and barycentric coordinates
+     * @param max_distance Faces farther than this are ignored
+     * @return Whether a face was found within max_distance
+     */
+    bool closestPoint(const glm::vec3 &p, ClosestPointHit &hit,
+                      float max_distance = std::numeric_limits<float>::infinity());
+
+    /**
+     * Finds the closest point on the mesh for each query point, distributing the queries over
+     * all threads
+     * @param points Query points in model space
+     * @param hits Closest point for every query point (resized to points.size())
+     * @param max_distance Faces farther than this are ignored
+     */
+    void closestPoint(const std::vector<glm::vec3> &points, std::vector<ClosestPointHit> &hits,
+                      float max_distance = std::numeric_limits<float>::infinity());
+
+    /**
+     * Finds all faces overlapping a box. updateBVH() must have been called.
+     * @param box Query box in model space
+     * @param faces Indices of the overlapping faces, in no particular order
+     */
+    void rangeQuery(const AABB &box, std::vector<uint32_t> &faces);
+
+    /**
+     * Finds all faces overlapping a sphere. updateBVH() must have been called.
+     * @param sphere Query sphere in model space
+     * @param faces Indices of the overlapping faces, in no particular order
+     */
+    void rangeQuery(const Sphere &sphere, std::vector<uint32_t> &faces);
+
+    /**
+     * Finds the faces overlapping a frustum. The test is conservative: faces just outside the
+     * frustum's edges may be included. updateBVH() must have been called.
+     * @param frustum Query frustum in model space
+     * @param faces Indices of the overlapping faces, in no particular order
+     */
+    void rangeQuery(const Frustum &frustum, std::vector<uint32_t> &faces);
+
+    /**
+     * Finds all pairs of intersecting faces between this mesh and another one, with both meshes
+     * placed in a common space by their transforms. The BVHs are traversed together in parallel
+     * and candidate faces are checked with a triangle-triangle test; faces that only touch
+     * count as intersecting. updateBVH() must have been called on both meshes.
+     * @param transform Model matrix of this mesh
+     * @param other Other mesh
+     * @param other_transform Model matrix of the other mesh
+     * @param pairs Intersecting pairs (face of this mesh, face of other), in no particular order
+     */
+    void intersectingFaces(const glm::mat4 &transform, Mesh &other,
+                           const glm::mat4 &other_transform,
+                           std::vector<std::pair<uint32_t, uint32_t>> &pairs);
+
+    /**
+     * Checks whether this mesh intersects another one, like intersectingFaces() but stopping at
+     * the first intersecting pair found. updateBVH() must have been called on both meshes.
+     * @param transform Model matrix of this mesh
+     * @param other Other mesh
+     * @param other_transform Model matrix of the other mesh
+     * @return Whether any two faces intersect
+     */
+    bool intersects(const glm::mat4 &transform, Mesh &other, const glm::mat4 &other_transform);
+
     void enableAttribute(std::string name);
 
     void disableAttribute(std::string name);
 
+    /**
+     * Non-owning view of the triangles' vertex positions and indices, valid until the positions
+     * or indices are modified. Empty for meshes without positions.
+     */
+    TriangleMeshView triangles();
+
   private:
+    template <typename Region>
+    void facesInRegion(const Region &region, std::vector<uint32_t> &faces);
+
     void setDefaultValue(GLuint id, const glm::vec3 &val);
 
     void setDefaultValue(GLuint id, const glm::vec2 &val);
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rcube
+{
+
+/**
+ * Set of tasks submitted to a ThreadPool that can be waited on together
+ */
+class TaskGroup
+{
+  public:
+    TaskGroup() = default;
+
+    TaskGroup(const TaskGroup &other) = delete;
+
+    TaskGroup &operator=(const TaskGroup &other) = delete;
+
+    /**
+     * Whether all tasks submitted to the group have finished
+     */
+    bool done() const
+    {
+        return pending_.load(std::memory_order_acquire) == 0;
+    }
+
+  private:
+    friend class ThreadPool;
+    std::atomic<size_t> pending_{0};
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+};
+
+/**
+ * Pool of worker threads with work stealing. Every worker has its own task queue: tasks
+ * submitted from a worker go to its queue and are run newest-first by that worker, while idle
+ * workers steal the oldest tasks from other queues. This keeps recursively split work local and
+ * balances uneven tasks (e.g., image tiles of varying cost) automatically.
+ *
+ * Threads that wait on a TaskGroup run queued tasks while waiting, so waiting from inside a task
+ * does not deadlock.
+ */
+class ThreadPool
+{
+  public:
+    /**
+     * Starts the workers
+     * @param num_threads Number of worker threads (at least 1)
+     */
+    explicit ThreadPool(size_t num_threads);
+
+    ThreadPool(const ThreadPool &other) = delete;
+
+    ThreadPool &operator=(const ThreadPool &other) = delete;
+
+    /**
+     * Finishes queued tasks and joins the workers
+     */
+    ~ThreadPool();
+
+    /**
+     * Pool shared by the library, with one worker per hardware thread
+     */
+    static ThreadPool &instance();
+
+    size_t size() const;
+
+    /**
+     * Queues a task
+     * @param group Group the task belongs to
+     * @param task Task to run; exceptions it throws are rethrown by wait()
+     */
+    void submit(TaskGroup &group, std::function<void()> task);
+
+    /**
+     * Runs queued tasks until all tasks of the group are done, then rethrows the first exception
+     * thrown by any of them
+     * @param group Group to wait for
+     */
+    void wait(TaskGroup &group);
+
+    /**
+     * Calls fn(i) for every i in [begin, end) as separate tasks of grain indices each and waits
+     * for them
+     * @param begin First index
+     * @param end One past the last index
+     * @param fn Callable with signature void(size_t i)
+     * @param grain Number of consecutive indices per task
+     */
+    template <typename Fn> void parallelFor(size_t begin, size_t end, Fn &&fn, size_t grain = 1)
+    {
+        grain = grain == 0 ? 1 : grain;
+        TaskGroup group;
+        for (size_t b = begin; b < end; b += grain)
+        {
+            const size_t e = b + grain < end ? b + grain : end;
+            submit(group, [&fn, b, e]() {
+                for (size_t i = b; i < e; ++i)
+                {
+                    fn(i);
+                }
+            });
+        }
+        wait(group);
+    }
+
+    /**
+     * Index of the calling thread's worker in [0, size()), or size() if the caller is not one of
+     * this pool's workers. Useful to index per-thread scratch data.
+     */
+    size_t workerIndex() const;
+
+  private:
+    struct Task
+    {
+        std::function<void()> fn;
+        TaskGroup *group;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void run(size_t index);
+
+    bool tryRunTask(size_t self);
+
+    void execute(Task &task);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> next_queue_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+};
+
+} // namespace rcube
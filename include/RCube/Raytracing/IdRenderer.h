@@ -0,0 +1,110 @@
+#pragma once
+
+#include "RCube/Core/Arch/World.h"
+#include "RCube/Raytracing/RaytracingScene.h"
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace rcube
+{
+
+class Camera;
+
+/// Value of IdBuffer::entities and IdBuffer::triangles in pixels where nothing was hit
+constexpr uint32_t ID_BUFFER_NONE = std::numeric_limits<uint32_t>::max();
+
+/**
+ * Per-pixel entity ids, triangle ids and depth rendered by an IdRenderer. Pixels are stored row
+ * by row with the top row first.
+ */
+struct IdBuffer
+{
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> entities;  /// Id of the entity seen through each pixel
+    std::vector<uint32_t> triangles; /// Index of the triangle seen in its entity's mesh
+    /// View-space depth (distance from the camera's plane) of the surface seen through each
+    /// pixel, or infinity where nothing was hit
+    std::vector<float> depth;
+
+    /**
+     * Index of a pixel in the arrays
+     * @param x Column, from the left
+     * @param y Row, from the top
+     */
+    size_t index(int x, int y) const
+    {
+        return static_cast<size_t>(y) * width + x;
+    }
+};
+
+/**
+ * Settings of an IdRenderer
+ */
+struct IdRendererSettings
+{
+    int width = 0;      /// Image width; 0 uses the camera's viewport width
+    int height = 0;     /// Image height; 0 uses the camera's viewport height
+    int tile_size = 32; /// Pixels are cast in square tiles of this size
+};
+
+/**
+ * Renders the entity, triangle and depth seen through each pixel of a camera by casting one ray
+ * through every pixel center on the CPU, e.g., for picking under the mouse or visibility
+ * analysis without an OpenGL context.
+ *
+ * Rays are cast through the same two-level hierarchy as the PathTracer, but only the closest
+ * hit is computed, without any shading. The image is split into tiles that are cast as tasks of
+ * the shared ThreadPool, and the rays of each 2x2 block of pixels are traced together as a
+ * RayPacket4, testing their boxes and triangles with SIMD instructions.
+ */
+class IdRenderer
+{
+  public:
+    IdRenderer() = default;
+
+    explicit IdRenderer(const IdRendererSettings &settings);
+
+    IdRendererSettings &settings()
+    {
+        return settings_;
+    }
+
+    const IdRendererSettings &settings() const
+    {
+        return settings_;
+    }
+
+    /**
+     * Renders the world as seen from a camera. The camera's matrices and the transforms are used
+     * as last computed by the CameraSystem and TransformSystem, i.e., in World::update().
+     * @param world World to render
+     * @param camera Entity with Camera and Transform components
+     * @return Ids and depth of every pixel
+     */
+    IdBuffer render(World &world, Entity camera);
+
+    /**
+     * Renders a snapshot of the world that is already up to date, reusing the buffer's storage,
+     * e.g., to render every frame or several views of the same scene
+     * @param scene Scene snapshot
+     * @param camera Camera whose view is rendered
+     * @param buffer Ids and depth of every pixel
+     */
+    void render(const RaytracingScene &scene, const Camera &camera, IdBuffer &buffer) const;
+
+    /**
+     * Scene snapshot used by the last call to render(World &, Entity)
+     */
+    const RaytracingScene &scene() const
+    {
+        return scene_;
+    }
+
+  private:
+    IdRendererSettings settings_;
+    RaytracingScene scene_;
+};
+
+} // namespace rcube
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "RCube/Core/Arch/World.h"
+#include "RCube/Core/Graphics/OpenGL/Image.h"
+#include "RCube/Raytracing/RaytracingScene.h"
+#include "glm/glm.hpp"
+#include <cstdint>
+
+namespace rcube
+{
+
+class Camera;
+
+/**
+ * Settings of a PathTracer
+ */
+struct PathTracerSettings
+{
+    int width = 0;               /// Image width; 0 uses the camera's viewport width
+    int height = 0;              /// Image height; 0 uses the camera's viewport height
+    int samples_per_pixel = 16;  /// Paths traced through every pixel
+    int max_bounces = 4;         /// Maximum number of indirect bounces per path
+    int tile_size = 16;          /// Pixels are rendered in square tiles of this size
+    uint32_t seed = 0;           /// Seed for the random numbers; renders are reproducible
+    /// Radiance arriving from the sky along indirect rays. The default approximates the
+    /// rasterizer's constant ambient term.
+    glm::vec3 environment = glm::vec3(0.03f);
+};
+
+/**
+ * Renders a World on the CPU by path tracing, as a reference for the OpenGL renderer.
+ *
+ * Surfaces use the same Cook-Torrance BRDF as the deferred renderer's lighting pass (GGX normal
+ * distribution, Smith-Schlick geometry term and Schlick's Fresnel approximation with a Lambertian
+ * diffuse lobe) with the constant albedo, roughness and metallic values of their Material;
+ * textures are not sampled. Point and directional lights are sampled directly with shadow rays,
+ * and indirect light is gathered by sampling the BRDF. Camera rays that miss everything see the
+ * camera's background color, and the result is gamma corrected like the rasterizer's output.
+ *
+ * The image is split into tiles that are rendered as tasks of the shared ThreadPool, so rendering
+ * scales with the number of cores, and the work stealing balances tiles of uneven cost. Random
+ * numbers are derived from the pixel and sample index, so the image does not depend on the
+ * number of threads.
+ */
+class PathTracer
+{
+  public:
+    PathTracer() = default;
+
+    explicit PathTracer(const PathTracerSettings &settings);
+
+    PathTracerSettings &settings()
+    {
+        return settings_;
+    }
+
+    const PathTracerSettings &settings() const
+    {
+        return settings_;
+    }
+
+    /**
+     * Renders the world as seen from a camera. The camera's matrices and the transforms are used
+     * as last computed by the CameraSystem and TransformSystem, i.e., in World::update().
+     * @param world World to render
+     * @param camera Entity with Camera and Transform components
+     * @return 8-bit RGB image with the top row first
+     */
+    Image render(World &world, Entity camera);
+
+    /**
+     * Renders a snapshot of the world that is already up to date, e.g., to render several views
+     * of the same scene
+     * @param scene Scene snapshot
+     * @param camera Camera whose view is rendered
+     * @return 8-bit RGB image with the top row first
+     */
+    Image render(const RaytracingScene &scene, const Camera &camera) const;
+
+    /**
+     * Scene snapshot used by the last call to render(World &, Entity)
+     */
+    const RaytracingScene &scene() const
+    {
+        return scene_;
+    }
+
+  private:
+    PathTracerSettings settings_;
+    RaytracingScene scene_;
+};
+
+} // namespace rcube
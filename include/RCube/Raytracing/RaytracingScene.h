@@ -0,0 +1,144 @@
+#pragma once
+
+#include "RCube/Core/Accel/InstanceBVH.h"
+#include "RCube/Core/Accel/Ray.h"
+#include "RCube/Core/Accel/RayPacket.h"
+#include "RCube/Core/Accel/TriangleMeshView.h"
+#include "RCube/Core/Arch/World.h"
+#include "RCube/Core/Graphics/OpenGL/Light.h"
+#include "RCube/Core/Graphics/OpenGL/Mesh.h"
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace rcube
+{
+
+/**
+ * Surface point found by RaytracingScene::intersect()
+ */
+struct SurfaceHit
+{
+    uint32_t object = 0;        /// Index of the object in RaytracingScene::objects()
+    uint32_t face = 0;          /// Index of the triangle in the object's mesh
+    float t = 0.f;              /// World-space ray parameter
+    glm::vec3 point;            /// World-space position
+    glm::vec3 barycentrics;     /// Barycentric coordinates of the point in the triangle
+    glm::vec3 normal;           /// Interpolated world-space normal facing the ray's origin
+    glm::vec3 geometric_normal; /// World-space face normal facing the ray's origin
+};
+
+/**
+ * Snapshot of the renderable contents of a World for ray tracing on the CPU: the triangle meshes
+ * of visible Drawables placed by their Transforms, their Materials' constant parameters, and the
+ * lights. Geometry is shared with the meshes and queried through their BVHs, which are the
+ * bottom level of a two-level hierarchy over the objects.
+ *
+ * Queries are read-only and may run on any number of threads. The snapshot refers to the meshes'
+ * vertex data, so it must be updated after meshes change.
+ */
+class RaytracingScene
+{
+  public:
+    struct Object
+    {
+        Entity entity;              /// Entity the object was made from
+        std::shared_ptr<Mesh> mesh; /// Keeps the geometry alive
+        TriangleMeshView triangles; /// Positions and indices of the mesh
+        const glm::vec3 *normals;   /// Per-vertex normals, or null to use face normals
+        glm::mat4 transform;        /// Model to world transformation
+        glm::mat3 normal_matrix;    /// Model to world transformation of normals
+        glm::vec3 albedo;
+        float roughness;
+        float metallic;
+    };
+
+    /**
+     * Light with its world-space placement, using the same conventions as the renderer:
+     * light.position is the position of a point light, or the direction towards a directional
+     * light (light.pos_w == 0)
+     */
+    struct SceneLight
+    {
+        Light light;
+        Entity entity;
+    };
+
+    RaytracingScene() = default;
+
+    /**
+     * Takes a new snapshot of the world. Meshes without a BVH get one built with
+     * Mesh::updateBVH(). Only triangle meshes are included.
+     * @param world World with Drawable, Transform, Material and light components
+     */
+    void update(World &world);
+
+    void clear();
+
+    const std::vector<Object> &objects() const
+    {
+        return objects_;
+    }
+
+    const std::vector<SceneLight> &lights() const
+    {
+        return lights_;
+    }
+
+    /**
+     * Finds the closest surface hit by a world-space ray within [ray.tmin(), ray.tmax()]
+     * @param ray Ray in world space
+     * @param hit Closest surface point
+     * @return Whether anything was hit
+     */
+    bool intersect(const Ray &ray, SurfaceHit &hit) const;
+
+    /**
+     * Finds the closest surface hit by a world-space ray like intersect(const Ray &, SurfaceHit &)
+     * without computing the point's shading data, e.g., for id buffers
+     * @param ray Ray in world space
+     * @param object Index of the object hit in objects()
+     * @param face Index of the triangle hit in the object's mesh
+     * @param t World-space ray parameter of the hit
+     * @return Whether anything was hit
+     */
+    bool intersect(const Ray &ray, uint32_t &object, uint32_t &face, float &t) const;
+
+    /**
+     * Finds the closest surfaces hit by a packet of world-space rays like
+     * intersect(const Ray &, uint32_t &, uint32_t &, float &). The rays traverse both levels of
+     * the hierarchy together, which pays off for coherent rays such as those of neighbouring
+     * pixels.
+     * @param packet Rays in world space
+     * @param object Per-lane index of the object hit in objects()
+     * @param face Per-lane index of the triangle hit in the object's mesh
+     * @param t Per-lane world-space ray parameter of the hit
+     * @return Bitmask of lanes that hit anything
+     */
+    int intersect(const RayPacket4 &packet, uint32_t object[RAY_PACKET_SIZE],
+                  uint32_t face[RAY_PACKET_SIZE], float t[RAY_PACKET_SIZE]) const;
+
+    /**
+     * Checks whether a world-space ray hits anything within [ray.tmin(), ray.tmax()]
+     * @param ray Ray in world space, e.g., a shadow ray
+     * @return Whether anything was hit
+     */
+    bool occluded(const Ray &ray) const;
+
+  private:
+    std::vector<Object> objects_;
+    std::vector<SceneLight> lights_;
+    InstanceBVH bvh_;
+};
+
+/**
+ * Ray through a point on a camera's image plane, from the near to the far clipping plane
+ * @param ndc_to_world Inverse of the camera's projection times view matrix
+ * @param ndc_x Horizontal normalized device coordinate in [-1, 1], increasing to the right
+ * @param ndc_y Vertical normalized device coordinate in [-1, 1], increasing upwards
+ * @return World-space ray whose parameter is the distance from the near plane
+ */
+Ray cameraRay(const glm::mat4 &ndc_to_world, float ndc_x, float ndc_y);
+
+} // namespace rcube
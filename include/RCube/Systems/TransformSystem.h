@@ -21,13 +21,29 @@ class TransformSystem : public System
     virtual void cleanup() override;
     virtual void update(bool force = false) override;
     virtual unsigned int priority() const override;
+    virtual bool mainThreadOnly() const override
+    {
+        return false;
+    }
     virtual const std::string name() const override
     {
         return "TransformSystem";
     }
 
+    /**
+     * Transforms whose world transformation was recomputed by the last update(), in no
+     * particular order, so that other systems can refresh data derived from them (e.g., picking
+     * bounds) without checking every entity
+     */
+    const std::vector<Transform *> &movedTransforms() const
+    {
+        return moved_;
+    }
+
   private:
-    void updateHierarchy(Transform *comp, bool force = false);
+    void updateHierarchy(Transform *comp, std::vector<Transform *> &moved, bool force = false);
+
+    std::vector<Transform *> moved_;
 };
 
 } // namespace rcube
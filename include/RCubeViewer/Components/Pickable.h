@@ -1,7 +1,9 @@
 #pragma once
 
+#include "RCube/Core/Accel/PointSet.h"
 #include "RCube/Core/Arch/Component.h"
 #include "RCube/Window.h"
+#include <memory>
 
 namespace rcube
 {
@@ -14,7 +16,12 @@ class Pickable : public Component<Pickable>
     bool active = true;
     bool picked = false;
     glm::vec3 point = glm::vec3(0.0, 0.0, 0.0);
-    size_t triangle = 0;
+    size_t triangle = 0;    /// Picked face of the Drawable's mesh, when points is not set
+    size_t point_index = 0; /// Picked point of points, when it is set
+    /// If set, picking tests these points (in the entity's model space) instead of the
+    /// Drawable's mesh, e.g., for point clouds drawn with sphere proxies. The mesh then needs no
+    /// BVH.
+    std::shared_ptr<PointSet> points;
 };
 
 } // namespace viewer
@@ -1,7 +1,11 @@
 #pragma once
 
+#include "RCube/Components/Transform.h"
+#include "RCube/Core/Accel/InstanceBVH.h"
 #include "RCube/Core/Arch/System.h"
 #include "glm/glm.hpp"
+#include <unordered_map>
+#include <vector>
 
 namespace rcube
 {
@@ -13,6 +17,11 @@ namespace viewer
  * It works by casting a ray from the camera that is controlled by the user (indicated entity that has
  * Camera and CameraController components), onto every entity that has Drawable, Transform and Pickable
  * components.
+ * Entities are found through a top-level BVH over their world-space bounds, so only the meshes
+ * whose bounds the ray crosses are tested. Entities that share a Mesh share its BVH.
+ * The BVH is rebuilt when pickable entities are added or removed; otherwise, before a pick, only
+ * the entities whose Transform the TransformSystem moved, or whose mesh or points BVH changed
+ * (see BVH::revision()), since the last pick are updated and the tree is refit.
  */
 class PickSystem : public System
 {
@@ -22,6 +31,29 @@ class PickSystem : public System
     virtual void update(bool) override;
     virtual unsigned int priority() const override;
     virtual const std::string name() const override;
+    virtual void registerEntity(const Entity &e, ComponentMask sign) override;
+    virtual void unregisterEntity(const Entity &e, ComponentMask sign) override;
+    virtual void registerEntities(const std::vector<Entity> &entities,
+                                  ComponentMask sign) override;
+    virtual void unregisterEntities(const std::vector<Entity> &entities,
+                                    ComponentMask sign) override;
+
+  private:
+    // Marks the instances whose Transform was moved by the TransformSystem in this frame
+    void markMovedInstances();
+
+    // Brings the top-level BVH up to date before a pick
+    void updateSceneBVH();
+
+    // BVH of the geometry picked for an entity, in model space
+    const BVH &pickBVH(Entity ent);
+
+    InstanceBVH scene_bvh_;               // Top-level BVH over pickable entities
+    std::vector<Entity> instances_;       // Entity of each instance of scene_bvh_
+    std::vector<bool> instance_moved_;    // Whether each instance moved since the last pick
+    std::vector<uint64_t> instance_revisions_; // pickBVH() revision each instance was built with
+    std::unordered_map<const Transform *, uint32_t> transform_instances_;
+    bool instances_outdated_ = true; // Pickable entities were added or removed
 };
 
 } // namespace viewer
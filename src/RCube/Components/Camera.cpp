@@ -6,28 +6,32 @@ namespace rcube
 
 Frustum Camera::frustum()
 {
-    static glm::vec4 cube[8] = {
-        glm::vec4(-1, 1, -1, 1),  // near topleft
-        glm::vec4(1, 1, -1, 1),   // near topright
-        glm::vec4(-1, -1, -1, 1), // near bottomleft
-        glm::vec4(-1, 1, -1, 1),  // near bottomright
-        glm::vec4(-1, 1, 1, 1),   // far topleft
-        glm::vec4(1, 1, 1, 1),    // far topright
-        glm::vec4(-1, -1, 1, 1),  // far bottomleft
-        glm::vec4(-1, 1, 1, 1)    // far bottomright
+    return frustum(glm::vec2(-1, -1), glm::vec2(1, 1));
+}
+
+Frustum Camera::frustum(const glm::vec2 &ndc_min, const glm::vec2 &ndc_max)
+{
+    const glm::vec4 cube[8] = {
+        glm::vec4(ndc_min.x, ndc_max.y, -1, 1), // near topleft
+        glm::vec4(ndc_max.x, ndc_max.y, -1, 1), // near topright
+        glm::vec4(ndc_min.x, ndc_min.y, -1, 1), // near bottomleft
+        glm::vec4(ndc_max.x, ndc_min.y, -1, 1), // near bottomright
+        glm::vec4(ndc_min.x, ndc_max.y, 1, 1),  // far topleft
+        glm::vec4(ndc_max.x, ndc_max.y, 1, 1),  // far topright
+        glm::vec4(ndc_min.x, ndc_min.y, 1, 1),  // far bottomleft
+        glm::vec4(ndc_max.x, ndc_min.y, 1, 1)   // far bottomright
     };
 
-    glm::mat4 invVP = glm::inverse(world_to_view * view_to_projection);
-    Frustum fr;
+    // Clip space is reached by applying world_to_view first, then view_to_projection
+    glm::mat4 invVP = glm::inverse(view_to_projection * world_to_view);
+    std::array<glm::vec3, 8> points;
     for (size_t i = 0; i < 8; ++i)
     {
         glm::vec4 tmp = invVP * cube[i];
         tmp /= tmp.w;
-        fr.points[i].x = tmp.x;
-        fr.points[i].y = tmp.y;
-        fr.points[i].z = tmp.z;
+        points[i] = glm::vec3(tmp);
     }
-    return fr;
+    return Frustum(points);
 }
 
 void Camera::drawGUI()
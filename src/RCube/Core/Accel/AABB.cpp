@@ -1,4 +1,5 @@
 #include "RCube/Core/Accel/AABB.h"
+#include <cmath>
 
 namespace rcube
 {
@@ -7,6 +8,12 @@ AABB::AABB(const glm::vec3 &bb_min, const glm::vec3 &bb_max) : min_(bb_min), max
 {
 }
 
+AABB AABB::null()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    return AABB(glm::vec3(inf, inf, inf), glm::vec3(-inf, -inf, -inf));
+}
+
 const glm::vec3 &AABB::min() const
 {
     return min_;
@@ -38,6 +45,10 @@ void AABB::expandBy(const glm::vec3 &p)
 
 void AABB::expandBy(const AABB &other)
 {
+    if (other.isNull())
+    {
+        return;
+    }
     expandBy(other.min_);
     expandBy(other.max_);
 }
@@ -56,44 +67,160 @@ size_t AABB::longestAxis() const
     return 2;
 }
 
-bool AABB::rayIntersect(const Ray &ray)
+float AABB::surfaceArea() const
 {
-    float nearT = -std::numeric_limits<float>::infinity();
-    float farT = std::numeric_limits<float>::infinity();
+    if (isNull())
+    {
+        return 0.f;
+    }
+    const glm::vec3 dims = max_ - min_;
+    return 2.f * (dims.x * dims.y + dims.y * dims.z + dims.z * dims.x);
+}
+
+glm::vec3 AABB::center() const
+{
+    return 0.5f * (min_ + max_);
+}
 
-    for (int i = 0; i < 3; i++)
+float AABB::distanceSquared(const glm::vec3 &p) const
+{
+    if (isNull())
     {
-        float origin = ray.origin()[i];
-        float minVal = min_[i], maxVal = max_[i];
+        return std::numeric_limits<float>::infinity();
+    }
+    const glm::vec3 d = glm::max(glm::max(min_ - p, p - max_), glm::vec3(0.f));
+    return glm::dot(d, d);
+}
 
-        if (ray.direction()[i] == 0)
-        {
-            if (origin < minVal || origin > maxVal)
-            {
-                return false;
-            }
-        }
-        else
-        {
-            float t1 = (minVal - origin) / ray.direction()[i];
-            float t2 = (maxVal - origin) / ray.direction()[i];
+bool AABB::contains(const glm::vec3 &p) const
+{
+    return p.x >= min_.x && p.y >= min_.y && p.z >= min_.z && p.x <= max_.x && p.y <= max_.y &&
+           p.z <= max_.z;
+}
+
+bool AABB::overlaps(const AABB &other) const
+{
+    return min_.x <= other.max_.x && min_.y <= other.max_.y && min_.z <= other.max_.z &&
+           other.min_.x <= max_.x && other.min_.y <= max_.y && other.min_.z <= max_.z;
+}
+
+Overlap AABB::classify(const AABB &box) const
+{
+    if (!overlaps(box))
+    {
+        return Overlap::Outside;
+    }
+    return contains(box.min_) && contains(box.max_) ? Overlap::Inside : Overlap::Partial;
+}
+
+AABB AABB::transformed(const glm::mat4 &m) const
+{
+    if (isNull())
+    {
+        return *this;
+    }
+    // Arvo's method: accumulate the extreme contribution of every matrix entry per axis
+    glm::vec3 new_min(m[3]), new_max(m[3]);
+    for (int col = 0; col < 3; ++col)
+    {
+        const glm::vec3 a = glm::vec3(m[col]) * min_[col];
+        const glm::vec3 b = glm::vec3(m[col]) * max_[col];
+        new_min += glm::min(a, b);
+        new_max += glm::max(a, b);
+    }
+    return AABB(new_min, new_max);
+}
 
-            if (t1 > t2)
-            {
-                std::swap(t1, t2);
-            }
+bool AABB::rayIntersect(const Ray &ray) const
+{
+    float t_near;
+    return rayIntersect(ray, t_near);
+}
 
-            nearT = std::max(t1, nearT);
-            farT = std::min(t2, farT);
+bool AABB::rayIntersect(const Ray &ray, float &t_near) const
+{
+    const glm::vec3 &o = ray.origin();
+    const glm::vec3 &inv = ray.inverseDirection();
+    const int signs = ray.directionSigns();
+    float t_enter = ray.tmin();
+    float t_exit = ray.tmax();
+    for (int i = 0; i < 3; ++i)
+    {
+        const bool negative = ((signs >> i) & 1) != 0;
+        const float t0 = ((negative ? max_[i] : min_[i]) - o[i]) * inv[i];
+        const float t1 = ((negative ? min_[i] : max_[i]) - o[i]) * inv[i] * RAY_BOX_EXIT_SCALE;
+        // Comparisons with NaN (0 * inf, for a ray parallel to the slabs that starts on one of
+        // their planes) are false, so such a slab does not restrict the interval
+        t_enter = t0 > t_enter ? t0 : t_enter;
+        t_exit = t1 < t_exit ? t1 : t_exit;
+    }
+    t_near = t_enter;
+    return t_enter <= t_exit;
+}
 
-            if (!(nearT <= farT))
-            {
-                return false;
-            }
+TransformedBoxTest::TransformedBoxTest(const glm::mat4 &b_to_a)
+    : linear_(b_to_a), translation_(b_to_a[3])
+{
+    // Face normals of both boxes and the cross products of their edge directions. Any axis is a
+    // valid candidate, so rounding errors in the axes themselves do not matter; only axes that
+    // vanish (parallel edges) are dropped.
+    glm::vec3 candidates[15];
+    size_t n = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+        glm::vec3 e(0.f);
+        e[k] = 1.f;
+        candidates[n++] = e;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        candidates[n++] = glm::cross(linear_[(i + 1) % 3], linear_[(i + 2) % 3]);
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            candidates[n++] = glm::cross(candidates[k], linear_[i]);
+        }
+    }
+    for (const glm::vec3 &axis : candidates)
+    {
+        if (axis == glm::vec3(0.f))
+        {
+            continue;
         }
+        axes_[num_axes_] = axis;
+        abs_axes_[num_axes_] = glm::abs(axis);
+        abs_projections_[num_axes_] =
+            glm::abs(glm::vec3(glm::dot(axis, linear_[0]), glm::dot(axis, linear_[1]),
+                               glm::dot(axis, linear_[2])));
+        ++num_axes_;
     }
+}
 
-    return ray.tmin() <= farT && nearT <= ray.tmax();
+bool TransformedBoxTest::overlaps(const AABB &a, const AABB &b) const
+{
+    const glm::vec3 center_a = 0.5f * (a.min() + a.max());
+    const glm::vec3 half_a = 0.5f * (a.max() - a.min());
+    const glm::vec3 center_b = 0.5f * (b.min() + b.max());
+    const glm::vec3 half_b = 0.5f * (b.max() - b.min());
+    const glm::vec3 d = linear_ * center_b + translation_ - center_a;
+    // Bounds on the magnitudes of the terms of dot(d, axis), which scale its rounding error
+    const glm::vec3 magnitude_a = glm::abs(center_a) + glm::abs(translation_) + half_a;
+    const glm::vec3 magnitude_b = glm::abs(center_b) + half_b;
+    constexpr float tolerance = 16.f * std::numeric_limits<float>::epsilon();
+    for (size_t k = 0; k < num_axes_; ++k)
+    {
+        const float radius =
+            glm::dot(abs_axes_[k], half_a) + glm::dot(abs_projections_[k], half_b);
+        const float error = tolerance * (glm::dot(abs_axes_[k], magnitude_a) +
+                                         glm::dot(abs_projections_[k], magnitude_b));
+        if (std::abs(glm::dot(d, axes_[k])) > radius + error)
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
 } // namespace rcube
\ No newline at end of file
@@ -1,117 +1,461 @@
 #include "RCube/Core/Accel/BVH.h"
+#include "RCube/Core/Accel/LBVH.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
 
 namespace rcube
 {
 
-bool BVHNode::rayIntersect(const Ray &ray, glm::vec3 &pt, PrimitivePtr &primitive)
+namespace
 {
-    if (aabb.rayIntersect(ray))
+
+struct Bin
+{
+    AABB aabb = AABB::null();
+    uint32_t count = 0;
+};
+
+// State shared by all recursive calls of the builder
+struct BVHBuilder
+{
+    const std::vector<AABB> &bounds;
+    const std::vector<glm::vec3> &centroids;
+    std::vector<uint32_t> &indices;
+    std::vector<BVHNode> &nodes;
+
+    // Builds the subtree over indices[begin, end) and returns the index of its root node
+    uint32_t build(uint32_t begin, uint32_t end, size_t depth)
     {
-        if ((left != nullptr && left->primitives.size() > 0) || (right != nullptr && right->primitives.size() > 0))
+        const uint32_t node_index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+
+        AABB node_aabb = AABB::null();
+        AABB centroid_aabb = AABB::null();
+        for (uint32_t i = begin; i < end; ++i)
         {
-            bool hitLeft = left->rayIntersect(ray, pt, primitive);
-            bool hitRight = right->rayIntersect(ray, pt, primitive);
-            return hitLeft || hitRight;
+            node_aabb.expandBy(bounds[indices[i]]);
+            centroid_aabb.expandBy(centroids[indices[i]]);
         }
-        else
+        nodes[node_index].aabb = node_aabb;
+
+        const uint32_t count = end - begin;
+        const glm::vec3 extent = centroid_aabb.max() - centroid_aabb.min();
+        const float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+        if (count <= BVH_MAX_LEAF_SIZE || depth >= BVH_MAXDEPTH)
         {
-            float t;
-            for (int i = 0; i < primitives.size(); i++)
+            return makeLeaf(node_index, begin, count);
+        }
+        if (max_extent <= 0.f)
+        {
+            // All centroids coincide (e.g., duplicate faces), so no axis separates them: split
+            // the range in half to keep leaves small
+            const uint32_t mid = begin + count / 2;
+            build(begin, mid, depth + 1);
+            nodes[node_index].offset = build(mid, end, depth + 1);
+            return node_index;
+        }
+
+        // Evaluate the SAH cost of splitting at every bin boundary along each axis
+        float best_cost = std::numeric_limits<float>::infinity();
+        int best_axis = -1;
+        size_t best_split = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (extent[axis] <= 0.f)
+            {
+                continue;
+            }
+            std::array<Bin, BVH_NUM_BINS> bins;
+            const float scale = float(BVH_NUM_BINS) / extent[axis];
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                Bin &bin = bins[binIndex(centroids[indices[i]][axis], centroid_aabb.min()[axis],
+                                         scale)];
+                bin.aabb.expandBy(bounds[indices[i]]);
+                bin.count += 1;
+            }
+            // Sweep from the right to get the area and count of every right partition...
+            std::array<float, BVH_NUM_BINS> right_area;
+            std::array<uint32_t, BVH_NUM_BINS> right_count;
+            AABB right_aabb = AABB::null();
+            uint32_t right_sum = 0;
+            for (size_t b = BVH_NUM_BINS - 1; b > 0; --b)
+            {
+                right_aabb.expandBy(bins[b].aabb);
+                right_sum += bins[b].count;
+                right_area[b] = right_aabb.surfaceArea();
+                right_count[b] = right_sum;
+            }
+            // ...then from the left to combine them with the left partitions
+            AABB left_aabb = AABB::null();
+            uint32_t left_sum = 0;
+            for (size_t b = 1; b < BVH_NUM_BINS; ++b)
             {
-                if (primitives[i]->rayIntersect(ray, t))
+                left_aabb.expandBy(bins[b - 1].aabb);
+                left_sum += bins[b - 1].count;
+                if (left_sum == 0 || right_count[b] == 0)
+                {
+                    continue;
+                }
+                const float cost =
+                    left_aabb.surfaceArea() * left_sum + right_area[b] * right_count[b];
+                if (cost < best_cost)
                 {
-                    pt = ray.origin() + t * ray.direction();
-                    primitive = primitives[i];
-                    return true;
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
                 }
             }
         }
-        return false;
+
+        uint32_t mid = begin;
+        if (best_axis >= 0)
+        {
+            const float leaf_cost = float(count);
+            const float split_cost =
+                BVH_TRAVERSAL_COST + best_cost / std::max(node_aabb.surfaceArea(),
+                                                          std::numeric_limits<float>::min());
+            if (split_cost >= leaf_cost && count <= 4 * BVH_MAX_LEAF_SIZE)
+            {
+                return makeLeaf(node_index, begin, count);
+            }
+            const float scale = float(BVH_NUM_BINS) / extent[best_axis];
+            const float cmin = centroid_aabb.min()[best_axis];
+            mid = static_cast<uint32_t>(
+                std::partition(indices.begin() + begin, indices.begin() + end,
+                               [&](uint32_t prim) {
+                                   return binIndex(centroids[prim][best_axis], cmin, scale) <
+                                          best_split;
+                               }) -
+                indices.begin());
+        }
+        if (mid == begin || mid == end)
+        {
+            // No usable split found: fall back to a median split along the widest axis
+            const size_t axis = centroid_aabb.longestAxis();
+            mid = begin + count / 2;
+            std::nth_element(indices.begin() + begin, indices.begin() + mid,
+                             indices.begin() + end, [&](uint32_t a, uint32_t b) {
+                                 return centroids[a][axis] < centroids[b][axis];
+                             });
+        }
+
+        build(begin, mid, depth + 1);
+        const uint32_t right = build(mid, end, depth + 1);
+        nodes[node_index].offset = right;
+        return node_index;
     }
-    return false;
-}
 
-BVHNodePtr buildBVH(std::vector<PrimitivePtr> &prims, size_t depth)
+    uint32_t makeLeaf(uint32_t node_index, uint32_t begin, uint32_t count)
+    {
+        nodes[node_index].offset = begin;
+        nodes[node_index].count = count;
+        return node_index;
+    }
+
+    static size_t binIndex(float c, float cmin, float scale)
+    {
+        const size_t b = static_cast<size_t>((c - cmin) * scale);
+        return std::min(b, BVH_NUM_BINS - 1);
+    }
+};
+
+constexpr char BVH_FILE_MAGIC[8] = {'R', 'C', 'U', 'B', 'E', 'B', 'V', 'H'};
+constexpr uint32_t BVH_FILE_VERSION = 1;
+constexpr uint32_t BVH_FILE_BYTE_ORDER = 0x01020304;
+
+// Header of files written by BVH::save, followed by the nodes and then the primitive indices
+struct BVHFileHeader
 {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t key;
+    uint64_t num_nodes;
+    uint64_t num_indices;
+    float sah_cost;
+    float built_sah_cost;
+    uint64_t reserved[2]; // Pads the header so that the nodes start 32-byte aligned
+};
 
-    auto node = std::make_shared<BVHNode>();
-    node->primitives = prims;
-    node->aabb = AABB();
-    node->left = nullptr;
-    node->right = nullptr;
+static_assert(sizeof(BVHFileHeader) == 64, "Unexpected BVH file header size");
 
-    // No primitives
-    if (prims.size() == 0)
+// Whether nodes and primitive indices read from a file form a tree that queries can traverse
+// without reading out of bounds or overflowing their stacks
+bool validFile(const BVHNode *nodes, uint64_t num_nodes, const uint32_t *indices,
+               uint64_t num_indices)
+{
+    if (num_nodes > std::numeric_limits<uint32_t>::max() ||
+        num_indices > std::numeric_limits<uint32_t>::max())
     {
-        return node;
+        return false;
     }
-
-    // Single triangle in the mesh
-    if (prims.size() == 1)
+    for (uint64_t i = 0; i < num_indices; ++i)
     {
-        node->aabb = prims[0]->aabb();
-        return node;
+        if (indices[i] >= num_indices)
+        {
+            return false;
+        }
+    }
+    // Children always come after their parent, so one pass in order finds every node's depth
+    std::vector<uint32_t> depth(num_nodes, 0);
+    for (uint64_t i = 0; i < num_nodes; ++i)
+    {
+        const BVHNode &node = nodes[i];
+        if (node.isLeaf())
+        {
+            if (uint64_t(node.offset) + node.count > num_indices)
+            {
+                return false;
+            }
+            continue;
+        }
+        if (node.offset <= i + 1 || node.offset >= num_nodes ||
+            depth[i] + 1 >= BVH_STACK_SIZE)
+        {
+            return false;
+        }
+        depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+        depth[node.offset] = std::max(depth[node.offset], depth[i] + 1);
     }
+    return true;
+}
 
-    // Many triangles in the mesh
-    node->aabb = prims[0]->aabb();
-    for (int i = 1; i < prims.size(); ++i)
+} // namespace
+
+void BVH::build(const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids,
+                BVHBuildMethod method)
+{
+    clear();
+    if (bounds.empty())
     {
-        node->aabb.expandBy(prims[i]->aabb());
+        return;
+    }
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices;
+    if (method != BVHBuildMethod::BinnedSAH)
+    {
+        internal::buildLBVH(bounds, centroids, method == BVHBuildMethod::TreeletLBVH, nodes,
+                            indices);
+    }
+    else
+    {
+        indices.resize(bounds.size());
+        for (uint32_t i = 0; i < indices.size(); ++i)
+        {
+            indices[i] = i;
+        }
+        nodes.reserve(2 * bounds.size() - 1);
+        BVHBuilder builder{bounds, centroids, indices, nodes};
+        builder.build(0, static_cast<uint32_t>(indices.size()), 0);
+        nodes.shrink_to_fit();
     }
+    nodes_ = std::move(nodes);
+    indices_ = std::move(indices);
+    sah_cost_ = computeSAHCost();
+    built_sah_cost_ = sah_cost_;
+    newRevision();
+}
 
-    // Midpoint of all triangles
-    glm::vec3 midpt(0, 0, 0);
-    for (int i = 0; i < prims.size(); ++i)
+void BVH::build(const std::vector<PrimitivePtr> &prims)
+{
+    std::vector<AABB> bounds;
+    std::vector<glm::vec3> centroids;
+    bounds.reserve(prims.size());
+    centroids.reserve(prims.size());
+    for (const PrimitivePtr &prim : prims)
     {
-        midpt += (prims[i]->position()) / float(prims.size());
+        bounds.push_back(prim->aabb());
+        centroids.push_back(prim->position());
     }
-    // midpt /= midpt.size();
+    build(bounds, centroids);
+}
 
-    std::vector<PrimitivePtr> left_primitives;
-    std::vector<PrimitivePtr> right_primitives;
+void BVH::clear()
+{
+    nodes_.clear();
+    indices_.clear();
+    sah_cost_ = 0.f;
+    built_sah_cost_ = 0.f;
+    newRevision();
+}
 
-    // split along midpoint of longest axis
-    glm::length_t axis = (glm::length_t)node->aabb.longestAxis();
-    for (int i = 0; i < prims.size(); ++i)
-    {
-        const glm::vec3 &curr_midpt = prims[i]->position();
+bool BVH::empty() const
+{
+    return nodes_.empty();
+}
+
+const AABB &BVH::bounds() const
+{
+    static const AABB empty_aabb = AABB::null();
+    return nodes_.empty() ? empty_aabb : nodes_[0].aabb;
+}
+
+const MappedArray<BVHNode> &BVH::nodes() const
+{
+    return nodes_;
+}
+
+const MappedArray<uint32_t> &BVH::primitiveIndices() const
+{
+    return indices_;
+}
 
-        // Triangles to the left of midpoint go to left child
-        if (curr_midpt[axis] <= midpt[axis])
+void BVH::save(const std::string &path, uint64_t key) const
+{
+    BVHFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, BVH_FILE_MAGIC, sizeof(header.magic));
+    header.version = BVH_FILE_VERSION;
+    header.byte_order = BVH_FILE_BYTE_ORDER;
+    header.key = key;
+    header.num_nodes = nodes_.size();
+    header.num_indices = indices_.size();
+    header.sah_cost = sah_cost_;
+    header.built_sah_cost = built_sah_cost_;
+    // Write to a temporary file and rename it into place, so that other processes that mapped
+    // or are reading the old file never see a truncated or half-written one
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file)
         {
-            left_primitives.push_back(prims[i]);
+            throw std::runtime_error("Unable to open " + tmp_path + " for writing");
         }
-        // Triangles to the right of midpoint go to right child
-        else
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(nodes_.data()),
+                   nodes_.size() * sizeof(BVHNode));
+        file.write(reinterpret_cast<const char *>(indices_.data()),
+                   indices_.size() * sizeof(uint32_t));
+        file.close();
+        if (!file)
         {
-            right_primitives.push_back(prims[i]);
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error("Unable to write BVH to " + tmp_path);
         }
     }
+    // rename() does not replace existing files on every platform
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0 &&
+        (std::remove(path.c_str()) != 0 || std::rename(tmp_path.c_str(), path.c_str()) != 0))
+    {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Unable to move BVH to " + path);
+    }
+}
+
+bool BVH::load(const std::string &path, uint64_t key)
+{
+    std::shared_ptr<MappedFile> file = MappedFile::open(path);
+    if (file == nullptr || file->size() < sizeof(BVHFileHeader))
+    {
+        return false;
+    }
+    BVHFileHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, BVH_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != BVH_FILE_VERSION || header.byte_order != BVH_FILE_BYTE_ORDER ||
+        header.key != key || header.num_nodes == 0)
+    {
+        return false;
+    }
+    // A truncated file (e.g., from an interrupted save) is rejected here
+    const uint64_t nodes_size = header.num_nodes * sizeof(BVHNode);
+    const uint64_t indices_size = header.num_indices * sizeof(uint32_t);
+    if (file->size() != sizeof(BVHFileHeader) + nodes_size + indices_size)
+    {
+        return false;
+    }
+    char *nodes = file->data() + sizeof(BVHFileHeader);
+    char *indices = nodes + nodes_size;
+    if (!validFile(reinterpret_cast<const BVHNode *>(nodes), header.num_nodes,
+                   reinterpret_cast<const uint32_t *>(indices), header.num_indices))
+    {
+        return false;
+    }
+    nodes_.map(file, reinterpret_cast<BVHNode *>(nodes), header.num_nodes);
+    indices_.map(file, reinterpret_cast<uint32_t *>(indices), header.num_indices);
+    sah_cost_ = header.sah_cost;
+    built_sah_cost_ = header.built_sah_cost;
+    newRevision();
+    return true;
+}
+
+bool BVH::mapped() const
+{
+    return nodes_.mapped();
+}
+
+float BVH::sahCost() const
+{
+    return sah_cost_;
+}
+
+float BVH::builtSAHCost() const
+{
+    return built_sah_cost_;
+}
+
+uint64_t BVH::revision() const
+{
+    return revision_;
+}
 
-    if (left_primitives.size() == 0 && right_primitives.size() > 0)
+void BVH::newRevision()
+{
+    static std::atomic<uint64_t> next_revision(1);
+    revision_ = next_revision.fetch_add(1, std::memory_order_relaxed);
+}
+
+void BVH::refitPartition(std::vector<uint32_t> &top, std::vector<uint32_t> &roots) const
+{
+    // Expand the largest subtrees breadth-first until there are enough to keep every thread
+    // busy; the expanded nodes are few and are refit serially afterwards
+    const size_t num_threads = ThreadPool::instance().size();
+    const size_t target = num_threads > 1 ? 8 * num_threads : 1;
+    roots.assign(1, 0);
+    while (roots.size() < target)
     {
-        left_primitives = right_primitives;
+        auto largest = std::max_element(roots.begin(), roots.end(), [&](uint32_t a, uint32_t b) {
+            return subtreeEnd(a) - a < subtreeEnd(b) - b;
+        });
+        const uint32_t index = *largest;
+        if (nodes_[index].isLeaf())
+        {
+            break;
+        }
+        top.push_back(index);
+        *largest = index + 1;
+        roots.push_back(nodes_[index].offset);
     }
+}
 
-    if (left_primitives.size() > 0 && right_primitives.size() == 0)
+uint32_t BVH::subtreeEnd(uint32_t index) const
+{
+    // The last node of a subtree is found by following right children down to a leaf
+    while (!nodes_[index].isLeaf())
     {
-        right_primitives = left_primitives;
+        index = nodes_[index].offset;
     }
+    return index + 1;
+}
 
-    if (depth < BVH_MAXDEPTH)
+float BVH::computeSAHCost() const
+{
+    if (nodes_.empty())
     {
-        node->left = buildBVH(left_primitives, depth + 1);
-        node->right = buildBVH(right_primitives, depth + 1);
+        return 0.f;
     }
-    else
+    float cost = 0.f;
+    for (const BVHNode &node : nodes_)
     {
-        node->left = std::make_shared<BVHNode>();
-        node->right = std::make_shared<BVHNode>();
-        node->left->primitives = std::vector<PrimitivePtr>();
-        node->right->primitives = std::vector<PrimitivePtr>();
+        cost += node.aabb.surfaceArea() * (node.isLeaf() ? float(node.count) : BVH_TRAVERSAL_COST);
     }
-    return node;
+    return cost / std::max(nodes_[0].aabb.surfaceArea(), std::numeric_limits<float>::min());
 }
 
 } // namespace rcube
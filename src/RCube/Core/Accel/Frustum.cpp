@@ -0,0 +1,69 @@
+#include "RCube/Core/Accel/Frustum.h"
+
+namespace rcube
+{
+
+Frustum::Frustum(const std::array<glm::vec3, 8> &corners) : points(corners)
+{
+    // Three corners on each face: near, far, left, right, top, bottom
+    static const int faces[6][3] = {{0, 1, 2}, {4, 5, 6}, {0, 2, 4},
+                                    {1, 3, 5}, {0, 1, 4}, {2, 3, 6}};
+    glm::vec3 center(0.f);
+    for (const glm::vec3 &p : points)
+    {
+        center += p;
+    }
+    center /= 8.f;
+    for (int i = 0; i < 6; ++i)
+    {
+        const glm::vec3 &a = points[faces[i][0]];
+        const glm::vec3 &b = points[faces[i][1]];
+        const glm::vec3 &c = points[faces[i][2]];
+        glm::vec3 n = glm::normalize(glm::cross(b - a, c - a));
+        // Orient the normal towards the inside
+        if (glm::dot(n, center - a) < 0.f)
+        {
+            n = -n;
+        }
+        planes[i] = glm::vec4(n, -glm::dot(n, a));
+    }
+}
+
+bool Frustum::contains(const glm::vec3 &p) const
+{
+    for (const glm::vec4 &plane : planes)
+    {
+        if (glm::dot(glm::vec3(plane), p) + plane.w < 0.f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+Overlap Frustum::classify(const AABB &box) const
+{
+    Overlap result = Overlap::Inside;
+    for (const glm::vec4 &plane : planes)
+    {
+        const glm::vec3 n(plane);
+        // Box corners farthest along and against the plane normal
+        const glm::vec3 p_vertex(n.x >= 0.f ? box.max().x : box.min().x,
+                                 n.y >= 0.f ? box.max().y : box.min().y,
+                                 n.z >= 0.f ? box.max().z : box.min().z);
+        const glm::vec3 n_vertex(n.x >= 0.f ? box.min().x : box.max().x,
+                                 n.y >= 0.f ? box.min().y : box.max().y,
+                                 n.z >= 0.f ? box.min().z : box.max().z);
+        if (glm::dot(n, p_vertex) + plane.w < 0.f)
+        {
+            return Overlap::Outside;
+        }
+        if (glm::dot(n, n_vertex) + plane.w < 0.f)
+        {
+            result = Overlap::Partial;
+        }
+    }
+    return result;
+}
+
+} // namespace rcube
@@ -0,0 +1,60 @@
+#include "RCube/Core/Accel/Hash.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include <cstring>
+#include <vector>
+
+namespace rcube
+{
+
+namespace
+{
+
+constexpr size_t HASH_BLOCK_SIZE = size_t(1) << 20;
+constexpr uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+// Final mixing step of SplitMix64
+uint64_t mix(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t hashBlock(const unsigned char *bytes, size_t size, uint64_t h)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        h = (h ^ mix(word)) * HASH_MULTIPLIER;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes + i, size - i);
+    return mix(h ^ mix(tail ^ size));
+}
+
+} // namespace
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    const size_t num_blocks = (size + HASH_BLOCK_SIZE - 1) / HASH_BLOCK_SIZE;
+    std::vector<uint64_t> block_hashes(num_blocks);
+    ThreadPool::instance().parallelFor(0, num_blocks, [&](size_t b) {
+        const size_t begin = b * HASH_BLOCK_SIZE;
+        const size_t end = std::min(size, begin + HASH_BLOCK_SIZE);
+        block_hashes[b] = hashBlock(bytes + begin, end - begin, b);
+    });
+    uint64_t h = mix(seed ^ size);
+    for (uint64_t block_hash : block_hashes)
+    {
+        h = mix(h ^ block_hash) * HASH_MULTIPLIER;
+    }
+    return mix(h);
+}
+
+} // namespace rcube
@@ -0,0 +1,147 @@
+#include "RCube/Core/Accel/InstanceBVH.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include <atomic>
+#include <stdexcept>
+
+namespace rcube
+{
+
+namespace
+{
+
+bool sameBounds(const AABB &a, const AABB &b)
+{
+    return (a.isNull() && b.isNull()) || (a.min() == b.min() && a.max() == b.max());
+}
+
+} // namespace
+
+void InstanceBVH::update(const std::vector<glm::mat4> &transforms,
+                         const std::vector<AABB> &local_bounds)
+{
+    if (transforms.size() != local_bounds.size())
+    {
+        throw std::runtime_error("Number of instance transforms and bounds do not match");
+    }
+    const bool rebuild = transforms.size() != instances_.size() || bvh_.empty();
+    instances_.resize(transforms.size());
+    std::atomic<bool> changed(false);
+    ThreadPool::instance().parallelFor(
+        0, instances_.size(),
+        [&](size_t i) {
+            Instance &inst = instances_[i];
+            if (!rebuild && inst.transform == transforms[i] &&
+                sameBounds(inst.local_bounds, local_bounds[i]))
+            {
+                return;
+            }
+            inst.transform = transforms[i];
+            inst.inverse_transform = glm::inverse(transforms[i]);
+            inst.local_bounds = local_bounds[i];
+            inst.world_bounds = local_bounds[i].transformed(transforms[i]);
+            changed = true;
+        },
+        1024);
+    if (rebuild || changed || outdated_)
+    {
+        refitOrRebuild(rebuild);
+    }
+}
+
+void InstanceBVH::setInstance(uint32_t instance, const glm::mat4 &transform,
+                              const AABB &local_bounds)
+{
+    Instance &inst = instances_[instance];
+    inst.transform = transform;
+    inst.inverse_transform = glm::inverse(transform);
+    inst.local_bounds = local_bounds;
+    inst.world_bounds = local_bounds.transformed(transform);
+    outdated_ = true;
+}
+
+void InstanceBVH::refit()
+{
+    if (outdated_)
+    {
+        refitOrRebuild(false);
+    }
+}
+
+void InstanceBVH::refitOrRebuild(bool rebuild)
+{
+    outdated_ = false;
+    if (!rebuild)
+    {
+        bvh_.refit([&](uint32_t i) { return instances_[i].world_bounds; });
+        if (bvh_.sahCost() <= BVH_REFIT_MAX_COST_RATIO * bvh_.builtSAHCost())
+        {
+            return;
+        }
+    }
+    std::vector<AABB> bounds(instances_.size());
+    std::vector<glm::vec3> centroids(instances_.size());
+    for (size_t i = 0; i < instances_.size(); ++i)
+    {
+        bounds[i] = instances_[i].world_bounds;
+        // Null boxes are never hit; any centroid works for them
+        centroids[i] = bounds[i].isNull() ? glm::vec3(0.f) : bounds[i].center();
+    }
+    bvh_.build(bounds, centroids);
+}
+
+void InstanceBVH::clear()
+{
+    instances_.clear();
+    bvh_.clear();
+    outdated_ = false;
+}
+
+size_t InstanceBVH::size() const
+{
+    return instances_.size();
+}
+
+const glm::mat4 &InstanceBVH::inverseTransform(uint32_t instance) const
+{
+    return instances_[instance].inverse_transform;
+}
+
+bool InstanceBVH::modelRay(uint32_t instance, const Ray &ray, Ray &model_ray, float &scale) const
+{
+    const glm::mat4 &inv = instances_[instance].inverse_transform;
+    const glm::vec3 origin(inv * glm::vec4(ray.origin(), 1.f));
+    const glm::vec3 direction(inv * glm::vec4(ray.direction(), 0.f));
+    scale = glm::length(direction);
+    if (!(scale > 0.f))
+    {
+        return false;
+    }
+    model_ray = Ray(origin, direction, ray.tmin() * scale, ray.tmax() * scale);
+    return true;
+}
+
+int InstanceBVH::modelPacket(uint32_t instance, const RayPacket4 &packet, int mask,
+                             RayPacket4 &model_packet, simd::float4 &scale) const
+{
+    auto lane = [&](int k) {
+        return Ray(glm::vec3(packet.origin.x[k], packet.origin.y[k], packet.origin.z[k]),
+                   glm::vec3(packet.direction.x[k], packet.direction.y[k], packet.direction.z[k]),
+                   packet.tmin[k], packet.tmax[k]);
+    };
+    Ray rays[RAY_PACKET_SIZE] = {lane(0), lane(1), lane(2), lane(3)};
+    alignas(16) float scales[RAY_PACKET_SIZE] = {1.f, 1.f, 1.f, 1.f};
+    int model_mask = 0;
+    for (int k = 0; k < static_cast<int>(RAY_PACKET_SIZE); ++k)
+    {
+        if (((mask >> k) & 1) && modelRay(instance, rays[k], rays[k], scales[k]))
+        {
+            model_mask |= 1 << k;
+        }
+    }
+    model_packet = RayPacket4(rays, RAY_PACKET_SIZE);
+    model_packet.active = model_mask;
+    scale = simd::float4::load(scales);
+    return model_mask;
+}
+
+} // namespace rcube
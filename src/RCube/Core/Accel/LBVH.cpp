@@ -0,0 +1,539 @@
+#include "RCube/Core/Accel/LBVH.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include <array>
+#include <atomic>
+#include <limits>
+#include <memory>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace rcube
+{
+namespace internal
+{
+
+namespace
+{
+
+constexpr size_t MORTON_BITS_PER_AXIS = 21;
+constexpr size_t MORTON_BITS = 3 * MORTON_BITS_PER_AXIS;
+constexpr size_t RADIX_BITS = 8;
+constexpr size_t RADIX_BUCKETS = size_t(1) << RADIX_BITS;
+constexpr size_t TREELET_SIZE = 7; /// Maximum number of leaves of a restructured treelet
+constexpr uint32_t INVALID = std::numeric_limits<uint32_t>::max();
+
+// Calls fn(chunk, begin, end) for num_chunks contiguous chunks of [0, n) of nearly equal size,
+// each chunk as a task of the shared ThreadPool
+template <typename Fn> void forEachChunk(size_t n, size_t num_chunks, Fn &&fn)
+{
+    ThreadPool::instance().parallelFor(0, num_chunks, [&](size_t chunk) {
+        fn(chunk, (n * chunk) / num_chunks, (n * (chunk + 1)) / num_chunks);
+    });
+}
+
+// Spreads the lower 21 bits of x so that there are two zero bits between each of them
+uint64_t expandBits(uint64_t x)
+{
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffff;
+    x = (x | x << 16) & 0x1f0000ff0000ff;
+    x = (x | x << 8) & 0x100f00f00f00f00f;
+    x = (x | x << 4) & 0x10c30c30c30c30c3;
+    x = (x | x << 2) & 0x1249249249249249;
+    return x;
+}
+
+uint64_t mortonCode(const glm::vec3 &p, const glm::vec3 &origin, const glm::vec3 &scale)
+{
+    const float max_coord = float((1 << MORTON_BITS_PER_AXIS) - 1);
+    const glm::vec3 q = glm::clamp((p - origin) * scale, 0.f, max_coord);
+    return (expandBits(uint64_t(q.x)) << 2) | (expandBits(uint64_t(q.y)) << 1) |
+           expandBits(uint64_t(q.z));
+}
+
+int countLeadingZeros(uint64_t x)
+{
+    if (x == 0)
+    {
+        return 64;
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - int(index);
+#else
+    int n = 0;
+    for (uint64_t bit = uint64_t(1) << 63; (x & bit) == 0; bit >>= 1)
+    {
+        ++n;
+    }
+    return n;
+#endif
+}
+
+// Stable parallel LSD radix sort of (key, value) pairs on the lower key_bits of the keys
+void radixSort(std::vector<uint64_t> &keys, std::vector<uint32_t> &values, size_t key_bits)
+{
+    const size_t n = keys.size();
+    const size_t num_chunks =
+        std::min(ThreadPool::instance().size(), std::max<size_t>(1, n / 4096));
+    std::vector<uint64_t> keys_tmp(n);
+    std::vector<uint32_t> values_tmp(n);
+    std::vector<std::array<size_t, RADIX_BUCKETS>> histograms(num_chunks);
+    for (size_t shift = 0; shift < key_bits; shift += RADIX_BITS)
+    {
+        forEachChunk(n, num_chunks, [&](size_t chunk, size_t begin, size_t end) {
+            std::array<size_t, RADIX_BUCKETS> &hist = histograms[chunk];
+            hist.fill(0);
+            for (size_t i = begin; i < end; ++i)
+            {
+                ++hist[(keys[i] >> shift) & (RADIX_BUCKETS - 1)];
+            }
+        });
+        // Skip passes where every key has the same digit
+        size_t largest_bucket = 0;
+        for (size_t b = 0; b < RADIX_BUCKETS; ++b)
+        {
+            size_t total = 0;
+            for (size_t c = 0; c < num_chunks; ++c)
+            {
+                total += histograms[c][b];
+            }
+            largest_bucket = std::max(largest_bucket, total);
+        }
+        if (largest_bucket == n)
+        {
+            continue;
+        }
+        // Turn the histograms into the output offset of each (bucket, chunk)
+        size_t offset = 0;
+        for (size_t b = 0; b < RADIX_BUCKETS; ++b)
+        {
+            for (size_t c = 0; c < num_chunks; ++c)
+            {
+                const size_t count = histograms[c][b];
+                histograms[c][b] = offset;
+                offset += count;
+            }
+        }
+        forEachChunk(n, num_chunks, [&](size_t chunk, size_t begin, size_t end) {
+            std::array<size_t, RADIX_BUCKETS> &offsets = histograms[chunk];
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t dst = offsets[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+                keys_tmp[dst] = keys[i];
+                values_tmp[dst] = values[i];
+            }
+        });
+        keys.swap(keys_tmp);
+        values.swap(values_tmp);
+    }
+}
+
+// Binary radix tree over n sorted primitives. Nodes [0, n - 1) are internal, nodes
+// [n - 1, 2n - 1) are leaves holding one primitive each.
+struct RadixTree
+{
+    size_t num_prims = 0;
+    std::vector<uint32_t> left, right, parent;
+    std::vector<AABB> aabb;
+    std::vector<uint32_t> count;     /// Primitives in the subtree
+    std::vector<uint32_t> out_nodes; /// Flattened BVH nodes the subtree turns into
+    std::vector<uint32_t> height;    /// Depth of the flattened subtree
+    std::vector<float> cost;         /// SAH cost of the subtree
+
+    bool isLeaf(uint32_t node) const
+    {
+        return node >= num_prims - 1;
+    }
+
+    uint32_t leafIndex(uint32_t prim) const
+    {
+        return uint32_t(num_prims - 1 + prim);
+    }
+
+    // Recomputes the cached values of an internal node from its children
+    void update(uint32_t node)
+    {
+        const uint32_t l = left[node], r = right[node];
+        AABB box = aabb[l];
+        box.expandBy(aabb[r]);
+        aabb[node] = box;
+        count[node] = count[l] + count[r];
+        const bool collapsed = count[node] <= BVH_MAX_LEAF_SIZE;
+        out_nodes[node] = collapsed ? 1 : 1 + out_nodes[l] + out_nodes[r];
+        height[node] = collapsed ? 1 : 1 + std::max(height[l], height[r]);
+        cost[node] = BVH_TRAVERSAL_COST * box.surfaceArea() + cost[l] + cost[r];
+    }
+};
+
+// Length of the common prefix of the augmented keys (code, index) of primitives i and j,
+// or -1 if j is out of range
+int commonPrefix(const std::vector<uint64_t> &codes, int64_t i, int64_t j)
+{
+    if (j < 0 || j >= int64_t(codes.size()))
+    {
+        return -1;
+    }
+    if (codes[i] == codes[j])
+    {
+        return 64 + countLeadingZeros(uint64_t(uint32_t(i) ^ uint32_t(j))) - 32;
+    }
+    return countLeadingZeros(codes[i] ^ codes[j]);
+}
+
+// Finds the children of internal node i (Karras 2012, Figure 4)
+void buildInternalNode(RadixTree &tree, const std::vector<uint64_t> &codes, int64_t i)
+{
+    const int d = commonPrefix(codes, i, i + 1) > commonPrefix(codes, i, i - 1) ? 1 : -1;
+    // Upper bound for the length of the range covered by this node
+    const int delta_min = commonPrefix(codes, i, i - d);
+    int64_t l_max = 2;
+    while (commonPrefix(codes, i, i + l_max * d) > delta_min)
+    {
+        l_max *= 2;
+    }
+    // Binary search for the other end
+    int64_t l = 0;
+    for (int64_t t = l_max / 2; t >= 1; t /= 2)
+    {
+        if (commonPrefix(codes, i, i + (l + t) * d) > delta_min)
+        {
+            l += t;
+        }
+    }
+    const int64_t j = i + l * d;
+    // Binary search for the split position
+    const int delta_node = commonPrefix(codes, i, j);
+    int64_t s = 0;
+    int64_t t = l;
+    do
+    {
+        t = (t + 1) / 2;
+        if (commonPrefix(codes, i, i + (s + t) * d) > delta_node)
+        {
+            s += t;
+        }
+    } while (t > 1);
+    const int64_t gamma = i + s * d + std::min(d, 0);
+
+    const uint32_t left =
+        std::min(i, j) == gamma ? tree.leafIndex(uint32_t(gamma)) : uint32_t(gamma);
+    const uint32_t right =
+        std::max(i, j) == gamma + 1 ? tree.leafIndex(uint32_t(gamma + 1)) : uint32_t(gamma + 1);
+    tree.left[i] = left;
+    tree.right[i] = right;
+    tree.parent[left] = uint32_t(i);
+    tree.parent[right] = uint32_t(i);
+}
+
+// Finds the topology of the treelet rooted at root that minimizes the SAH cost and rewires
+// the tree accordingly (Karras and Aila 2013)
+void optimizeTreelet(RadixTree &tree, uint32_t root)
+{
+    // Grow the treelet by repeatedly expanding the leaf with the largest surface area
+    std::array<uint32_t, TREELET_SIZE> leaves;
+    std::array<uint32_t, TREELET_SIZE - 1> internals;
+    size_t num_leaves = 2, num_internals = 1;
+    leaves[0] = tree.left[root];
+    leaves[1] = tree.right[root];
+    internals[0] = root;
+    while (num_leaves < TREELET_SIZE)
+    {
+        int best = -1;
+        float best_area = -1.f;
+        for (size_t k = 0; k < num_leaves; ++k)
+        {
+            const float area = tree.aabb[leaves[k]].surfaceArea();
+            if (!tree.isLeaf(leaves[k]) && area > best_area)
+            {
+                best = int(k);
+                best_area = area;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        const uint32_t node = leaves[best];
+        internals[num_internals++] = node;
+        leaves[best] = tree.left[node];
+        leaves[num_leaves++] = tree.right[node];
+    }
+    if (num_leaves < 3)
+    {
+        return;
+    }
+
+    // Optimal cost of every subset of treelet leaves. Every proper subset of s is numerically
+    // smaller than s, so visiting subsets in increasing order satisfies all dependencies.
+    const uint32_t num_subsets = 1u << num_leaves;
+    std::array<AABB, 1 << TREELET_SIZE> boxes;
+    std::array<float, 1 << TREELET_SIZE> best_cost;
+    std::array<uint32_t, 1 << TREELET_SIZE> best_split;
+    std::array<uint32_t, 1 << TREELET_SIZE> height;
+    for (uint32_t s = 1; s < num_subsets; ++s)
+    {
+        const uint32_t lowest = s & (~s + 1);
+        if (s == lowest)
+        {
+            size_t k = 0;
+            while ((s >> k) != 1)
+            {
+                ++k;
+            }
+            boxes[s] = tree.aabb[leaves[k]];
+            best_cost[s] = tree.cost[leaves[k]];
+            height[s] = tree.height[leaves[k]];
+            continue;
+        }
+        boxes[s] = boxes[s ^ lowest];
+        boxes[s].expandBy(boxes[lowest]);
+        float cost = std::numeric_limits<float>::infinity();
+        uint32_t split = 0;
+        // Enumerate partitions of s into two non-empty subsets, each once, by keeping the lowest
+        // leaf on the left
+        const uint32_t rest = s ^ lowest;
+        for (uint32_t q = rest;; q = (q - 1) & rest)
+        {
+            const uint32_t p = q | lowest;
+            if (p != s)
+            {
+                const float c = best_cost[p] + best_cost[s ^ p];
+                if (c < cost)
+                {
+                    cost = c;
+                    split = p;
+                }
+            }
+            if (q == 0)
+            {
+                break;
+            }
+        }
+        best_cost[s] = BVH_TRAVERSAL_COST * boxes[s].surfaceArea() + cost;
+        best_split[s] = split;
+        height[s] = 1 + std::max(height[split], height[s ^ split]);
+    }
+    if (!(best_cost[num_subsets - 1] < tree.cost[root]))
+    {
+        return;
+    }
+    // Keep the tree no deeper than the radix tree so traversal stacks stay bounded
+    if (height[num_subsets - 1] > tree.height[root])
+    {
+        return;
+    }
+
+    // Rebuild the treelet from the optimal partitions, reusing its internal nodes
+    size_t next_internal = 0;
+    struct Rebuilder
+    {
+        RadixTree &tree;
+        const std::array<uint32_t, TREELET_SIZE> &leaves;
+        const std::array<uint32_t, TREELET_SIZE - 1> &internals;
+        const std::array<uint32_t, 1 << TREELET_SIZE> &best_split;
+        size_t &next_internal;
+
+        uint32_t build(uint32_t s)
+        {
+            if ((s & (s - 1)) == 0)
+            {
+                size_t k = 0;
+                while ((s >> k) != 1)
+                {
+                    ++k;
+                }
+                return leaves[k];
+            }
+            const uint32_t node = internals[next_internal++];
+            const uint32_t l = build(best_split[s]);
+            const uint32_t r = build(s ^ best_split[s]);
+            tree.left[node] = l;
+            tree.right[node] = r;
+            tree.parent[l] = node;
+            tree.parent[r] = node;
+            tree.update(node);
+            return node;
+        }
+    };
+    Rebuilder rebuilder{tree, leaves, internals, best_split, next_internal};
+    rebuilder.build(num_subsets - 1);
+}
+
+// Writes the flattened subtree of a radix tree node into the output arrays
+struct Flattener
+{
+    const RadixTree &tree;
+    const std::vector<uint32_t> &sorted_prims;
+    std::vector<BVHNode> &nodes;
+    std::vector<uint32_t> &indices;
+
+    void emit(uint32_t node, uint32_t out, uint32_t prim_offset) const
+    {
+        nodes[out].aabb = tree.aabb[node];
+        if (tree.count[node] <= BVH_MAX_LEAF_SIZE)
+        {
+            nodes[out].offset = prim_offset;
+            nodes[out].count = tree.count[node];
+            gather(node, prim_offset);
+            return;
+        }
+        const uint32_t l = tree.left[node];
+        const uint32_t r = tree.right[node];
+        nodes[out].offset = out + 1 + tree.out_nodes[l];
+        nodes[out].count = 0;
+        emit(l, out + 1, prim_offset);
+        emit(r, nodes[out].offset, prim_offset + tree.count[l]);
+    }
+
+    uint32_t gather(uint32_t node, uint32_t prim_offset) const
+    {
+        if (tree.isLeaf(node))
+        {
+            indices[prim_offset] = sorted_prims[node - (tree.num_prims - 1)];
+            return prim_offset + 1;
+        }
+        return gather(tree.right[node], gather(tree.left[node], prim_offset));
+    }
+};
+
+} // namespace
+
+void buildLBVH(const std::vector<AABB> &bounds, const std::vector<glm::vec3> &centroids,
+               bool optimize_treelets, std::vector<BVHNode> &nodes,
+               std::vector<uint32_t> &indices)
+{
+    const size_t n = bounds.size();
+    nodes.clear();
+    indices.clear();
+    if (n == 0)
+    {
+        return;
+    }
+
+    // Quantize centroids to a grid over their bounding box
+    ThreadPool &pool = ThreadPool::instance();
+    const size_t num_chunks = std::min(pool.size(), n);
+    std::vector<AABB> chunk_bounds(num_chunks, AABB::null());
+    forEachChunk(n, num_chunks, [&](size_t chunk, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+        {
+            chunk_bounds[chunk].expandBy(centroids[i]);
+        }
+    });
+    AABB centroid_bounds = AABB::null();
+    for (const AABB &box : chunk_bounds)
+    {
+        centroid_bounds.expandBy(box);
+    }
+    const glm::vec3 extent = centroid_bounds.max() - centroid_bounds.min();
+    const float max_extent = std::max(extent.x, std::max(extent.y, extent.z));
+    const float grid_scale =
+        max_extent > 0.f ? float(1 << MORTON_BITS_PER_AXIS) / max_extent : 0.f;
+    const glm::vec3 scale(grid_scale, grid_scale, grid_scale);
+
+    std::vector<uint64_t> codes(n);
+    std::vector<uint32_t> sorted_prims(n);
+    pool.parallelFor(
+        0, n,
+        [&](size_t i) {
+            codes[i] = mortonCode(centroids[i], centroid_bounds.min(), scale);
+            sorted_prims[i] = uint32_t(i);
+        },
+        1024);
+    radixSort(codes, sorted_prims, MORTON_BITS);
+
+    // Build the radix tree: every internal node independently finds its children
+    RadixTree tree;
+    tree.num_prims = n;
+    const size_t num_tree_nodes = 2 * n - 1;
+    tree.left.assign(num_tree_nodes, INVALID);
+    tree.right.assign(num_tree_nodes, INVALID);
+    tree.parent.assign(num_tree_nodes, INVALID);
+    tree.aabb.resize(num_tree_nodes);
+    tree.count.resize(num_tree_nodes);
+    tree.out_nodes.resize(num_tree_nodes);
+    tree.height.resize(num_tree_nodes);
+    tree.cost.resize(num_tree_nodes);
+    pool.parallelFor(
+        0, n - 1, [&](size_t i) { buildInternalNode(tree, codes, int64_t(i)); }, 1024);
+
+    // Compute bounds bottom-up: the second thread to reach a node processes it, at which point
+    // both of its subtrees are complete (and restructured, if enabled)
+    std::unique_ptr<std::atomic<uint32_t>[]> visits(new std::atomic<uint32_t>[n]);
+    for (size_t i = 0; i + 1 < n; ++i)
+    {
+        visits[i].store(0, std::memory_order_relaxed);
+    }
+    pool.parallelFor(
+        0, n,
+        [&](size_t prim) {
+            uint32_t node = tree.leafIndex(uint32_t(prim));
+            tree.aabb[node] = bounds[sorted_prims[prim]];
+            tree.count[node] = 1;
+            tree.out_nodes[node] = 1;
+            tree.height[node] = 1;
+            tree.cost[node] = tree.aabb[node].surfaceArea();
+            node = tree.parent[node];
+            while (node != INVALID)
+            {
+                if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0)
+                {
+                    return;
+                }
+                tree.update(node);
+                if (optimize_treelets && tree.count[node] >= TREELET_SIZE)
+                {
+                    optimizeTreelet(tree, node);
+                }
+                node = tree.parent[node];
+            }
+        },
+        1024);
+
+    // Flatten into the depth-first node layout. Subtree sizes are known, so the top of the tree
+    // is expanded serially until there are enough independent subtrees to emit in parallel.
+    const uint32_t root = n == 1 ? tree.leafIndex(0) : 0;
+    nodes.resize(tree.out_nodes[root]);
+    indices.resize(n);
+    Flattener flattener{tree, sorted_prims, nodes, indices};
+    struct Task
+    {
+        uint32_t node, out, prim_offset;
+    };
+    std::vector<Task> tasks{{root, 0, 0}};
+    std::vector<Task> frontier;
+    const size_t target_tasks = 8 * pool.size();
+    while (!tasks.empty() && tasks.size() + frontier.size() < target_tasks)
+    {
+        std::vector<Task> next;
+        for (const Task &task : tasks)
+        {
+            if (tree.count[task.node] <= BVH_MAX_LEAF_SIZE)
+            {
+                frontier.push_back(task);
+                continue;
+            }
+            const uint32_t l = tree.left[task.node];
+            const uint32_t r = tree.right[task.node];
+            BVHNode &out = nodes[task.out];
+            out.aabb = tree.aabb[task.node];
+            out.offset = task.out + 1 + tree.out_nodes[l];
+            out.count = 0;
+            next.push_back({l, task.out + 1, task.prim_offset});
+            next.push_back({r, out.offset, task.prim_offset + tree.count[l]});
+        }
+        tasks.swap(next);
+    }
+    frontier.insert(frontier.end(), tasks.begin(), tasks.end());
+    pool.parallelFor(0, frontier.size(), [&](size_t i) {
+        flattener.emit(frontier[i].node, frontier[i].out, frontier[i].prim_offset);
+    });
+}
+
+} // namespace internal
+} // namespace rcube
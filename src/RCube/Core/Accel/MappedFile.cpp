@@ -0,0 +1,112 @@
+#include "RCube/Core/Accel/MappedFile.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rcube
+{
+
+#ifdef _WIN32
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        return nullptr;
+    }
+    void *data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (data == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return nullptr;
+    }
+    std::shared_ptr<MappedFile> mapped(new MappedFile());
+    mapped->file_ = file;
+    mapped->mapping_ = mapping;
+    mapped->data_ = static_cast<char *>(data);
+    mapped->size_ = static_cast<size_t>(size.QuadPart);
+    return mapped;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_ != nullptr)
+    {
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+        CloseHandle(file_);
+    }
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string &path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    std::shared_ptr<MappedFile> mapped(new MappedFile());
+    mapped->data_ = static_cast<char *>(data);
+    mapped->size_ = size;
+    return mapped;
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_ != nullptr)
+    {
+        munmap(data_, size_);
+    }
+}
+
+#endif
+
+char *MappedFile::data()
+{
+    return data_;
+}
+
+size_t MappedFile::size() const
+{
+    return size_;
+}
+
+} // namespace rcube
@@ -0,0 +1,163 @@
+#include "RCube/Core/Accel/PointSet.h"
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace rcube
+{
+
+namespace
+{
+
+template <typename Region>
+void pointsInRegion(const BVH &bvh, const std::vector<glm::vec3> &points, const Region &region,
+                    std::vector<uint32_t> &indices)
+{
+    bvh.rangeQuery([&](const AABB &box) { return region.classify(box); },
+                   [&](uint32_t i) { return region.contains(points[i]); }, indices);
+}
+
+} // namespace
+
+PointSet::PointSet(std::vector<glm::vec3> points, BVHBuildMethod method)
+{
+    build(std::move(points), method);
+}
+
+PointSet::PointSet(std::vector<glm::vec3> points, float radius, BVHBuildMethod method)
+{
+    build(std::move(points), radius, method);
+}
+
+PointSet::PointSet(std::vector<glm::vec3> points, std::vector<float> radii, BVHBuildMethod method)
+{
+    build(std::move(points), std::move(radii), method);
+}
+
+void PointSet::build(std::vector<glm::vec3> points, BVHBuildMethod method)
+{
+    build(std::move(points), 0.f, method);
+}
+
+void PointSet::build(std::vector<glm::vec3> points, float radius, BVHBuildMethod method)
+{
+    points_ = std::move(points);
+    radii_.clear();
+    radius_ = radius;
+    buildBVH(method);
+}
+
+void PointSet::build(std::vector<glm::vec3> points, std::vector<float> radii,
+                     BVHBuildMethod method)
+{
+    if (radii.size() != points.size())
+    {
+        throw std::runtime_error("Got " + std::to_string(radii.size()) + " radii for " +
+                                 std::to_string(points.size()) + " points");
+    }
+    points_ = std::move(points);
+    radii_ = std::move(radii);
+    radius_ = 0.f;
+    buildBVH(method);
+}
+
+void PointSet::buildBVH(BVHBuildMethod method)
+{
+    std::vector<AABB> bounds(points_.size());
+    for (size_t i = 0; i < points_.size(); ++i)
+    {
+        const glm::vec3 r(radius(static_cast<uint32_t>(i)));
+        bounds[i] = AABB(points_[i] - r, points_[i] + r);
+    }
+    bvh_.build(bounds, points_, method);
+}
+
+const std::vector<glm::vec3> &PointSet::points() const
+{
+    return points_;
+}
+
+const BVH &PointSet::bvh() const
+{
+    return bvh_;
+}
+
+size_t PointSet::size() const
+{
+    return points_.size();
+}
+
+float PointSet::radius(uint32_t index) const
+{
+    return radii_.empty() ? radius_ : radii_[index];
+}
+
+bool PointSet::rayIntersect(const Ray &ray, uint32_t &index, float &t) const
+{
+    return bvh_.rayIntersect(
+        ray,
+        [&](uint32_t i, const Ray &r, float &t_hit) {
+            return rcube::rayIntersect(points_[i], radius(i), r, t_hit);
+        },
+        index, t);
+}
+
+bool PointSet::occluded(const Ray &ray) const
+{
+    return bvh_.occluded(ray, [&](uint32_t i, const Ray &r, float &t_hit) {
+        return rcube::rayIntersect(points_[i], radius(i), r, t_hit);
+    });
+}
+
+bool PointSet::nearest(const glm::vec3 &p, uint32_t &index, float &distance,
+                       float max_distance) const
+{
+    float dist_sq;
+    auto point_distance = [&](uint32_t i) {
+        const glm::vec3 d = points_[i] - p;
+        return glm::dot(d, d);
+    };
+    if (!bvh_.nearest(p, point_distance, index, dist_sq, max_distance * max_distance))
+    {
+        return false;
+    }
+    distance = std::sqrt(dist_sq);
+    return true;
+}
+
+void PointSet::kNearest(const glm::vec3 &p, size_t k, std::vector<BVHNeighbor> &neighbors,
+                        float max_distance) const
+{
+    auto point_distance = [&](uint32_t i) {
+        const glm::vec3 d = points_[i] - p;
+        return glm::dot(d, d);
+    };
+    bvh_.kNearest(p, k, point_distance, neighbors, max_distance * max_distance);
+}
+
+void PointSet::radiusSearch(const glm::vec3 &p, float radius,
+                            std::vector<BVHNeighbor> &neighbors) const
+{
+    auto point_distance = [&](uint32_t i) {
+        const glm::vec3 d = points_[i] - p;
+        return glm::dot(d, d);
+    };
+    bvh_.radiusSearch(p, radius * radius, point_distance, neighbors);
+}
+
+void PointSet::rangeQuery(const AABB &box, std::vector<uint32_t> &indices) const
+{
+    pointsInRegion(bvh_, points_, box, indices);
+}
+
+void PointSet::rangeQuery(const Sphere &sphere, std::vector<uint32_t> &indices) const
+{
+    pointsInRegion(bvh_, points_, sphere, indices);
+}
+
+void PointSet::rangeQuery(const Frustum &frustum, std::vector<uint32_t> &indices) const
+{
+    pointsInRegion(bvh_, points_, frustum, indices);
+}
+
+} // namespace rcube
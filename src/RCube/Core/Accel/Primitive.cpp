@@ -1,11 +1,12 @@
 #include "RCube/Core/Accel/Primitive.h"
+#include <algorithm>
+#include <cmath>
 
 namespace rcube
 {
 
 Point::Point(size_t id, const glm::vec3 &pos, float radius) : pos_(pos), id_(id), radius_(radius)
 {
-    radius_sq_ = radius * radius;
 }
 
 size_t Point::id() const
@@ -15,18 +16,7 @@ size_t Point::id() const
 
 bool Point::rayIntersect(const Ray &ray, float &t) const
 {
-    const glm::vec3 L = pos_ - ray.origin();
-    const float tca = glm::dot(L, ray.direction());
-    const float d2 = glm::dot(L, L) - tca * tca;
-    if (d2 > radius_sq_)
-    {
-        return false;
-    }
-    const float thc = std::sqrt(radius_sq_ - d2);
-    const float t0 = tca - thc;
-    const float t1 = tca + thc;
-    t = std::min(t0, t1);
-    return true;
+    return rcube::rayIntersect(pos_, radius_, ray, t);
 }
 
 glm::vec3 Point::position() const
@@ -52,52 +42,389 @@ size_t Triangle::id() const
 
 bool Triangle::rayIntersect(const Ray &ray, float &t) const
 {
-    const glm::vec3 v0v1 = v1_ - v0_;
-    const glm::vec3 v0v2 = v2_ - v0_;
-    const glm::vec3 pvec = glm::cross(ray.direction(), v0v2);
-    const float det = glm::dot(v0v1, pvec);
+    return rcube::rayIntersect(v0_, v1_, v2_, ray, t);
+}
+
+glm::vec3 Triangle::position() const
+{
+    // This can be precomputed
+    return (v0_ + v1_ + v2_) / 3.f;
+}
+
+AABB Triangle::aabb() const
+{
+    // This can be precomputed
+    return AABB{glm::min(v0_, glm::min(v1_, v2_)), glm::max(v0_, glm::max(v1_, v2_))};
+}
 
-    // if the determinant is negative the triangle is backfacing
-    // if the determinant is close to 0, the ray misses the triangle
-    if (std::abs(det) < 1e-6)
+bool rayIntersect(const glm::vec3 &center, float radius, const Ray &ray, float &t)
+{
+    const glm::vec3 L = center - ray.origin();
+    const float tca = glm::dot(L, ray.direction());
+    // Squared distance from the center to the ray, computed from the closest point rather than
+    // as |L|^2 - tca^2 to avoid cancellation for small spheres far from the origin
+    const glm::vec3 offset = L - tca * ray.direction();
+    const float d2 = glm::dot(offset, offset);
+    const float radius_sq = radius * radius;
+    if (d2 > radius_sq)
     {
         return false;
     }
+    const float thc = std::sqrt(radius_sq - d2);
+    const float t0 = tca - thc;
+    const float t1 = tca + thc;
+    // Closest intersection in front of the ray origin, within [tmin, tmax]
+    const float tempt = t0 >= ray.tmin() ? t0 : t1;
+    if (tempt < ray.tmin() || tempt > ray.tmax())
+    {
+        return false;
+    }
+    t = tempt;
+    return true;
+}
+
+WatertightRay::WatertightRay(const Ray &ray)
+{
+    const glm::vec3 &d = ray.direction();
+    const glm::vec3 ad = glm::abs(d);
+    kz = ad.x > ad.y ? (ad.x > ad.z ? 0 : 2) : (ad.y > ad.z ? 1 : 2);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    sz = 1.f / d[kz];
+    sx = d[kx] * sz;
+    sy = d[ky] * sz;
+}
+
+bool rayIntersect(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const Ray &ray,
+                  float &t)
+{
+    return rayIntersect(v0, v1, v2, ray, WatertightRay(ray), t);
+}
+
+bool rayIntersect(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const Ray &ray,
+                  const WatertightRay &wray, float &t)
+{
+    // Vertices relative to the ray origin, sheared so that the ray points along +z
+    const glm::vec3 a = v0 - ray.origin();
+    const glm::vec3 b = v1 - ray.origin();
+    const glm::vec3 c = v2 - ray.origin();
+    const float ax = a[wray.kx] - wray.sx * a[wray.kz];
+    const float ay = a[wray.ky] - wray.sy * a[wray.kz];
+    const float bx = b[wray.kx] - wray.sx * b[wray.kz];
+    const float by = b[wray.ky] - wray.sy * b[wray.kz];
+    const float cx = c[wray.kx] - wray.sx * c[wray.kz];
+    const float cy = c[wray.ky] - wray.sy * c[wray.kz];
+
+    // Scaled barycentric coordinates: 2D edge functions of the projected triangle
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+    if (u == 0.f || v == 0.f || w == 0.f)
+    {
+        // The ray passes through an edge as far as single precision can tell; recompute exactly
+        // so that the triangles sharing the edge agree on which of them is hit
+        u = static_cast<float>(double(cx) * double(by) - double(cy) * double(bx));
+        v = static_cast<float>(double(ax) * double(cy) - double(ay) * double(cx));
+        w = static_cast<float>(double(bx) * double(ay) - double(by) * double(ax));
+    }
+    // The ray is inside if all edge functions have the same sign (either side is hit)
+    if ((u < 0.f || v < 0.f || w < 0.f) && (u > 0.f || v > 0.f || w > 0.f))
+    {
+        return false;
+    }
+    const float det = u + v + w;
+    if (det == 0.f)
+    {
+        return false;
+    }
+    const float az = wray.sz * a[wray.kz];
+    const float bz = wray.sz * b[wray.kz];
+    const float cz = wray.sz * c[wray.kz];
+    const float t_hit = (u * az + v * bz + w * cz) / det;
+    if (!(t_hit >= ray.tmin() && t_hit <= ray.tmax()))
+    {
+        return false;
+    }
+    t = t_hit;
+    return true;
+}
+
+glm::vec3 closestPoint(const glm::vec3 &p, const glm::vec3 &v0, const glm::vec3 &v1,
+                       const glm::vec3 &v2, glm::vec3 &barycentrics)
+{
+    // Voronoi region tests from Ericson, Real-Time Collision Detection, 5.1.5
+    const glm::vec3 ab = v1 - v0;
+    const glm::vec3 ac = v2 - v0;
+    const glm::vec3 ap = p - v0;
+    const float d1 = glm::dot(ab, ap);
+    const float d2 = glm::dot(ac, ap);
+    if (d1 <= 0.f && d2 <= 0.f)
+    {
+        barycentrics = glm::vec3(1.f, 0.f, 0.f);
+        return v0;
+    }
+    const glm::vec3 bp = p - v1;
+    const float d3 = glm::dot(ab, bp);
+    const float d4 = glm::dot(ac, bp);
+    if (d3 >= 0.f && d4 <= d3)
+    {
+        barycentrics = glm::vec3(0.f, 1.f, 0.f);
+        return v1;
+    }
+    const float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+    {
+        const float v = d1 / (d1 - d3);
+        barycentrics = glm::vec3(1.f - v, v, 0.f);
+        return v0 + v * ab;
+    }
+    const glm::vec3 cp = p - v2;
+    const float d5 = glm::dot(ab, cp);
+    const float d6 = glm::dot(ac, cp);
+    if (d6 >= 0.f && d5 <= d6)
+    {
+        barycentrics = glm::vec3(0.f, 0.f, 1.f);
+        return v2;
+    }
+    const float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+    {
+        const float w = d2 / (d2 - d6);
+        barycentrics = glm::vec3(1.f - w, 0.f, w);
+        return v0 + w * ac;
+    }
+    const float va = d3 * d6 - d5 * d4;
+    if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+    {
+        const float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        barycentrics = glm::vec3(0.f, 1.f - w, w);
+        return v1 + w * (v2 - v1);
+    }
+    // Inside the face
+    const float denom = 1.f / (va + vb + vc);
+    const float v = vb * denom;
+    const float w = vc * denom;
+    barycentrics = glm::vec3(1.f - v - w, v, w);
+    return v0 + v * ab + w * ac;
+}
 
-    float invDet = 1.f / det;
-    const glm::vec3 tvec = ray.origin() - v0_;
-    float u = glm::dot(tvec, pvec) * invDet;
-    if (u < 0.0f || u > 1.0f)
+bool overlaps(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const AABB &box)
+{
+    if (box.isNull())
     {
         return false;
     }
+    // Test the 13 potential separating axes with the box centered at the origin: the box face
+    // normals, the triangle normal and the cross products of their edges (Akenine-Moller)
+    const glm::vec3 center = box.center();
+    const glm::vec3 half = box.max() - center;
+    const glm::vec3 a = v0 - center;
+    const glm::vec3 b = v1 - center;
+    const glm::vec3 c = v2 - center;
+    auto separated = [&](const glm::vec3 &axis) {
+        const float pa = glm::dot(a, axis);
+        const float pb = glm::dot(b, axis);
+        const float pc = glm::dot(c, axis);
+        const float r = glm::dot(half, glm::abs(axis));
+        return std::min(pa, std::min(pb, pc)) > r || std::max(pa, std::max(pb, pc)) < -r;
+    };
+    const glm::vec3 edges[3] = {b - a, c - b, a - c};
+    const glm::vec3 box_axes[3] = {glm::vec3(1.f, 0.f, 0.f), glm::vec3(0.f, 1.f, 0.f),
+                                   glm::vec3(0.f, 0.f, 1.f)};
+    for (const glm::vec3 &axis : box_axes)
+    {
+        if (separated(axis))
+        {
+            return false;
+        }
+    }
+    if (separated(glm::cross(edges[0], edges[1])))
+    {
+        return false;
+    }
+    for (const glm::vec3 &box_axis : box_axes)
+    {
+        for (const glm::vec3 &edge : edges)
+        {
+            if (separated(glm::cross(box_axis, edge)))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool overlaps(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2,
+              const Sphere &sphere)
+{
+    glm::vec3 barycentrics;
+    return sphere.contains(closestPoint(sphere.center, v0, v1, v2, barycentrics));
+}
+
+bool overlaps(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2,
+              const Frustum &frustum)
+{
+    for (const glm::vec4 &plane : frustum.planes)
+    {
+        const glm::vec3 n(plane);
+        if (glm::dot(n, v0) + plane.w < 0.f && glm::dot(n, v1) + plane.w < 0.f &&
+            glm::dot(n, v2) + plane.w < 0.f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace
+{
+
+using dvec3 = glm::dvec3;
+
+// Sign of the volume of the tetrahedron (a, b, c, d): positive if d is above the plane of the
+// counterclockwise triangle (a, b, c)
+double orient3d(const dvec3 &a, const dvec3 &b, const dvec3 &c, const dvec3 &d)
+{
+    return glm::dot(glm::cross(b - a, c - a), d - a);
+}
 
-    const glm::vec3 qvec = glm::cross(tvec, v0v1);
-    const float v = glm::dot(ray.direction(), qvec) * invDet;
-    if (v < 0.0f || u + v > 1.0f)
+double orient2d(const glm::dvec2 &a, const glm::dvec2 &b, const glm::dvec2 &c)
+{
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+bool sameSide(double a, double b)
+{
+    return (a > 0. && b > 0.) || (a < 0. && b < 0.);
+}
+
+// Whether segment pq, which does not lie in the plane of triangle abc, meets the triangle
+bool segmentCrossesTriangle(const dvec3 &p, const dvec3 &q, const dvec3 &a, const dvec3 &b,
+                            const dvec3 &c)
+{
+    const double sp = orient3d(a, b, c, p);
+    const double sq = orient3d(a, b, c, q);
+    if (sameSide(sp, sq) || (sp == 0. && sq == 0.))
     {
         return false;
     }
+    // The line through p and q passes inside the triangle if it turns the same way around all
+    // three edges
+    const double o0 = orient3d(p, q, a, b);
+    const double o1 = orient3d(p, q, b, c);
+    const double o2 = orient3d(p, q, c, a);
+    return (o0 >= 0. && o1 >= 0. && o2 >= 0.) || (o0 <= 0. && o1 <= 0. && o2 <= 0.);
+}
 
-    const float tempt = glm::dot(v0v2, qvec) * invDet;
-    if (tempt < ray.tmin() || tempt > ray.tmax())
+bool segmentsIntersect2d(const glm::dvec2 &a, const glm::dvec2 &b, const glm::dvec2 &c,
+                         const glm::dvec2 &d)
+{
+    const double o0 = orient2d(a, b, c);
+    const double o1 = orient2d(a, b, d);
+    const double o2 = orient2d(c, d, a);
+    const double o3 = orient2d(c, d, b);
+    if (sameSide(o0, o1) || sameSide(o2, o3))
     {
         return false;
     }
-    t = tempt;
+    if (o0 == 0. && o1 == 0.)
+    {
+        // Collinear: overlap of the projections on the dominant axis
+        const int k = std::abs(b.x - a.x) + std::abs(d.x - c.x) >=
+                              std::abs(b.y - a.y) + std::abs(d.y - c.y)
+                          ? 0
+                          : 1;
+        return std::max(std::min(a[k], b[k]), std::min(c[k], d[k])) <=
+               std::min(std::max(a[k], b[k]), std::max(c[k], d[k]));
+    }
     return true;
 }
 
-glm::vec3 Triangle::position() const
+bool insideTriangle2d(const glm::dvec2 &p, const glm::dvec2 *t)
 {
-    // This can be precomputed
-    return (v0_ + v1_ + v2_) / 3.f;
+    const double o0 = orient2d(t[0], t[1], p);
+    const double o1 = orient2d(t[1], t[2], p);
+    const double o2 = orient2d(t[2], t[0], p);
+    return (o0 >= 0. && o1 >= 0. && o2 >= 0.) || (o0 <= 0. && o1 <= 0. && o2 <= 0.);
 }
 
-AABB Triangle::aabb() const
+// Overlap of two triangles lying in the same plane with normal n
+bool coplanarTrianglesOverlap(const dvec3 *a, const dvec3 *b, const dvec3 &n)
 {
-    // This can be precomputed
-    return AABB{glm::min(v0_, glm::min(v1_, v2_)), glm::max(v0_, glm::max(v1_, v2_))};
+    // Drop the coordinate along which the normal is largest
+    const dvec3 an = glm::abs(n);
+    const int drop = an.x >= an.y && an.x >= an.z ? 0 : (an.y >= an.z ? 1 : 2);
+    const int i = drop == 0 ? 1 : 0;
+    const int j = drop == 2 ? 1 : 2;
+    glm::dvec2 pa[3], pb[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        pa[k] = glm::dvec2(a[k][i], a[k][j]);
+        pb[k] = glm::dvec2(b[k][i], b[k][j]);
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+        for (int l = 0; l < 3; ++l)
+        {
+            if (segmentsIntersect2d(pa[k], pa[(k + 1) % 3], pb[l], pb[(l + 1) % 3]))
+            {
+                return true;
+            }
+        }
+    }
+    // No edges cross, so either one triangle contains the other or they are disjoint
+    return insideTriangle2d(pa[0], pb) || insideTriangle2d(pb[0], pa);
+}
+
+} // namespace
+
+bool overlaps(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, const glm::vec3 &u0,
+              const glm::vec3 &u1, const glm::vec3 &u2)
+{
+    const dvec3 a[3] = {dvec3(v0), dvec3(v1), dvec3(v2)};
+    const dvec3 b[3] = {dvec3(u0), dvec3(u1), dvec3(u2)};
+    // Reject if either triangle is entirely on one side of the other's plane
+    const dvec3 nb = glm::cross(b[1] - b[0], b[2] - b[0]);
+    double da[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        da[k] = glm::dot(nb, a[k] - b[0]);
+    }
+    if (sameSide(da[0], da[1]) && sameSide(da[0], da[2]))
+    {
+        return false;
+    }
+    const dvec3 na = glm::cross(a[1] - a[0], a[2] - a[0]);
+    double db[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        db[k] = glm::dot(na, b[k] - a[0]);
+    }
+    if (sameSide(db[0], db[1]) && sameSide(db[0], db[2]))
+    {
+        return false;
+    }
+    // Coplanar triangles; a degenerate triangle lies in every plane, so it is only handled here
+    // if it lies in the plane of the other triangle
+    const dvec3 zero(0.);
+    const bool a_in_plane = nb != zero && da[0] == 0. && da[1] == 0. && da[2] == 0.;
+    const bool b_in_plane = na != zero && db[0] == 0. && db[1] == 0. && db[2] == 0.;
+    if (a_in_plane || b_in_plane)
+    {
+        return coplanarTrianglesOverlap(a, b, b_in_plane ? na : nb);
+    }
+    // The intersection of two triangles in different planes, if any, is a segment whose ends lie
+    // on edges of the triangles, so some edge of one triangle must cross the other
+    for (int k = 0; k < 3; ++k)
+    {
+        if (segmentCrossesTriangle(a[k], a[(k + 1) % 3], b[0], b[1], b[2]) ||
+            segmentCrossesTriangle(b[k], b[(k + 1) % 3], a[0], a[1], a[2]))
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 } // namespace rcube
@@ -1,4 +1,5 @@
 #include "RCube/Core/Accel/Ray.h"
+#include <cmath>
 
 namespace rcube
 {
@@ -6,7 +7,9 @@ Ray::Ray(const glm::vec3 o, const glm::vec3 d, float tmin, float tmax)
     : orig(o), tmin_(tmin), tmax_(tmax)
 {
     dir = glm::normalize(d);
-    inv_dir = 1.0f / orig;
+    inv_dir = 1.0f / dir;
+    dir_signs = (std::signbit(inv_dir.x) ? 1 : 0) | (std::signbit(inv_dir.y) ? 2 : 0) |
+                (std::signbit(inv_dir.z) ? 4 : 0);
 }
 
 const glm::vec3 &Ray::origin() const
@@ -24,6 +27,11 @@ const glm::vec3 &Ray::inverseDirection() const
     return inv_dir;
 }
 
+int Ray::directionSigns() const
+{
+    return dir_signs;
+}
+
 float Ray::tmin() const
 {
     return tmin_;
@@ -34,4 +42,9 @@ float Ray::tmax() const
     return tmax_;
 }
 
+void Ray::setTmax(float t)
+{
+    tmax_ = t;
+}
+
 } // namespace rcube
\ No newline at end of file
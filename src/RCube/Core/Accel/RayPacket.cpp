@@ -0,0 +1,56 @@
+#include "RCube/Core/Accel/RayPacket.h"
+#include <algorithm>
+
+namespace rcube
+{
+
+RayPacket4::RayPacket4(const Ray *rays, size_t count)
+{
+    float ox[4] = {0.f}, oy[4] = {0.f}, oz[4] = {0.f};
+    float dx[4] = {1.f, 1.f, 1.f, 1.f}, dy[4] = {1.f, 1.f, 1.f, 1.f}, dz[4] = {1.f, 1.f, 1.f, 1.f};
+    // Inactive lanes get an empty interval so they never report hits
+    float t0[4], t1[4];
+    std::fill(t0, t0 + 4, std::numeric_limits<float>::infinity());
+    std::fill(t1, t1 + 4, -std::numeric_limits<float>::infinity());
+    count = std::min(count, RAY_PACKET_SIZE);
+    for (size_t i = 0; i < count; ++i)
+    {
+        ox[i] = rays[i].origin().x;
+        oy[i] = rays[i].origin().y;
+        oz[i] = rays[i].origin().z;
+        dx[i] = rays[i].direction().x;
+        dy[i] = rays[i].direction().y;
+        dz[i] = rays[i].direction().z;
+        t0[i] = rays[i].tmin();
+        t1[i] = rays[i].tmax();
+        active |= 1 << i;
+    }
+    origin = simd::vec3x4{simd::float4::load(ox), simd::float4::load(oy), simd::float4::load(oz)};
+    direction =
+        simd::vec3x4{simd::float4::load(dx), simd::float4::load(dy), simd::float4::load(dz)};
+    inv_direction = simd::vec3x4{simd::float4(1.f) / direction.x, simd::float4(1.f) / direction.y,
+                                 simd::float4(1.f) / direction.z};
+    const simd::float4 zero(0.f);
+    negative_direction = simd::vec3x4{inv_direction.x < zero, inv_direction.y < zero,
+                                      inv_direction.z < zero};
+    tmin = simd::float4::load(t0);
+    tmax = simd::float4::load(t1);
+
+    float is_x[4], is_y[4], sx[4], sy[4], sz[4];
+    for (size_t i = 0; i < 4; ++i)
+    {
+        // Inactive lanes get the constants of their dummy +z direction
+        const Ray ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]));
+        const WatertightRay wray(i < count ? rays[i] : ray);
+        is_x[i] = wray.kz == 0 ? 1.f : 0.f;
+        is_y[i] = wray.kz == 1 ? 1.f : 0.f;
+        sx[i] = wray.sx;
+        sy[i] = wray.sy;
+        sz[i] = wray.sz;
+    }
+    dominant_x = simd::float4::load(is_x) > simd::float4(0.f);
+    dominant_y = simd::float4::load(is_y) > simd::float4(0.f);
+    shear = simd::vec3x4{simd::float4::load(sx), simd::float4::load(sy), simd::float4::load(sz)};
+}
+
+} // namespace rcube
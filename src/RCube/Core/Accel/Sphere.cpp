@@ -0,0 +1,28 @@
+#include "RCube/Core/Accel/Sphere.h"
+
+namespace rcube
+{
+
+Sphere::Sphere(const glm::vec3 &c, float r) : center(c), radius(r)
+{
+}
+
+bool Sphere::contains(const glm::vec3 &p) const
+{
+    const glm::vec3 d = p - center;
+    return glm::dot(d, d) <= radius * radius;
+}
+
+Overlap Sphere::classify(const AABB &box) const
+{
+    const float radius_sq = radius * radius;
+    if (box.distanceSquared(center) > radius_sq)
+    {
+        return Overlap::Outside;
+    }
+    // The box is inside if its corner farthest from the center is
+    const glm::vec3 far = glm::max(glm::abs(box.min() - center), glm::abs(box.max() - center));
+    return glm::dot(far, far) <= radius_sq ? Overlap::Inside : Overlap::Partial;
+}
+
+} // namespace rcube
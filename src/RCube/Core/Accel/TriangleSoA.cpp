@@ -0,0 +1,252 @@
+#include "RCube/Core/Accel/TriangleSoA.h"
+#include "RCube/Core/Accel/SIMD.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace rcube
+{
+
+void TriangleSoA::build(const TriangleMeshView &triangles, const BVH &bvh)
+{
+    const MappedArray<uint32_t> &indices = bvh.primitiveIndices();
+    if (indices.size() != triangles.num_faces)
+    {
+        throw std::runtime_error("BVH was built over " + std::to_string(indices.size()) +
+                                 " primitives but the mesh has " +
+                                 std::to_string(triangles.num_faces) + " triangles");
+    }
+    size_ = indices.size();
+    stride_ = size_ + 3;
+    // Padding is zero, i.e., degenerate triangles that are never reported as hits
+    coords_.assign(9 * stride_, 0.f);
+    ThreadPool::instance().parallelFor(
+        0, size_,
+        [&](size_t i) {
+            glm::vec3 v[3];
+            triangles.vertices(indices[i], v[0], v[1], v[2]);
+            for (int k = 0; k < 3; ++k)
+            {
+                for (int c = 0; c < 3; ++c)
+                {
+                    coords_[(3 * k + c) * stride_ + i] = v[k][c];
+                }
+            }
+        },
+        1024);
+}
+
+void TriangleSoA::clear()
+{
+    coords_.clear();
+    size_ = 0;
+    stride_ = 0;
+}
+
+size_t TriangleSoA::size() const
+{
+    return size_;
+}
+
+bool TriangleSoA::empty() const
+{
+    return size_ == 0;
+}
+
+int TriangleSoA::intersectBlock(uint32_t position, int lanes, const Ray &ray,
+                                const WatertightRay &wray, float t[4]) const
+{
+    using namespace simd;
+    const float *base = coords_.data() + position;
+    const glm::vec3 &o = ray.origin();
+    // Coordinate along an axis of vertex k of the four triangles, relative to the ray origin
+    auto load = [&](int k, int axis) {
+        return float4::load(base + (3 * k + axis) * stride_) - float4(o[axis]);
+    };
+    const float4 sx(wray.sx), sy(wray.sy), sz(wray.sz);
+    const float4 a_kz = load(0, wray.kz);
+    const float4 b_kz = load(1, wray.kz);
+    const float4 c_kz = load(2, wray.kz);
+    const float4 ax = load(0, wray.kx) - sx * a_kz;
+    const float4 ay = load(0, wray.ky) - sy * a_kz;
+    const float4 bx = load(1, wray.kx) - sx * b_kz;
+    const float4 by = load(1, wray.ky) - sy * b_kz;
+    const float4 cx = load(2, wray.kx) - sx * c_kz;
+    const float4 cy = load(2, wray.ky) - sy * c_kz;
+    const float4 u = cx * by - cy * bx;
+    const float4 v = ax * cy - ay * cx;
+    const float4 w = bx * ay - by * ax;
+
+    const float4 zero(0.f);
+    // Lanes with an edge function of exactly zero are redone by the scalar test, which falls
+    // back to double precision
+    const int exact = lanes & ~movemask((abs(u) > zero) & (abs(v) > zero) & (abs(w) > zero));
+    const int negative = movemask((u < zero) | (v < zero) | (w < zero));
+    const int positive = movemask((u > zero) | (v > zero) | (w > zero));
+    const float4 det = u + v + w;
+    const float4 t_hit = (u * (sz * a_kz) + v * (sz * b_kz) + w * (sz * c_kz)) / det;
+    const int valid = movemask((abs(det) > zero) & (t_hit >= float4(ray.tmin())) &
+                               (t_hit <= float4(ray.tmax())));
+    int hits = lanes & ~exact & ~(negative & positive) & valid;
+    t_hit.store(t);
+    for (int i = 0; i < 4; ++i)
+    {
+        if ((exact >> i) & 1)
+        {
+            const uint32_t p = position + i;
+            if (rcube::rayIntersect(vertex(p, 0), vertex(p, 1), vertex(p, 2), ray, wray, t[i]))
+            {
+                hits |= 1 << i;
+            }
+        }
+    }
+    return hits;
+}
+
+bool TriangleSoA::rayIntersect(uint32_t first, uint32_t count, const Ray &ray,
+                               const WatertightRay &wray, uint32_t &position, float &t) const
+{
+    bool hit = false;
+    float t_closest = ray.tmax();
+    for (uint32_t p = first; p < first + count; p += 4)
+    {
+        const uint32_t n = std::min(4u, first + count - p);
+        float t_lanes[4];
+        const int hits = intersectBlock(p, (1 << n) - 1, ray, wray, t_lanes);
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            if (((hits >> i) & 1) && t_lanes[i] <= t_closest)
+            {
+                hit = true;
+                position = p + i;
+                t_closest = t_lanes[i];
+            }
+        }
+    }
+    t = t_closest;
+    return hit;
+}
+
+bool TriangleSoA::occluded(uint32_t first, uint32_t count, const Ray &ray,
+                           const WatertightRay &wray) const
+{
+    for (uint32_t p = first; p < first + count; p += 4)
+    {
+        const uint32_t n = std::min(4u, first + count - p);
+        float t_lanes[4];
+        if (intersectBlock(p, (1 << n) - 1, ray, wray, t_lanes) != 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int TriangleSoA::rayIntersect(uint32_t first, uint32_t count, const RayPacket4 &packet, int mask,
+                              simd::float4 &t, uint32_t position[RAY_PACKET_SIZE]) const
+{
+    RayPacket4 p = packet;
+    int hit = 0;
+    for (uint32_t i = first; i < first + count; ++i)
+    {
+        simd::float4 t_tri = p.tmax;
+        const int tri_hit = rcube::rayIntersect(vertex(i, 0), vertex(i, 1), vertex(i, 2), p, mask,
+                                                t_tri);
+        if (tri_hit == 0)
+        {
+            continue;
+        }
+        hit |= tri_hit;
+        p.tmax = simd::select(simd::laneMask(tri_hit), t_tri, p.tmax);
+        for (size_t k = 0; k < RAY_PACKET_SIZE; ++k)
+        {
+            if (tri_hit & (1 << k))
+            {
+                position[k] = i;
+            }
+        }
+    }
+    t = p.tmax;
+    return hit;
+}
+
+int TriangleSoA::occluded(uint32_t first, uint32_t count, const RayPacket4 &packet,
+                          int mask) const
+{
+    int hit = 0;
+    for (uint32_t i = first; i < first + count && (mask & ~hit) != 0; ++i)
+    {
+        simd::float4 t_tri = packet.tmax;
+        hit |= rcube::rayIntersect(vertex(i, 0), vertex(i, 1), vertex(i, 2), packet, mask & ~hit,
+                                   t_tri);
+    }
+    return hit;
+}
+
+bool TriangleSoA::rayIntersect(const BVH &bvh, const Ray &ray, uint32_t &face, float &t) const
+{
+    const WatertightRay wray(ray);
+    return bvh.rayIntersectLeaves(
+        ray,
+        [&](uint32_t first, uint32_t count, const Ray &r, uint32_t &position, float &t_hit) {
+            return rayIntersect(first, count, r, wray, position, t_hit);
+        },
+        face, t);
+}
+
+int TriangleSoA::rayIntersect(const BVH &bvh, const RayPacket4 &packet,
+                              uint32_t face[RAY_PACKET_SIZE], float t[RAY_PACKET_SIZE]) const
+{
+    return bvh.rayIntersectLeaves(
+        packet,
+        [&](uint32_t first, uint32_t count, const RayPacket4 &p, int mask, simd::float4 &t_hit,
+            uint32_t position[RAY_PACKET_SIZE]) {
+            return rayIntersect(first, count, p, mask, t_hit, position);
+        },
+        face, t);
+}
+
+bool TriangleSoA::occluded(const BVH &bvh, const Ray &ray) const
+{
+    const WatertightRay wray(ray);
+    return bvh.occludedLeaves(ray, [&](uint32_t first, uint32_t count, const Ray &r) {
+        return occluded(first, count, r, wray);
+    });
+}
+
+int TriangleSoA::occluded(const BVH &bvh, const RayPacket4 &packet) const
+{
+    return bvh.occludedLeaves(
+        packet, [&](uint32_t first, uint32_t count, const RayPacket4 &p, int mask) {
+            return occluded(first, count, p, mask);
+        });
+}
+
+bool TriangleSoA::rayIntersect(const BVH &bvh, const WideBVH &wide_bvh, const Ray &ray,
+                               uint32_t &face, float &t) const
+{
+    const WatertightRay wray(ray);
+    uint32_t position;
+    const bool hit = wide_bvh.rayIntersectLeaves(
+        ray,
+        [&](uint32_t first, uint32_t count, const Ray &r, uint32_t &p, float &t_hit) {
+            return rayIntersect(first, count, r, wray, p, t_hit);
+        },
+        position, t);
+    if (hit)
+    {
+        face = bvh.primitiveIndices()[position];
+    }
+    return hit;
+}
+
+bool TriangleSoA::occluded(const WideBVH &wide_bvh, const Ray &ray) const
+{
+    const WatertightRay wray(ray);
+    return wide_bvh.occludedLeaves(ray, [&](uint32_t first, uint32_t count, const Ray &r) {
+        return occluded(first, count, r, wray);
+    });
+}
+
+} // namespace rcube
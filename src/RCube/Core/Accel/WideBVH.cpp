@@ -0,0 +1,226 @@
+#include "RCube/Core/Accel/WideBVH.h"
+#include <algorithm>
+#include <cmath>
+
+namespace rcube
+{
+
+namespace
+{
+
+constexpr int MIN_EXPONENT = -126;
+constexpr int MAX_EXPONENT = 127;
+
+float dequantize(float origin, uint8_t q, float step)
+{
+    return origin + static_cast<float>(q) * step;
+}
+
+/**
+ * Stores the children's boxes in a node, rounding outwards so that the boxes dequantized by the
+ * traversal contain the exact ones
+ */
+void quantize(WideBVHNode &node, const AABB *boxes, int num_children)
+{
+    AABB box = AABB::null();
+    for (int i = 0; i < num_children; ++i)
+    {
+        box.expandBy(boxes[i]);
+    }
+    node.origin = box.min();
+    for (int a = 0; a < 3; ++a)
+    {
+        // Smallest power of two step with which 255 steps span the box
+        const float extent = box.max()[a] - box.min()[a];
+        int e = MIN_EXPONENT;
+        if (extent > 0.f)
+        {
+            std::frexp(extent / 255.f, &e);
+            e = std::max(e, MIN_EXPONENT);
+        }
+        node.exponent[a] = static_cast<int8_t>(e);
+        while (e < MAX_EXPONENT && dequantize(node.origin[a], 255, node.step(a)) < box.max()[a])
+        {
+            node.exponent[a] = static_cast<int8_t>(++e);
+        }
+        const float step = node.step(a);
+        for (int i = 0; i < num_children; ++i)
+        {
+            const float lo = std::floor((boxes[i].min()[a] - node.origin[a]) / step);
+            const float hi = std::ceil((boxes[i].max()[a] - node.origin[a]) / step);
+            uint8_t q_lo = static_cast<uint8_t>(std::min(std::max(lo, 0.f), 255.f));
+            uint8_t q_hi = static_cast<uint8_t>(std::min(std::max(hi, 0.f), 255.f));
+            // Division and addition round, so check the planes as the traversal computes them
+            while (q_lo > 0 && dequantize(node.origin[a], q_lo, step) > boxes[i].min()[a])
+            {
+                --q_lo;
+            }
+            while (q_hi < 255 && dequantize(node.origin[a], q_hi, step) < boxes[i].max()[a])
+            {
+                ++q_hi;
+            }
+            node.lo[a][i] = q_lo;
+            node.hi[a][i] = q_hi;
+        }
+    }
+}
+
+} // namespace
+
+AABB WideBVHNode::childBounds(int i) const
+{
+    glm::vec3 bb_min, bb_max;
+    for (int a = 0; a < 3; ++a)
+    {
+        bb_min[a] = dequantize(origin[a], lo[a][i], step(a));
+        bb_max[a] = dequantize(origin[a], hi[a][i], step(a));
+    }
+    return AABB(bb_min, bb_max);
+}
+
+void WideBVH::build(const BVH &bvh)
+{
+    clear();
+    if (bvh.empty())
+    {
+        return;
+    }
+    const MappedArray<BVHNode> &binary = bvh.nodes();
+    bounds_ = bvh.bounds();
+    // Collapsed trees typically have a quarter as many nodes as the binary tree
+    nodes_.reserve(binary.size() / 4 + 1);
+    if (!binary[0].isLeaf())
+    {
+        collapse(binary, 0);
+        return;
+    }
+    if (binary[0].count > WIDE_BVH_MAX_LEAF_SIZE)
+    {
+        splitLeaf(binary[0], binary[0].offset, binary[0].count);
+        return;
+    }
+    // A single leaf becomes the only child of the root
+    WideBVHNode root{};
+    root.num_children = 1;
+    root.child[0] = binary[0].offset;
+    root.count[0] = static_cast<uint8_t>(binary[0].count);
+    quantize(root, &binary[0].aabb, 1);
+    nodes_.push_back(root);
+}
+
+void WideBVH::clear()
+{
+    nodes_.clear();
+    bounds_ = AABB::null();
+}
+
+bool WideBVH::empty() const
+{
+    return nodes_.empty();
+}
+
+const AABB &WideBVH::bounds() const
+{
+    return bounds_;
+}
+
+const std::vector<WideBVHNode> &WideBVH::nodes() const
+{
+    return nodes_;
+}
+
+uint32_t WideBVH::collapse(const MappedArray<BVHNode> &binary, uint32_t index)
+{
+    uint32_t children[WIDE_BVH_WIDTH] = {index + 1, binary[index].offset};
+    size_t num_children = 2;
+    while (num_children < WIDE_BVH_WIDTH)
+    {
+        // Open the interior child with the largest surface area
+        size_t largest = num_children;
+        float largest_area = -1.f;
+        for (size_t i = 0; i < num_children; ++i)
+        {
+            const BVHNode &node = binary[children[i]];
+            if (!node.isLeaf() && node.aabb.surfaceArea() > largest_area)
+            {
+                largest = i;
+                largest_area = node.aabb.surfaceArea();
+            }
+        }
+        if (largest == num_children)
+        {
+            break;
+        }
+        const uint32_t opened = children[largest];
+        children[largest] = opened + 1;
+        children[num_children++] = binary[opened].offset;
+    }
+
+    // Children are written after the recursion, which may reallocate the node array
+    const uint32_t wide_index = static_cast<uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+    WideBVHNode node{};
+    node.num_children = static_cast<uint8_t>(num_children);
+    AABB boxes[WIDE_BVH_WIDTH];
+    for (size_t i = 0; i < num_children; ++i)
+    {
+        const BVHNode &child = binary[children[i]];
+        boxes[i] = child.aabb;
+        if (child.isLeaf() && child.count > WIDE_BVH_MAX_LEAF_SIZE)
+        {
+            node.child[i] = splitLeaf(child, child.offset, child.count);
+            node.count[i] = 0;
+        }
+        else if (child.isLeaf())
+        {
+            node.child[i] = child.offset;
+            node.count[i] = static_cast<uint8_t>(child.count);
+        }
+        else
+        {
+            node.child[i] = collapse(binary, children[i]);
+            node.count[i] = 0;
+        }
+    }
+    quantize(node, boxes, static_cast<int>(num_children));
+    nodes_[wide_index] = node;
+    return wide_index;
+}
+
+uint32_t WideBVH::splitLeaf(const BVHNode &leaf, uint32_t first, uint32_t count)
+{
+    // Fill the children up to the leaf size limit, or split evenly into subtrees if four full
+    // children are not enough
+    const uint32_t max_count = static_cast<uint32_t>(WIDE_BVH_WIDTH) * WIDE_BVH_MAX_LEAF_SIZE;
+    const uint32_t child_count =
+        count <= max_count ? WIDE_BVH_MAX_LEAF_SIZE
+                           : (count + static_cast<uint32_t>(WIDE_BVH_WIDTH) - 1) /
+                                 static_cast<uint32_t>(WIDE_BVH_WIDTH);
+    const uint32_t wide_index = static_cast<uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+    WideBVHNode node{};
+    AABB boxes[WIDE_BVH_WIDTH];
+    uint32_t num_children = 0;
+    for (uint32_t begin = first; begin < first + count; begin += child_count)
+    {
+        const uint32_t n = std::min(child_count, first + count - begin);
+        boxes[num_children] = leaf.aabb;
+        if (n > WIDE_BVH_MAX_LEAF_SIZE)
+        {
+            node.child[num_children] = splitLeaf(leaf, begin, n);
+            node.count[num_children] = 0;
+        }
+        else
+        {
+            node.child[num_children] = begin;
+            node.count[num_children] = static_cast<uint8_t>(n);
+        }
+        ++num_children;
+    }
+    node.num_children = static_cast<uint8_t>(num_children);
+    quantize(node, boxes, static_cast<int>(num_children));
+    nodes_[wide_index] = node;
+    return wide_index;
+}
+
+} // namespace rcube
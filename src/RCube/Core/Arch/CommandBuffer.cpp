@@ -0,0 +1,190 @@
+#include "RCube/Core/Arch/CommandBuffer.h"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace rcube
+{
+
+CommandBuffer::CommandBuffer()
+{
+    num_lanes_ = ThreadPool::instance().size() + 1;
+    lanes_ = std::make_unique<Lane[]>(num_lanes_);
+}
+
+PendingEntity CommandBuffer::create()
+{
+    // Entities are created in index order when the buffer is applied, before any other command
+    return PendingEntity{num_pending_.fetch_add(1, std::memory_order_relaxed)};
+}
+
+void CommandBuffer::destroy(Entity entity)
+{
+    record(Command{0, CommandType::Destroy, 0, entity, NO_PENDING_ENTITY, nullptr});
+}
+
+size_t CommandBuffer::size() const
+{
+    size_t count = num_pending_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < num_lanes_; ++i)
+    {
+        std::lock_guard<std::mutex> lock(lanes_[i].mutex);
+        count += lanes_[i].commands.size();
+    }
+    return count;
+}
+
+void CommandBuffer::clear()
+{
+    for (size_t i = 0; i < num_lanes_; ++i)
+    {
+        std::lock_guard<std::mutex> lock(lanes_[i].mutex);
+        lanes_[i].commands.clear();
+    }
+    num_pending_.store(0, std::memory_order_relaxed);
+    sequence_.store(0, std::memory_order_relaxed);
+}
+
+void CommandBuffer::record(Command command)
+{
+    command.sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+    // Workers never share a lane, so their locks are uncontended
+    Lane &lane = lanes_[std::min(ThreadPool::instance().workerIndex(), num_lanes_ - 1)];
+    std::lock_guard<std::mutex> lock(lane.mutex);
+    lane.commands.push_back(std::move(command));
+}
+
+std::vector<EntityHandle> CommandBuffer::apply(World &world)
+{
+    std::vector<Command> commands;
+    for (size_t i = 0; i < num_lanes_; ++i)
+    {
+        std::lock_guard<std::mutex> lock(lanes_[i].mutex);
+        std::move(lanes_[i].commands.begin(), lanes_[i].commands.end(),
+                  std::back_inserter(commands));
+        lanes_[i].commands.clear();
+    }
+    std::sort(commands.begin(), commands.end(),
+              [](const Command &a, const Command &b) { return a.sequence < b.sequence; });
+    const uint32_t num_created = num_pending_.exchange(0, std::memory_order_relaxed);
+    sequence_.store(0, std::memory_order_relaxed);
+
+    std::vector<EntityHandle> created;
+    created.reserve(num_created);
+    for (uint32_t i = 0; i < num_created; ++i)
+    {
+        created.push_back(world.createEntity());
+    }
+
+    // Apply all changes to the component storage, remembering the components each entity had
+    // before its first change
+    std::vector<std::pair<Entity, ComponentMask>> touched;
+    std::vector<char> seen;
+    for (Command &command : commands)
+    {
+        const Entity e =
+            command.pending != NO_PENDING_ENTITY ? created[command.pending].entity : command.entity;
+        if (!world.entity_mgr_.hasEntity(e))
+        {
+            continue;
+        }
+        if (e.id() >= seen.size())
+        {
+            seen.resize(e.id() + 1, 0);
+        }
+        if (!seen[e.id()])
+        {
+            seen[e.id()] = 1;
+            touched.push_back({e, world.entityMask(e)});
+        }
+        switch (command.type)
+        {
+        case CommandType::Add:
+            command.add(world, e);
+            break;
+        case CommandType::Remove: {
+            auto it = world.component_mgrs_.find(command.family);
+            if (it != world.component_mgrs_.end())
+            {
+                it->second->remove(e);
+            }
+            break;
+        }
+        case CommandType::Destroy:
+            for (auto &mgr : world.component_mgrs_)
+            {
+                mgr.second->remove(e);
+            }
+            world.entity_mgr_.removeEntity(e);
+            break;
+        }
+    }
+
+    // Compare each entity's components before and after the batch once, collecting the
+    // entities that enter or leave each filter of each system
+    const std::vector<std::unique_ptr<System>> &systems = world.systems_;
+    std::vector<std::vector<std::vector<Entity>>> added(systems.size());
+    std::vector<std::vector<std::vector<Entity>>> removed(systems.size());
+    for (size_t s = 0; s < systems.size(); ++s)
+    {
+        added[s].resize(systems[s]->filters().size());
+        removed[s].resize(systems[s]->filters().size());
+    }
+    for (const auto &entry : touched)
+    {
+        const Entity e = entry.first;
+        const ComponentMask &old_mask = entry.second;
+        ComponentMask new_mask;
+        if (world.entity_mgr_.hasEntity(e))
+        {
+            for (const auto &mgr : world.component_mgrs_)
+            {
+                if (mgr.second->has(e))
+                {
+                    new_mask.set(mgr.first);
+                }
+            }
+        }
+        if (new_mask == old_mask)
+        {
+            continue;
+        }
+        world.moveToArchetype(e, new_mask);
+        for (size_t s = 0; s < systems.size(); ++s)
+        {
+            const std::vector<ComponentMask> &filters = systems[s]->filters();
+            for (size_t f = 0; f < filters.size(); ++f)
+            {
+                const bool new_match = new_mask.match(filters[f]);
+                const bool old_match = old_mask.match(filters[f]);
+                if (new_match && !old_match)
+                {
+                    added[s][f].push_back(e);
+                }
+                else if (!new_match && old_match)
+                {
+                    removed[s][f].push_back(e);
+                }
+            }
+        }
+    }
+    for (size_t s = 0; s < systems.size(); ++s)
+    {
+        const std::vector<ComponentMask> &filters = systems[s]->filters();
+        for (size_t f = 0; f < filters.size(); ++f)
+        {
+            if (!added[s][f].empty())
+            {
+                systems[s]->registerEntities(added[s][f], filters[f]);
+            }
+            if (!removed[s][f].empty())
+            {
+                std::sort(removed[s][f].begin(), removed[s][f].end());
+                systems[s]->unregisterEntities(removed[s][f], filters[f]);
+            }
+        }
+    }
+    return created;
+}
+
+} // namespace rcube
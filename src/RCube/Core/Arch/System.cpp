@@ -12,12 +12,12 @@ void ComponentMask::reset(size_t pos)
     bits.reset(pos);
 }
 
-bool ComponentMask::match(const ComponentMask &other)
+bool ComponentMask::match(const ComponentMask &other) const
 {
     return (bits & other.bits) == other.bits;
 }
 
-bool ComponentMask::equal(const ComponentMask &other)
+bool ComponentMask::equal(const ComponentMask &other) const
 {
     return bits == other.bits;
 }
@@ -0,0 +1,137 @@
+#include "RCube/Core/Arch/SystemScheduler.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace rcube
+{
+
+namespace
+{
+
+// Whether two systems may not run concurrently
+bool conflict(const System &a, const System &b)
+{
+    if (!a.declaresAccess() || !b.declaresAccess())
+    {
+        return true;
+    }
+    const auto a_writes = a.writesComponents().bits;
+    const auto b_writes = b.writesComponents().bits;
+    return (a_writes & (b.readsComponents().bits | b_writes)).any() ||
+           (b_writes & a.readsComponents().bits).any();
+}
+
+} // namespace
+
+void SystemScheduler::build(const std::vector<System *> &systems)
+{
+    systems_ = systems;
+    dependents_.assign(systems.size(), {});
+    num_dependencies_.assign(systems.size(), 0);
+    for (uint32_t j = 0; j < systems.size(); ++j)
+    {
+        for (uint32_t i = 0; i < j; ++i)
+        {
+            if (conflict(*systems[i], *systems[j]))
+            {
+                dependents_[i].push_back(j);
+                ++num_dependencies_[j];
+            }
+        }
+    }
+}
+
+void SystemScheduler::run(ThreadPool &pool)
+{
+    const size_t n = systems_.size();
+    std::unique_ptr<std::atomic<uint32_t>[]> remaining(new std::atomic<uint32_t>[n]);
+    for (size_t i = 0; i < n; ++i)
+    {
+        remaining[i].store(num_dependencies_[i], std::memory_order_relaxed);
+    }
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<uint32_t> main_ready; // Main-thread systems whose dependencies are done
+    size_t finished = 0;
+    std::exception_ptr error;
+    TaskGroup group;
+
+    std::function<void(uint32_t)> schedule;
+    auto runSystem = [&](uint32_t i) {
+        try
+        {
+            systems_[i]->update(false);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+        for (uint32_t d : dependents_[i])
+        {
+            if (remaining[d].fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                schedule(d);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        ++finished;
+        cv.notify_all();
+    };
+    schedule = [&](uint32_t i) {
+        if (systems_[i]->mainThreadOnly())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            main_ready.push_back(i);
+            cv.notify_all();
+        }
+        else
+        {
+            pool.submit(group, [&runSystem, i]() { runSystem(i); });
+        }
+    };
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        if (num_dependencies_[i] == 0)
+        {
+            schedule(i);
+        }
+    }
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return !main_ready.empty() || finished == n; });
+        if (main_ready.empty())
+        {
+            break;
+        }
+        // Main-thread systems that became ready together run in list order
+        const auto next = std::min_element(main_ready.begin(), main_ready.end());
+        const uint32_t i = *next;
+        main_ready.erase(next);
+        lock.unlock();
+        runSystem(i);
+    }
+    pool.wait(group);
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+const std::vector<uint32_t> &SystemScheduler::dependents(size_t i) const
+{
+    return dependents_[i];
+}
+
+} // namespace rcube
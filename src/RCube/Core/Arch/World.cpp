@@ -19,7 +19,15 @@ void World::cleanup()
         sys->cleanup();
     }
     systems_.clear();
+    scheduler_outdated_ = true;
     component_mgrs_.clear();
+    for (std::atomic<BaseComponentManager *> &mgr : component_mgr_lookup_)
+    {
+        mgr.store(nullptr, std::memory_order_relaxed);
+    }
+    archetypes_.clear();
+    archetype_indices_.clear();
+    entity_locations_.clear();
 }
 
 EntityHandle World::createEntity()
@@ -39,17 +47,25 @@ void World::removeEntity(EntityHandle ent)
         std::cerr << "Given EntityHandle was not generated from this World" << std::endl;
         return;
     }
+    // Stale handles must not touch the components of the entity that reused their ID
+    if (!entity_mgr_.hasEntity(ent.entity))
+    {
+        return;
+    }
+    // Drop all components first and update the archetype and systems once for the final mask
+    const ComponentMask old_mask = entityMask(ent.entity);
     for (auto &mgr_ : component_mgrs_)
     {
         mgr_.second->remove(ent.entity);
-        updateEntityToSystem(ent.entity, mgr_.first, false);
     }
+    moveToArchetype(ent.entity, ComponentMask());
+    updateSystems(ent.entity, old_mask, ComponentMask());
     entity_mgr_.removeEntity(ent.entity);
 }
 
-EntityHandleIterator<std::unordered_set<Entity>> World::entities()
+EntityHandleIterator<std::vector<Entity>> World::entities()
 {
-    return EntityHandleIterator<decltype(entity_mgr_.entities)>(this, entity_mgr_.entities);
+    return EntityHandleIterator<std::vector<Entity>>(this, entity_mgr_.entities());
 }
 
 size_t World::numEntities() const
@@ -59,16 +75,24 @@ size_t World::numEntities() const
 
 void World::update()
 {
-    for (const auto &sys : systems_)
+    if (scheduler_outdated_)
     {
-        sys->update(false);
+        std::vector<System *> systems;
+        for (const auto &sys : systems_)
+        {
+            systems.push_back(sys.get());
+        }
+        scheduler_.build(systems);
+        scheduler_outdated_ = false;
     }
+    scheduler_.run(ThreadPool::instance());
 }
 
 void World::addSystem(std::unique_ptr<System> sys)
 {
     sys->registerWorld(this);
     systems_.push_back(std::move(sys));
+    scheduler_outdated_ = true;
     std::sort(systems_.begin(), systems_.end(),
               [](const std::unique_ptr<System> &sys1, const std::unique_ptr<System> &sys2) {
                   return sys1->priority() < sys2->priority();
@@ -77,17 +101,22 @@ void World::addSystem(std::unique_ptr<System> sys)
 
 void World::updateEntityToSystem(Entity ent, int component_family, bool flag)
 {
-    ComponentMask old_entity_mask = entity_masks_[ent];
-    entity_masks_[ent].set(component_family, flag);
-
-    ComponentMask new_entity_mask = entity_masks_[ent];
+    ComponentMask old_entity_mask = entityMask(ent);
+    ComponentMask new_entity_mask = old_entity_mask;
+    new_entity_mask.set(component_family, flag);
+    moveToArchetype(ent, new_entity_mask);
+    updateSystems(ent, old_entity_mask, new_entity_mask);
+}
 
+void World::updateSystems(Entity ent, const ComponentMask &old_mask,
+                          const ComponentMask &new_mask)
+{
     for (auto &sys : systems_)
     {
         for (ComponentMask sys_mask : sys->filters())
         {
-            bool new_match = new_entity_mask.match(sys_mask);
-            bool old_match = old_entity_mask.match(sys_mask);
+            bool new_match = new_mask.match(sys_mask);
+            bool old_match = old_mask.match(sys_mask);
             if (new_match && !old_match)
             {
                 sys->registerEntity(ent, sys_mask);
@@ -100,4 +129,50 @@ void World::updateEntityToSystem(Entity ent, int component_family, bool flag)
     }
 }
 
+ComponentMask World::entityMask(Entity ent) const
+{
+    if (ent.id() >= entity_locations_.size() ||
+        entity_locations_[ent.id()].archetype == UINT32_MAX)
+    {
+        return ComponentMask();
+    }
+    return archetypes_[entity_locations_[ent.id()].archetype].mask;
+}
+
+void World::moveToArchetype(Entity ent, const ComponentMask &mask)
+{
+    if (ent.id() >= entity_locations_.size())
+    {
+        entity_locations_.resize(ent.id() + 1);
+    }
+    EntityLocation &loc = entity_locations_[ent.id()];
+    if (loc.archetype != UINT32_MAX)
+    {
+        if (archetypes_[loc.archetype].mask == mask)
+        {
+            return;
+        }
+        // Swap-remove from the old archetype
+        std::vector<Entity> &rows = archetypes_[loc.archetype].entities;
+        rows[loc.row] = rows.back();
+        entity_locations_[rows[loc.row].id()].row = loc.row;
+        rows.pop_back();
+        loc.archetype = UINT32_MAX;
+    }
+    // Entities without components do not belong to any archetype
+    if (mask.bits.none())
+    {
+        return;
+    }
+    auto it = archetype_indices_.find(mask);
+    if (it == archetype_indices_.end())
+    {
+        it = archetype_indices_.emplace(mask, static_cast<uint32_t>(archetypes_.size())).first;
+        archetypes_.push_back(Archetype{mask, {}});
+    }
+    loc.archetype = it->second;
+    loc.row = static_cast<uint32_t>(archetypes_[it->second].entities.size());
+    archetypes_[it->second].entities.push_back(ent);
+}
+
 } // namespace rcube
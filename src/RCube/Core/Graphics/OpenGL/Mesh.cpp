@@ -1,9 +1,12 @@
 #include "RCube/Core/Graphics/OpenGL/Mesh.h"
+#include "RCube/Core/Accel/Hash.h"
 #include "RCube/Core/Graphics/OpenGL/CheckGLError.h"
 #include "RCube/Core/Graphics/OpenGL/ShaderProgram.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
 #include "glad/glad.h"
 #include "glm/gtc/type_ptr.hpp"
 #include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <stdexcept>
 
@@ -50,6 +53,23 @@ void findCentroidAndScale(const std::vector<glm::vec3> &vertices, glm::vec3 &cen
     scale = std::max(size.x, std::max(size.y, size.z));
 }
 
+namespace
+{
+
+// Exact intersection test between face f of a and face g of b, with b's vertices mapped into
+// a's space by b_to_a
+bool facesOverlap(const TriangleMeshView &a, uint32_t f, const TriangleMeshView &b, uint32_t g,
+                  const glm::mat4 &b_to_a)
+{
+    glm::vec3 a0, a1, a2, b0, b1, b2;
+    a.vertices(f, a0, a1, a2);
+    b.vertices(g, b0, b1, b2);
+    return overlaps(a0, a1, a2, glm::vec3(b_to_a * glm::vec4(b0, 1.f)),
+                    glm::vec3(b_to_a * glm::vec4(b1, 1.f)), glm::vec3(b_to_a * glm::vec4(b2, 1.f)));
+}
+
+} // namespace
+
 //-----------------------------------------------------------------------------
 // MeshData
 //-----------------------------------------------------------------------------
@@ -330,52 +350,304 @@ void Mesh::setDefaultValue(GLuint id, const glm::vec2 &val)
     glVertexAttrib2f(id, val[0], val[1]);
 }
 
-void Mesh::updateBVH()
+TriangleMeshView Mesh::triangles()
 {
-    // TODO(pradeep): find a way to avoid creating all these primitives and reuse original mesh data
-    std::vector<PrimitivePtr> prims;
-    const glm::vec3 *pos = attributes_["positions"]->ptrVec3();
-    const unsigned int *ind = indices_->ptr();
+    TriangleMeshView view;
+    const std::shared_ptr<AttributeBuffer> &positions = attributes_.at("positions");
+    if (positions->size() == 0)
+    {
+        return view;
+    }
+    view.positions = positions->ptrVec3();
     if (numIndexData() > 0)
     {
-        prims.reserve(indices_->size() / 3);
-        size_t face_id = 0;
-        for (size_t i = 0; i < indices_->size(); i += 3)
+        view.indices = indices_->ptr();
+        view.num_faces = indices_->size() / 3;
+    }
+    else
+    {
+        view.num_faces = positions->size() / 9;
+    }
+    return view;
+}
+
+void Mesh::updateBVH(BVHBuildMethod method, const std::string &cache_dir)
+{
+    bvh_method_ = method;
+    const TriangleMeshView tris = triangles();
+    if (tris.num_faces == 0)
+    {
+        bvh_.clear();
+        bvh_triangles_.clear();
+        wide_bvh_.clear();
+        return;
+    }
+    std::string cache_file;
+    uint64_t key = 0;
+    if (!cache_dir.empty())
+    {
+        // Cached BVHs are named after a hash of everything they depend on
+        const std::shared_ptr<AttributeBuffer> &positions = attributes_.at("positions");
+        key = hashBytes(positions->ptr(), positions->size() * sizeof(float),
+                        static_cast<uint64_t>(method));
+        if (numIndexData() > 0)
+        {
+            key = hashBytes(indices_->ptr(), indices_->size() * sizeof(unsigned int), key);
+        }
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(key));
+        cache_file = cache_dir + "/" + name;
+        if (bvh_.load(cache_file, key) && bvh_.primitiveIndices().size() == tris.num_faces)
         {
-            prims.push_back(std::make_shared<Triangle>(face_id++, pos[ind[i + 0]], pos[ind[i + 1]],
-                                                       pos[ind[i + 2]]));
+            bvh_triangles_.build(tris, bvh_);
+            wide_bvh_.build(bvh_);
+            return;
         }
     }
-    else
+    // The BVH refers to faces by index, so no per-face primitives need to be created
+    std::vector<AABB> bounds(tris.num_faces);
+    std::vector<glm::vec3> centroids(tris.num_faces);
+    for (size_t f = 0; f < tris.num_faces; ++f)
     {
-        size_t num_verts = numVertexData();
-        prims.reserve(num_verts / 3);
-        size_t face_id = 0;
-        for (size_t i = 0; i < num_verts; i += 3)
+        glm::vec3 v0, v1, v2;
+        tris.vertices(f, v0, v1, v2);
+        bounds[f] = AABB(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
+        centroids[f] = (v0 + v1 + v2) / 3.f;
+    }
+    bvh_.build(bounds, centroids, method);
+    bvh_triangles_.build(tris, bvh_);
+    wide_bvh_.build(bvh_);
+    if (!cache_file.empty())
+    {
+        // The cache is optional: a failed save only costs a rebuild next time
+        try
+        {
+            bvh_.save(cache_file, key);
+        }
+        catch (const std::runtime_error &e)
         {
-            prims.push_back(
-                std::make_shared<Triangle>(face_id++, pos[i + 0], pos[i + 1], pos[i + 2]));
+            std::cerr << "Unable to cache BVH: " << e.what() << std::endl;
         }
     }
-    bvh_ = buildBVH(prims);
+}
+
+bool Mesh::refitBVH(float max_cost_ratio)
+{
+    const TriangleMeshView tris = triangles();
+    if (bvh_.empty() || bvh_.primitiveIndices().size() != tris.num_faces)
+    {
+        updateBVH(bvh_method_);
+        return false;
+    }
+    bvh_.refit([&](uint32_t f) {
+        glm::vec3 v0, v1, v2;
+        tris.vertices(f, v0, v1, v2);
+        return AABB(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
+    });
+    if (bvh_.sahCost() > max_cost_ratio * bvh_.builtSAHCost())
+    {
+        updateBVH(bvh_method_);
+        return false;
+    }
+    bvh_triangles_.build(tris, bvh_);
+    wide_bvh_.build(bvh_);
+    return true;
 }
 
 bool Mesh::rayIntersect(const Ray &ray, glm::vec3 &pt, size_t &id)
 {
-    if (bvh_ == nullptr)
+    if (bvh_.empty())
     {
         return false;
     }
-    PrimitivePtr prim;
-    bool hit = bvh_->rayIntersect(ray, pt, prim);
-    if (!hit)
+    uint32_t face;
+    float t;
+    if (!bvh_triangles_.rayIntersect(bvh_, wide_bvh_, ray, face, t))
+    {
+        return false;
+    }
+    pt = ray.origin() + t * ray.direction();
+    id = face;
+    return true;
+}
+
+void Mesh::rayIntersect(const std::vector<Ray> &rays, std::vector<RayHit> &hits)
+{
+    hits.assign(rays.size(), RayHit());
+    if (bvh_.empty())
+    {
+        return;
+    }
+    const size_t num_packets = (rays.size() + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE;
+    ThreadPool::instance().parallelFor(
+        0, num_packets,
+        [&](size_t p) {
+            const size_t i = p * RAY_PACKET_SIZE;
+            const size_t count = std::min(RAY_PACKET_SIZE, rays.size() - i);
+            uint32_t face[RAY_PACKET_SIZE];
+            float t[RAY_PACKET_SIZE];
+            const int hit =
+                bvh_triangles_.rayIntersect(bvh_, RayPacket4(&rays[i], count), face, t);
+            for (size_t k = 0; k < count; ++k)
+            {
+                if (hit & (1 << k))
+                {
+                    RayHit &h = hits[i + k];
+                    h.hit = true;
+                    h.t = t[k];
+                    h.point = rays[i + k].origin() + t[k] * rays[i + k].direction();
+                    h.id = face[k];
+                }
+            }
+        },
+        64);
+}
+
+bool Mesh::occluded(const Ray &ray)
+{
+    return bvh_triangles_.occluded(wide_bvh_, ray);
+}
+
+void Mesh::occluded(const std::vector<Ray> &rays, std::vector<uint8_t> &occluded)
+{
+    occluded.assign(rays.size(), 0);
+    if (bvh_.empty())
+    {
+        return;
+    }
+    const size_t num_packets = (rays.size() + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE;
+    ThreadPool::instance().parallelFor(
+        0, num_packets,
+        [&](size_t p) {
+            const size_t i = p * RAY_PACKET_SIZE;
+            const size_t count = std::min(RAY_PACKET_SIZE, rays.size() - i);
+            const int hit = bvh_triangles_.occluded(bvh_, RayPacket4(&rays[i], count));
+            for (size_t k = 0; k < count; ++k)
+            {
+                occluded[i + k] = (hit >> k) & 1;
+            }
+        },
+        64);
+}
+
+void Mesh::rayIntersectAll(const Ray &ray, std::vector<RayHit> &hits)
+{
+    hits.clear();
+    const TriangleMeshView tris = triangles();
+    bvh_.rayIntersectAll(
+        ray,
+        [&](uint32_t f, const Ray &r, float &t) {
+            glm::vec3 v0, v1, v2;
+            tris.vertices(f, v0, v1, v2);
+            return rcube::rayIntersect(v0, v1, v2, r, t);
+        },
+        [&](uint32_t f, float t) {
+            RayHit h;
+            h.hit = true;
+            h.t = t;
+            h.point = ray.origin() + t * ray.direction();
+            h.id = f;
+            hits.push_back(h);
+        });
+    std::sort(hits.begin(), hits.end(),
+              [](const RayHit &a, const RayHit &b) { return a.t < b.t; });
+}
+
+void Mesh::rayIntersectAll(const std::vector<Ray> &rays, std::vector<std::vector<RayHit>> &hits)
+{
+    hits.resize(rays.size());
+    ThreadPool::instance().parallelFor(
+        0, rays.size(), [&](size_t i) { rayIntersectAll(rays[i], hits[i]); }, 64);
+}
+
+bool Mesh::closestPoint(const glm::vec3 &p, ClosestPointHit &hit, float max_distance)
+{
+    hit = ClosestPointHit();
+    const TriangleMeshView tris = triangles();
+    auto face_distance = [&](uint32_t f) {
+        glm::vec3 v0, v1, v2, bary;
+        tris.vertices(f, v0, v1, v2);
+        const glm::vec3 d = rcube::closestPoint(p, v0, v1, v2, bary) - p;
+        return glm::dot(d, d);
+    };
+    uint32_t face;
+    float dist_sq;
+    if (!bvh_.nearest(p, face_distance, face, dist_sq, max_distance * max_distance))
     {
         return false;
     }
-    id = prim->id();
+    glm::vec3 v0, v1, v2;
+    tris.vertices(face, v0, v1, v2);
+    hit.found = true;
+    hit.point = rcube::closestPoint(p, v0, v1, v2, hit.barycentrics);
+    hit.distance = std::sqrt(dist_sq);
+    hit.id = face;
     return true;
 }
 
+void Mesh::closestPoint(const std::vector<glm::vec3> &points, std::vector<ClosestPointHit> &hits,
+                        float max_distance)
+{
+    hits.resize(points.size());
+    ThreadPool::instance().parallelFor(
+        0, points.size(), [&](size_t i) { closestPoint(points[i], hits[i], max_distance); }, 64);
+}
+
+template <typename Region>
+void Mesh::facesInRegion(const Region &region, std::vector<uint32_t> &faces)
+{
+    const TriangleMeshView tris = triangles();
+    bvh_.rangeQuery([&](const AABB &box) { return region.classify(box); },
+                    [&](uint32_t f) {
+                        glm::vec3 v0, v1, v2;
+                        tris.vertices(f, v0, v1, v2);
+                        return overlaps(v0, v1, v2, region);
+                    },
+                    faces);
+}
+
+void Mesh::rangeQuery(const AABB &box, std::vector<uint32_t> &faces)
+{
+    facesInRegion(box, faces);
+}
+
+void Mesh::rangeQuery(const Sphere &sphere, std::vector<uint32_t> &faces)
+{
+    facesInRegion(sphere, faces);
+}
+
+void Mesh::rangeQuery(const Frustum &frustum, std::vector<uint32_t> &faces)
+{
+    facesInRegion(frustum, faces);
+}
+
+void Mesh::intersectingFaces(const glm::mat4 &transform, Mesh &other,
+                             const glm::mat4 &other_transform,
+                             std::vector<std::pair<uint32_t, uint32_t>> &pairs)
+{
+    pairs.clear();
+    const TriangleMeshView tris = triangles();
+    const TriangleMeshView other_tris = other.triangles();
+    // Faces are compared in this mesh's model space
+    const glm::mat4 other_to_this = glm::inverse(transform) * other_transform;
+    bvh_.overlapPairs(
+        other.bvh_, other_to_this,
+        [&](uint32_t f, uint32_t g) {
+            return facesOverlap(tris, f, other_tris, g, other_to_this);
+        },
+        pairs);
+}
+
+bool Mesh::intersects(const glm::mat4 &transform, Mesh &other, const glm::mat4 &other_transform)
+{
+    const TriangleMeshView tris = triangles();
+    const TriangleMeshView other_tris = other.triangles();
+    const glm::mat4 other_to_this = glm::inverse(transform) * other_transform;
+    return bvh_.overlaps(other.bvh_, other_to_this, [&](uint32_t f, uint32_t g) {
+        return facesOverlap(tris, f, other_tris, g, other_to_this);
+    });
+}
+
 void LineMeshData::clear()
 {
     vertices.clear();
@@ -0,0 +1,178 @@
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include <algorithm>
+
+namespace rcube
+{
+
+namespace
+{
+
+// Worker index of the current thread and the pool it belongs to
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t num_threads)
+{
+    num_threads = std::max<size_t>(1, num_threads);
+    workers_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    threads_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        threads_.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &t : threads_)
+    {
+        t.join();
+    }
+}
+
+ThreadPool &ThreadPool::instance()
+{
+    static ThreadPool pool(std::max<unsigned>(1, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+size_t ThreadPool::size() const
+{
+    return workers_.size();
+}
+
+size_t ThreadPool::workerIndex() const
+{
+    return current_pool == this ? current_worker : workers_.size();
+}
+
+void ThreadPool::submit(TaskGroup &group, std::function<void()> task)
+{
+    group.pending_.fetch_add(1, std::memory_order_relaxed);
+    // Workers push to their own queue; other threads spread tasks over all queues
+    const size_t self = workerIndex();
+    size_t queue = self;
+    if (self >= workers_.size())
+    {
+        queue = next_queue_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers_[queue]->mutex);
+        workers_[queue]->tasks.push_back({std::move(task), &group});
+    }
+    queued_.fetch_add(1, std::memory_order_release);
+    {
+        // Pairs with the predicate check in run() so that the wakeup cannot be missed
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    wake_.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup &group)
+{
+    const size_t self = workerIndex();
+    while (!group.done())
+    {
+        if (!tryRunTask(self))
+        {
+            std::this_thread::yield();
+        }
+    }
+    std::lock_guard<std::mutex> lock(group.error_mutex_);
+    if (group.error_)
+    {
+        std::exception_ptr error = group.error_;
+        group.error_ = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::run(size_t index)
+{
+    current_pool = this;
+    current_worker = index;
+    while (true)
+    {
+        if (tryRunTask(index))
+        {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [this]() { return stop_ || queued_.load() > 0; });
+        if (stop_ && queued_.load() == 0)
+        {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::tryRunTask(size_t self)
+{
+    if (queued_.load(std::memory_order_acquire) == 0)
+    {
+        return false;
+    }
+    Task task;
+    bool found = false;
+    // Newest task from our own queue first...
+    if (self < workers_.size())
+    {
+        Worker &own = *workers_[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    // ...otherwise steal the oldest task from another queue
+    for (size_t k = 1; !found && k <= workers_.size(); ++k)
+    {
+        Worker &victim = *workers_[(self + k) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (!found)
+    {
+        return false;
+    }
+    queued_.fetch_sub(1, std::memory_order_relaxed);
+    execute(task);
+    return true;
+}
+
+void ThreadPool::execute(Task &task)
+{
+    try
+    {
+        task.fn();
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(task.group->error_mutex_);
+        if (!task.group->error_)
+        {
+            task.group->error_ = std::current_exception();
+        }
+    }
+    task.group->pending_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+} // namespace rcube
@@ -0,0 +1,101 @@
+#include "RCube/Raytracing/IdRenderer.h"
+#include "RCube/Components/Camera.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rcube
+{
+
+IdRenderer::IdRenderer(const IdRendererSettings &settings) : settings_(settings)
+{
+}
+
+IdBuffer IdRenderer::render(World &world, Entity camera)
+{
+    const Camera *cam = world.getComponent<Camera>(camera);
+    scene_.update(world);
+    IdBuffer buffer;
+    render(scene_, *cam, buffer);
+    return buffer;
+}
+
+void IdRenderer::render(const RaytracingScene &scene, const Camera &camera, IdBuffer &buffer) const
+{
+    const int width = settings_.width > 0 ? settings_.width : camera.viewport_size.x;
+    const int height = settings_.height > 0 ? settings_.height : camera.viewport_size.y;
+    if (width <= 0 || height <= 0)
+    {
+        throw std::runtime_error("Invalid image size for id rendering: " + std::to_string(width) +
+                                 "x" + std::to_string(height));
+    }
+    const int tile_size = std::max(settings_.tile_size, 1);
+    const int tiles_x = (width + tile_size - 1) / tile_size;
+    const int tiles_y = (height + tile_size - 1) / tile_size;
+    const size_t num_pixels = static_cast<size_t>(width) * height;
+    buffer.width = width;
+    buffer.height = height;
+    buffer.entities.resize(num_pixels);
+    buffer.triangles.resize(num_pixels);
+    buffer.depth.resize(num_pixels);
+
+    const glm::mat4 world_to_view = camera.worldToView();
+    const glm::mat4 ndc_to_world = glm::inverse(camera.viewToProjection() * world_to_view);
+    // View-space depth of a world-space point is -(row 2 of the view matrix . point)
+    const glm::vec4 view_z(world_to_view[0][2], world_to_view[1][2], world_to_view[2][2],
+                           world_to_view[3][2]);
+
+    ThreadPool::instance().parallelFor(0, static_cast<size_t>(tiles_x) * tiles_y, [&](size_t tile) {
+        const int x0 = static_cast<int>(tile % tiles_x) * tile_size;
+        const int y0 = static_cast<int>(tile / tiles_x) * tile_size;
+        const int x1 = std::min(x0 + tile_size, width);
+        const int y1 = std::min(y0 + tile_size, height);
+        // Neighbouring rays mostly visit the same nodes, so each 2x2 block of pixels is traced
+        // as one packet
+        std::vector<Ray> rays;
+        rays.reserve(RAY_PACKET_SIZE);
+        for (int by = y0; by < y1; by += 2)
+        {
+            for (int bx = x0; bx < x1; bx += 2)
+            {
+                rays.clear();
+                size_t pixels[RAY_PACKET_SIZE];
+                for (int y = by; y < std::min(by + 2, y1); ++y)
+                {
+                    for (int x = bx; x < std::min(bx + 2, x1); ++x)
+                    {
+                        const float ndc_x = 2.f * (x + 0.5f) / width - 1.f;
+                        const float ndc_y = 1.f - 2.f * (y + 0.5f) / height;
+                        pixels[rays.size()] = buffer.index(x, y);
+                        rays.push_back(cameraRay(ndc_to_world, ndc_x, ndc_y));
+                    }
+                }
+                uint32_t objects[RAY_PACKET_SIZE], faces[RAY_PACKET_SIZE];
+                float t[RAY_PACKET_SIZE];
+                const int hit =
+                    scene.intersect(RayPacket4(rays.data(), rays.size()), objects, faces, t);
+                for (size_t k = 0; k < rays.size(); ++k)
+                {
+                    const size_t pixel = pixels[k];
+                    if (hit & (1 << k))
+                    {
+                        const glm::vec3 p = rays[k].origin() + t[k] * rays[k].direction();
+                        buffer.entities[pixel] = scene.objects()[objects[k]].entity.id();
+                        buffer.triangles[pixel] = faces[k];
+                        buffer.depth[pixel] = -(glm::dot(glm::vec3(view_z), p) + view_z.w);
+                    }
+                    else
+                    {
+                        buffer.entities[pixel] = ID_BUFFER_NONE;
+                        buffer.triangles[pixel] = ID_BUFFER_NONE;
+                        buffer.depth[pixel] = std::numeric_limits<float>::infinity();
+                    }
+                }
+            }
+        }
+    });
+}
+
+} // namespace rcube
@@ -0,0 +1,312 @@
+#include "RCube/Raytracing/PathTracer.h"
+#include "RCube/Components/Camera.h"
+#include "RCube/Core/Parallel/ThreadPool.h"
+#include "glm/gtc/constants.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace rcube
+{
+
+namespace
+{
+
+// Smaller roughness turns the GGX distribution into a spike that cannot be sampled reliably
+constexpr float MIN_ROUGHNESS = 0.03f;
+
+// Number of bounces after which paths are randomly terminated (Russian roulette)
+constexpr int MIN_BOUNCES = 2;
+
+// PCG32 random number generator
+struct Random
+{
+    uint64_t state;
+
+    Random(uint32_t seed, uint32_t stream) : state(0)
+    {
+        const uint64_t s = (static_cast<uint64_t>(stream) << 32) | seed;
+        state = (s ^ 0x9e3779b97f4a7c15ull) * 0xbf58476d1ce4e5b9ull;
+        next();
+    }
+
+    uint32_t next()
+    {
+        const uint64_t old = state;
+        state = old * 6364136223846793005ull + 1442695040888963407ull;
+        const uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        const uint32_t rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
+    }
+
+    // Uniform in [0, 1)
+    float uniform()
+    {
+        return static_cast<float>(next() >> 8) * (1.f / 16777216.f);
+    }
+};
+
+// Material parameters at a surface point, with the BRDF of PBRLightingPassShader
+struct SurfaceBRDF
+{
+    glm::vec3 albedo;
+    float roughness;
+    float metallic;
+    glm::vec3 specular_color; // F0
+    float specular_probability;
+
+    SurfaceBRDF(const RaytracingScene::Object &obj)
+        : albedo(obj.albedo), roughness(std::max(obj.roughness, MIN_ROUGHNESS)),
+          metallic(obj.metallic)
+    {
+        specular_color = glm::mix(glm::vec3(0.04f), albedo, metallic);
+        // Metals have no diffuse lobe; sample the specular lobe more often the more metallic
+        specular_probability = 0.5f + 0.5f * glm::clamp(metallic, 0.f, 1.f);
+    }
+
+    float dGgx(float h_dot_n) const
+    {
+        const float a = roughness * roughness;
+        const float a2 = a * a;
+        const float denom = h_dot_n * h_dot_n * (a2 - 1.f) + 1.f;
+        return a2 / (glm::pi<float>() * denom * denom);
+    }
+
+    float gSchlickGgx(float n_dot_v) const
+    {
+        const float r = 1.f + roughness;
+        const float k = (r * r) / 8.f;
+        return n_dot_v / (n_dot_v * (1.f - k) + k);
+    }
+
+    glm::vec3 fSchlick(float cos_grazing_angle) const
+    {
+        const float f = std::pow(glm::clamp(1.f - cos_grazing_angle, 0.f, 1.f), 5.f);
+        return specular_color + (glm::vec3(1.f) - specular_color) * f;
+    }
+
+    // BRDF for light arriving from l and leaving towards v
+    glm::vec3 eval(const glm::vec3 &n, const glm::vec3 &v, const glm::vec3 &l) const
+    {
+        const glm::vec3 h = glm::normalize(l + v);
+        const float n_dot_v = std::max(glm::dot(n, v), 0.f);
+        const float n_dot_l = std::max(glm::dot(n, l), 0.f);
+        const float d = dGgx(std::max(glm::dot(h, n), 0.f));
+        const float g = gSchlickGgx(n_dot_l) * gSchlickGgx(n_dot_v);
+        const glm::vec3 f = fSchlick(std::max(glm::dot(h, v), 0.f));
+        const glm::vec3 specular = d * g * f / (4.f * n_dot_v * n_dot_l + 0.001f);
+        const glm::vec3 kd = (glm::vec3(1.f) - f) * (1.f - metallic);
+        return kd * albedo / glm::pi<float>() + specular;
+    }
+
+    // Density of sample() choosing direction l
+    float pdf(const glm::vec3 &n, const glm::vec3 &v, const glm::vec3 &l) const
+    {
+        const float n_dot_l = glm::dot(n, l);
+        if (n_dot_l <= 0.f)
+        {
+            return 0.f;
+        }
+        const glm::vec3 h = glm::normalize(l + v);
+        const float v_dot_h = glm::dot(v, h);
+        const float pdf_specular =
+            v_dot_h > 0.f ? dGgx(std::max(glm::dot(h, n), 0.f)) * glm::dot(h, n) / (4.f * v_dot_h)
+                          : 0.f;
+        const float pdf_diffuse = n_dot_l / glm::pi<float>();
+        return specular_probability * std::max(pdf_specular, 0.f) +
+               (1.f - specular_probability) * pdf_diffuse;
+    }
+
+    // Samples an incoming direction from a mixture of GGX half-vectors and a cosine lobe
+    bool sample(const glm::vec3 &n, const glm::vec3 &v, Random &rng, glm::vec3 &l) const
+    {
+        // Orthonormal basis around n (Duff et al. 2017)
+        const float sign = std::copysign(1.f, n.z);
+        const float a = -1.f / (sign + n.z);
+        const float b = n.x * n.y * a;
+        const glm::vec3 t(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        const glm::vec3 s(b, sign + n.y * n.y * a, -n.y);
+
+        const float u0 = rng.uniform();
+        const float u1 = rng.uniform();
+        const float phi = 2.f * glm::pi<float>() * u1;
+        if (rng.uniform() < specular_probability)
+        {
+            const float a2 = roughness * roughness * roughness * roughness;
+            const float cos_theta = std::sqrt((1.f - u0) / (1.f + (a2 - 1.f) * u0));
+            const float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+            const glm::vec3 h = sin_theta * std::cos(phi) * t + sin_theta * std::sin(phi) * s +
+                                cos_theta * n;
+            l = 2.f * glm::dot(v, h) * h - v;
+        }
+        else
+        {
+            const float r = std::sqrt(u0);
+            l = r * std::cos(phi) * t + r * std::sin(phi) * s + std::sqrt(1.f - u0) * n;
+        }
+        return glm::dot(n, l) > 0.f;
+    }
+};
+
+// Moves a ray origin off the surface to avoid hitting it again, to the side of direction dir
+glm::vec3 offsetOrigin(const glm::vec3 &p, const glm::vec3 &ng, const glm::vec3 &dir)
+{
+    const glm::vec3 ap = glm::abs(p);
+    const float eps = 1e-4f * std::max(1.f, std::max(ap.x, std::max(ap.y, ap.z)));
+    return p + (glm::dot(dir, ng) >= 0.f ? eps : -eps) * ng;
+}
+
+glm::vec3 directLighting(const RaytracingScene &scene, const SurfaceHit &hit,
+                         const SurfaceBRDF &brdf, const glm::vec3 &v)
+{
+    glm::vec3 result(0.f);
+    for (const RaytracingScene::SceneLight &sl : scene.lights())
+    {
+        const Light &light = sl.light;
+        glm::vec3 l;
+        float dist = std::numeric_limits<float>::infinity();
+        float att = 1.f;
+        if (std::abs(light.pos_w) < 0.00001f)
+        {
+            l = light.position;
+        }
+        else
+        {
+            l = light.position - hit.point;
+            dist = glm::length(l);
+            att = (light.radius * light.radius) / (dist * dist);
+        }
+        const float l_length = glm::length(l);
+        if (!(l_length > 0.f))
+        {
+            continue;
+        }
+        l /= l_length;
+        const float n_dot_l = glm::dot(hit.normal, l);
+        if (n_dot_l <= 0.f || glm::dot(hit.geometric_normal, l) <= 0.f)
+        {
+            continue;
+        }
+        const glm::vec3 origin = offsetOrigin(hit.point, hit.geometric_normal, l);
+        if (scene.occluded(Ray(origin, l, 0.f, dist * (1.f - 1e-4f))))
+        {
+            continue;
+        }
+        result += brdf.eval(hit.normal, v, l) * att * light.color * n_dot_l;
+    }
+    return result;
+}
+
+} // namespace
+
+PathTracer::PathTracer(const PathTracerSettings &settings) : settings_(settings)
+{
+}
+
+Image PathTracer::render(World &world, Entity camera)
+{
+    const Camera *cam = world.getComponent<Camera>(camera);
+    scene_.update(world);
+    return render(scene_, *cam);
+}
+
+Image PathTracer::render(const RaytracingScene &scene, const Camera &camera) const
+{
+    const int width = settings_.width > 0 ? settings_.width : camera.viewport_size.x;
+    const int height = settings_.height > 0 ? settings_.height : camera.viewport_size.y;
+    if (width <= 0 || height <= 0)
+    {
+        throw std::runtime_error("Invalid image size for path tracing: " + std::to_string(width) +
+                                 "x" + std::to_string(height));
+    }
+    const int spp = std::max(settings_.samples_per_pixel, 1);
+    const int tile_size = std::max(settings_.tile_size, 1);
+    const int tiles_x = (width + tile_size - 1) / tile_size;
+    const int tiles_y = (height + tile_size - 1) / tile_size;
+
+    // Camera rays go from the near to the far plane, like the rasterizer's clipping
+    const glm::mat4 ndc_to_world =
+        glm::inverse(camera.viewToProjection() * camera.worldToView());
+    const glm::vec3 background = glm::pow(camera.background_color, glm::vec3(2.2f));
+
+    // Radiance along a camera ray
+    auto trace = [&](Ray ray, Random &rng) {
+        glm::vec3 result(0.f);
+        glm::vec3 throughput(1.f);
+        for (int bounce = 0;; ++bounce)
+        {
+            SurfaceHit hit;
+            if (!scene.intersect(ray, hit))
+            {
+                result += throughput * (bounce == 0 ? background : settings_.environment);
+                break;
+            }
+            const SurfaceBRDF brdf(scene.objects()[hit.object]);
+            const glm::vec3 v = -ray.direction();
+            result += throughput * directLighting(scene, hit, brdf, v);
+            if (bounce >= settings_.max_bounces)
+            {
+                break;
+            }
+            glm::vec3 l;
+            if (!brdf.sample(hit.normal, v, rng, l) || glm::dot(hit.geometric_normal, l) <= 0.f)
+            {
+                break;
+            }
+            const float pdf = brdf.pdf(hit.normal, v, l);
+            if (!(pdf > 0.f))
+            {
+                break;
+            }
+            throughput *= brdf.eval(hit.normal, v, l) * glm::dot(hit.normal, l) / pdf;
+            if (bounce >= MIN_BOUNCES)
+            {
+                const float survive =
+                    std::min(0.95f, std::max(throughput.x, std::max(throughput.y, throughput.z)));
+                if (!(rng.uniform() < survive))
+                {
+                    break;
+                }
+                throughput /= survive;
+            }
+            ray = Ray(offsetOrigin(hit.point, hit.geometric_normal, l), l);
+        }
+        return result;
+    };
+
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 3);
+    ThreadPool::instance().parallelFor(0, static_cast<size_t>(tiles_x) * tiles_y, [&](size_t tile) {
+        const int x0 = static_cast<int>(tile % tiles_x) * tile_size;
+        const int y0 = static_cast<int>(tile / tiles_x) * tile_size;
+        const int x1 = std::min(x0 + tile_size, width);
+        const int y1 = std::min(y0 + tile_size, height);
+        for (int y = y0; y < y1; ++y)
+        {
+            for (int x = x0; x < x1; ++x)
+            {
+                const uint32_t pixel = static_cast<uint32_t>(y) * width + x;
+                Random rng(settings_.seed, pixel);
+                glm::vec3 sum(0.f);
+                for (int s = 0; s < spp; ++s)
+                {
+                    const float ndc_x = 2.f * (x + rng.uniform()) / width - 1.f;
+                    const float ndc_y = 1.f - 2.f * (y + rng.uniform()) / height;
+                    sum += trace(cameraRay(ndc_to_world, ndc_x, ndc_y), rng);
+                }
+                const glm::vec3 color =
+                    glm::clamp(glm::pow(sum / float(spp), glm::vec3(1.f / 2.2f)), 0.f, 1.f);
+                unsigned char *out = &pixels[3 * static_cast<size_t>(pixel)];
+                for (int c = 0; c < 3; ++c)
+                {
+                    out[c] = static_cast<unsigned char>(color[c] * 255.f + 0.5f);
+                }
+            }
+        }
+    });
+    Image im;
+    im.setPixels(width, height, 3, pixels);
+    return im;
+}
+
+} // namespace rcube
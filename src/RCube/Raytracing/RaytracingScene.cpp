@@ -0,0 +1,224 @@
+#include "RCube/Raytracing/RaytracingScene.h"
+#include "RCube/Components/BaseLight.h"
+#include "RCube/Components/Drawable.h"
+#include "RCube/Components/Material.h"
+#include "RCube/Components/Transform.h"
+#include <algorithm>
+
+namespace rcube
+{
+
+namespace
+{
+
+// Barycentric coordinates of a point in the plane of a triangle
+glm::vec3 barycentricCoordinates(const glm::vec3 &p, const glm::vec3 &v0, const glm::vec3 &v1,
+                                 const glm::vec3 &v2)
+{
+    const glm::vec3 e0 = v1 - v0;
+    const glm::vec3 e1 = v2 - v0;
+    const glm::vec3 d = p - v0;
+    const float d00 = glm::dot(e0, e0);
+    const float d01 = glm::dot(e0, e1);
+    const float d11 = glm::dot(e1, e1);
+    const float d20 = glm::dot(d, e0);
+    const float d21 = glm::dot(d, e1);
+    const float denom = d00 * d11 - d01 * d01;
+    if (!(std::abs(denom) > 0.f))
+    {
+        return glm::vec3(1.f, 0.f, 0.f);
+    }
+    const float v = (d11 * d20 - d01 * d21) / denom;
+    const float w = (d00 * d21 - d01 * d20) / denom;
+    return glm::vec3(1.f - v - w, v, w);
+}
+
+} // namespace
+
+void RaytracingScene::update(World &world)
+{
+    clear();
+    // Visit entities in a fixed order so that object indices do not depend on hashing
+    std::vector<Entity> entities;
+    entities.reserve(world.numEntities());
+    auto it = world.entities();
+    while (it.hasNext())
+    {
+        entities.push_back(it.next().entity);
+    }
+    std::sort(entities.begin(), entities.end());
+
+    const Material default_material;
+    std::vector<glm::mat4> transforms;
+    std::vector<AABB> bounds;
+    for (Entity ent : entities)
+    {
+        Transform *tr = world.getComponentUnsafe<Transform>(ent);
+        if (tr == nullptr)
+        {
+            continue;
+        }
+        BaseLight *light = world.getComponentUnsafe<BaseLight>(ent);
+        if (light != nullptr)
+        {
+            SceneLight l;
+            l.light = light->light();
+            l.light.position = tr->worldPosition();
+            l.entity = ent;
+            lights_.push_back(l);
+        }
+        Drawable *dr = world.getComponentUnsafe<Drawable>(ent);
+        if (dr == nullptr || !dr->visible || dr->mesh == nullptr ||
+            dr->mesh->primitive() != MeshPrimitive::Triangles)
+        {
+            continue;
+        }
+        const std::shared_ptr<Mesh> &mesh = dr->mesh;
+        if (mesh->bvh().empty())
+        {
+            mesh->updateBVH();
+        }
+        Object obj;
+        obj.entity = ent;
+        obj.mesh = mesh;
+        obj.triangles = mesh->triangles();
+        obj.normals = nullptr;
+        if (mesh->hasAttribute("normals") &&
+            mesh->attribute("normals")->size() == mesh->attribute("positions")->size())
+        {
+            obj.normals = mesh->attribute("normals")->ptrVec3();
+        }
+        obj.transform = tr->worldTransform();
+        obj.normal_matrix = glm::transpose(glm::inverse(glm::mat3(obj.transform)));
+        const Material *mat = world.getComponentUnsafe<Material>(ent);
+        mat = mat != nullptr ? mat : &default_material;
+        obj.albedo = mat->albedo;
+        obj.roughness = mat->roughness;
+        obj.metallic = mat->metallic;
+        objects_.push_back(obj);
+        transforms.push_back(obj.transform);
+        bounds.push_back(mesh->bvh().bounds());
+    }
+    bvh_.update(transforms, bounds);
+}
+
+void RaytracingScene::clear()
+{
+    objects_.clear();
+    lights_.clear();
+    bvh_.clear();
+}
+
+bool RaytracingScene::intersect(const Ray &ray, SurfaceHit &hit) const
+{
+    uint32_t object;
+    uint32_t face;
+    float t;
+    if (!intersect(ray, object, face, t))
+    {
+        return false;
+    }
+    const Object &obj = objects_[object];
+    size_t i0, i1, i2;
+    obj.triangles.vertexIndices(face, i0, i1, i2);
+    const glm::vec3 &v0 = obj.triangles.positions[i0];
+    const glm::vec3 &v1 = obj.triangles.positions[i1];
+    const glm::vec3 &v2 = obj.triangles.positions[i2];
+    hit.object = object;
+    hit.face = face;
+    hit.t = t;
+    hit.point = ray.origin() + t * ray.direction();
+    const glm::vec3 p_model(bvh_.inverseTransform(object) * glm::vec4(hit.point, 1.f));
+    hit.barycentrics = barycentricCoordinates(p_model, v0, v1, v2);
+
+    glm::vec3 ng = obj.normal_matrix * glm::cross(v1 - v0, v2 - v0);
+    const float ng_length = glm::length(ng);
+    ng = ng_length > 0.f ? ng / ng_length : -ray.direction();
+    if (glm::dot(ng, ray.direction()) > 0.f)
+    {
+        ng = -ng;
+    }
+    glm::vec3 n = ng;
+    if (obj.normals != nullptr)
+    {
+        const glm::vec3 ns =
+            obj.normal_matrix * (hit.barycentrics.x * obj.normals[i0] +
+                                 hit.barycentrics.y * obj.normals[i1] +
+                                 hit.barycentrics.z * obj.normals[i2]);
+        const float ns_length = glm::length(ns);
+        if (ns_length > 0.f)
+        {
+            n = ns / ns_length;
+            // Shade both sides of the surface, like the rasterizer
+            n = glm::dot(n, ng) < 0.f ? -n : n;
+        }
+    }
+    hit.normal = n;
+    hit.geometric_normal = ng;
+    return true;
+}
+
+bool RaytracingScene::intersect(const Ray &ray, uint32_t &object, uint32_t &face, float &t) const
+{
+    // Every accepted hit is closer than the previous ones, so the last face reported is the
+    // closest one
+    return bvh_.rayIntersect(
+        ray,
+        [&](uint32_t i, const Ray &model_ray, float &t_model) {
+            const Mesh &mesh = *objects_[i].mesh;
+            uint32_t f;
+            if (!mesh.bvhTriangles().rayIntersect(mesh.bvh(), mesh.wideBVH(), model_ray, f,
+                                                  t_model))
+            {
+                return false;
+            }
+            face = f;
+            return true;
+        },
+        object, t);
+}
+
+int RaytracingScene::intersect(const RayPacket4 &packet, uint32_t object[RAY_PACKET_SIZE],
+                               uint32_t face[RAY_PACKET_SIZE], float t[RAY_PACKET_SIZE]) const
+{
+    // As in the scalar query, the faces reported last for each lane are the closest ones
+    return bvh_.rayIntersect(
+        packet,
+        [&](uint32_t i, const RayPacket4 &model_packet, int mask, simd::float4 &t_model) {
+            const Mesh &mesh = *objects_[i].mesh;
+            uint32_t faces[RAY_PACKET_SIZE];
+            alignas(16) float t_faces[RAY_PACKET_SIZE];
+            RayPacket4 p = model_packet;
+            p.active = mask;
+            const int hit = mesh.bvhTriangles().rayIntersect(mesh.bvh(), p, faces, t_faces);
+            for (size_t k = 0; k < RAY_PACKET_SIZE; ++k)
+            {
+                if (hit & (1 << k))
+                {
+                    face[k] = faces[k];
+                }
+            }
+            t_model = simd::select(simd::laneMask(hit), simd::float4::load(t_faces), t_model);
+            return hit;
+        },
+        object, t);
+}
+
+bool RaytracingScene::occluded(const Ray &ray) const
+{
+    return bvh_.occluded(ray, [&](uint32_t i, const Ray &model_ray) {
+        const Mesh &mesh = *objects_[i].mesh;
+        return mesh.bvhTriangles().occluded(mesh.wideBVH(), model_ray);
+    });
+}
+
+Ray cameraRay(const glm::mat4 &ndc_to_world, float ndc_x, float ndc_y)
+{
+    const glm::vec4 p_near = ndc_to_world * glm::vec4(ndc_x, ndc_y, -1.f, 1.f);
+    const glm::vec4 p_far = ndc_to_world * glm::vec4(ndc_x, ndc_y, 1.f, 1.f);
+    const glm::vec3 origin = glm::vec3(p_near) / p_near.w;
+    const glm::vec3 dir = glm::vec3(p_far) / p_far.w - origin;
+    return Ray(origin, dir, 0.f, glm::length(dir));
+}
+
+} // namespace rcube
@@ -10,6 +10,8 @@ CameraSystem::CameraSystem()
 {
     ComponentMask camera_filter(Transform::family(), Camera::family());
     addFilter(camera_filter);
+    declareReads<Transform, Camera>();
+    declareWrites<Camera>();
 }
 
 unsigned int CameraSystem::priority() const
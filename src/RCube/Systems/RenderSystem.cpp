@@ -420,6 +420,8 @@ DeferredRenderSystem::DeferredRenderSystem(glm::ivec2 resolution, unsigned int m
     renderable_filter.set(Drawable::family());
     renderable_filter.set(Material::family());
     addFilter(renderable_filter);
+
+    declareReads<BaseLight, Camera, Transform, Drawable, Material>();
 }
 
 void DeferredRenderSystem::initialize()
@@ -452,7 +454,8 @@ void DeferredRenderSystem::update(bool force)
 {
     const auto &light_entities = registered_entities_[filters_[0]];
     const auto &camera_entities = registered_entities_[filters_[1]];
-    const auto &renderable_entities = registered_entities_[filters_[2]];
+    // Renderables are streamed archetype by archetype instead of through filters_[2]
+    const auto renderables = world_->view<Drawable, Transform, Material>();
 
     // Set lights
     std::vector<Light> lights;
@@ -509,21 +512,20 @@ void DeferredRenderSystem::update(bool force)
         state.stencil.op_stencil_fail = StencilOp::Replace;
 
         std::vector<DrawCall> drawcalls_geom_pass;
-        drawcalls_geom_pass.reserve(renderable_entities.size());
-        for (const auto &render_entity : renderable_entities)
-        {
-            Drawable *dr = world_->getComponent<Drawable>(render_entity);
-            if (!dr->visible)
+        drawcalls_geom_pass.reserve(renderables.size());
+        renderables.forEach([&](Entity, Drawable &dr, Transform &transform, Material &material) {
+            if (!dr.visible)
             {
-                continue;
+                return;
             }
-            Mesh *mesh = dr->mesh.get();
-            Transform *tr = world_->getComponent<Transform>(render_entity);
-            auto pbr = world_->getComponent<Material>(render_entity);
+            // Components never move while the frame is drawn, so the uniform callback can keep
+            // pointers to them
+            Transform *tr = &transform;
+            Material *pbr = &material;
 
             DrawCall dc;
             dc.settings = state;
-            dc.mesh = GLRenderer::getDrawCallMeshInfo(dr->mesh);
+            dc.mesh = GLRenderer::getDrawCallMeshInfo(dr.mesh);
             if (pbr->albedo_texture != nullptr)
             {
                 dc.textures.push_back({pbr->albedo_texture->id(), 0});
@@ -556,7 +558,7 @@ void DeferredRenderSystem::update(bool force)
                 shader->uniform("wireframe.thickness").set(pbr->wireframe_thickness);
             };
             drawcalls_geom_pass.push_back(dc);
-        }
+        });
         renderer_.draw(rt_geom_pass, drawcalls_geom_pass);
         gbuffer_->done();
         gbuffer_->blit(framebuffer_hdr_, {0, 0}, resolution_, {0, 0}, resolution_, false, true,
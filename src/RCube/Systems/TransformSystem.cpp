@@ -10,7 +10,8 @@ unsigned int TransformSystem::priority() const
     return 100;
 }
 
-void TransformSystem::updateHierarchy(Transform *comp, bool force)
+void TransformSystem::updateHierarchy(Transform *comp, std::vector<Transform *> &moved,
+                                      bool force)
 {
     if (comp->dirty_ || force)
     {
@@ -29,9 +30,10 @@ void TransformSystem::updateHierarchy(Transform *comp, bool force)
             comp->world_transform_ = comp->parent()->worldTransform() * comp->localTransform();
         }
         comp->dirty_ = false;
+        moved.push_back(comp);
         for (auto child : comp->children())
         {
-            updateHierarchy(child, true);
+            updateHierarchy(child, moved, true);
         }
     }
 }
@@ -41,6 +43,8 @@ TransformSystem::TransformSystem()
     ComponentMask transform_filter;
     transform_filter.set(Transform::family());
     addFilter(transform_filter);
+    declareReads<Transform>();
+    declareWrites<Transform>();
 }
 
 void TransformSystem::initialize()
@@ -52,16 +56,21 @@ void TransformSystem::cleanup()
 }
 void TransformSystem::update(bool force)
 {
-    const auto &transformable_entities = registered_entities_[filters_[0]];
-    for (const Entity &ent : transformable_entities)
-    {
-        Transform *comp = world_->getComponent<Transform>(ent);
-        // Update hierarchy from root level nodes which do not have a parent
-        if (comp->parent() == nullptr)
-        {
-            updateHierarchy(comp, force);
-        }
-    }
+    // The hierarchies under different roots are disjoint, so they are updated in parallel, each
+    // thread collecting the transforms it moved
+    moved_ = parallelForEach(
+        filters_[0], std::vector<Transform *>(),
+        [&](Entity ent, std::vector<Transform *> &moved) {
+            Transform *comp = world_->getComponent<Transform>(ent);
+            // Update hierarchy from root level nodes which do not have a parent
+            if (comp->parent() == nullptr)
+            {
+                updateHierarchy(comp, moved, force);
+            }
+        },
+        [](std::vector<Transform *> &result, const std::vector<Transform *> &moved) {
+            result.insert(result.end(), moved.begin(), moved.end());
+        });
 }
 
 } // namespace rcube
@@ -2,6 +2,7 @@
 #include "RCube/Components/Camera.h"
 #include "RCube/Components/Drawable.h"
 #include "RCube/Components/Transform.h"
+#include "RCube/Systems/TransformSystem.h"
 #include "RCubeViewer/Components/CameraController.h"
 #include "RCubeViewer/Components/Pickable.h"
 #include "imgui.h"
@@ -28,8 +29,103 @@ PickSystem::PickSystem()
     addFilter({Drawable::family(), Transform::family(), Pickable::family()});
 }
 
+void PickSystem::registerEntity(const Entity &e, ComponentMask sign)
+{
+    System::registerEntity(e, sign);
+    instances_outdated_ = instances_outdated_ || sign == filters_[1];
+}
+
+void PickSystem::unregisterEntity(const Entity &e, ComponentMask sign)
+{
+    System::unregisterEntity(e, sign);
+    instances_outdated_ = instances_outdated_ || sign == filters_[1];
+}
+
+void PickSystem::registerEntities(const std::vector<Entity> &entities, ComponentMask sign)
+{
+    System::registerEntities(entities, sign);
+    instances_outdated_ = instances_outdated_ || sign == filters_[1];
+}
+
+void PickSystem::unregisterEntities(const std::vector<Entity> &entities, ComponentMask sign)
+{
+    System::unregisterEntities(entities, sign);
+    instances_outdated_ = instances_outdated_ || sign == filters_[1];
+}
+
+const BVH &PickSystem::pickBVH(Entity ent)
+{
+    const Pickable *pick = world_->getComponent<Pickable>(ent);
+    return pick->points != nullptr ? pick->points->bvh()
+                                   : world_->getComponent<Drawable>(ent)->mesh->bvh();
+}
+
+void PickSystem::markMovedInstances()
+{
+    // Everything is read again when the BVH is rebuilt
+    if (instances_outdated_)
+    {
+        return;
+    }
+    const auto *transforms =
+        dynamic_cast<const TransformSystem *>(world_->getSystem("TransformSystem"));
+    if (transforms == nullptr)
+    {
+        return;
+    }
+    for (const Transform *tr : transforms->movedTransforms())
+    {
+        auto it = transform_instances_.find(tr);
+        if (it != transform_instances_.end())
+        {
+            instance_moved_[it->second] = true;
+        }
+    }
+}
+
+void PickSystem::updateSceneBVH()
+{
+    if (instances_outdated_)
+    {
+        instances_ = getFilteredEntities(filters_[1]);
+        std::vector<glm::mat4> transforms(instances_.size());
+        std::vector<AABB> bounds(instances_.size());
+        instance_revisions_.resize(instances_.size());
+        transform_instances_.clear();
+        for (size_t i = 0; i < instances_.size(); ++i)
+        {
+            Transform *tr = world_->getComponent<Transform>(instances_[i]);
+            const BVH &bvh = pickBVH(instances_[i]);
+            transforms[i] = tr->worldTransform();
+            bounds[i] = bvh.bounds();
+            instance_revisions_[i] = bvh.revision();
+            transform_instances_[tr] = static_cast<uint32_t>(i);
+        }
+        scene_bvh_.update(transforms, bounds);
+        instance_moved_.assign(instances_.size(), false);
+        instances_outdated_ = false;
+        return;
+    }
+    // Meshes may have been refit or rebuilt, and points replaced, without moving the entity
+    for (uint32_t i = 0; i < instances_.size(); ++i)
+    {
+        const BVH &bvh = pickBVH(instances_[i]);
+        if (instance_moved_[i] || bvh.revision() != instance_revisions_[i])
+        {
+            scene_bvh_.setInstance(
+                i, world_->getComponent<Transform>(instances_[i])->worldTransform(), bvh.bounds());
+            instance_moved_[i] = false;
+            instance_revisions_[i] = bvh.revision();
+        }
+    }
+    scene_bvh_.refit();
+}
+
 void PickSystem::update(bool)
 {
+    // Moved transforms are only reported for one frame, so they are collected even when
+    // nothing is picked
+    markMovedInstances();
     if (ImGui::GetIO().WantCaptureMouse)
     {
         return;
@@ -54,44 +150,56 @@ void PickSystem::update(bool)
             glm::vec3 ray_wor(glm::inverse(cam->worldToView()) * ray_eye);
             ray_wor = glm::normalize(ray_wor);
 
-            // Closest hit info
-            float min_dist = std::numeric_limits<float>::infinity();
-            Entity closest;
-            size_t closest_id = 0;
-            glm::vec3 closest_point;
-            bool hit = false;
+            updateSceneBVH();
 
             // Find the closest hit among all entities that have Drawable, Transform and Pickable
-            // components
-            for (Entity ent :
-                 getFilteredEntities({Drawable::family(), Transform::family(), Pickable::family()}))
-            {
-                Drawable *dr = world_->getComponent<Drawable>(ent);
-                Transform *tr = world_->getComponent<Transform>(ent);
-                Pickable *pickable = world_->getComponent<Pickable>(ent);
-
-                const glm::mat4 model_inv = glm::inverse(tr->worldTransform());
-                glm::vec3 ray_origin_model =
-                    glm::vec3(model_inv * glm::vec4(cam_tr->worldPosition(), 1.0));
-                glm::vec3 ray_dir_model = glm::normalize(model_inv * glm::vec4(ray_wor, 0.0));
-                Ray ray_model(ray_origin_model, ray_dir_model);
-                glm::vec3 pt;
-                size_t id;
-                if (dr->mesh->rayIntersect(ray_model, pt, id))
-                {
-                    hit = true;
-                    min_dist = std::min(glm::length(pt - ray_model.origin()), min_dist);
-                    closest_point = pt;
-                    closest_id = id;
-                    closest = ent;
-                }
-            }
+            // components. Every hit reported is closer than the previous ones, so the last one
+            // is the closest.
+            RayHit closest_hit;
+            const Ray ray_world(cam_tr->worldPosition(), ray_wor);
+            uint32_t closest;
+            float t;
+            const bool hit = scene_bvh_.rayIntersect(
+                ray_world,
+                [&](uint32_t i, const Ray &ray_model, float &t_model) {
+                    const Pickable *pick = world_->getComponent<Pickable>(instances_[i]);
+                    if (pick->points != nullptr)
+                    {
+                        uint32_t index;
+                        if (!pick->points->rayIntersect(ray_model, index, t_model))
+                        {
+                            return false;
+                        }
+                        closest_hit.point = ray_model.origin() + t_model * ray_model.direction();
+                        closest_hit.id = index;
+                        return true;
+                    }
+                    Drawable *dr = world_->getComponent<Drawable>(instances_[i]);
+                    glm::vec3 point;
+                    size_t face;
+                    if (!dr->mesh->rayIntersect(ray_model, point, face))
+                    {
+                        return false;
+                    }
+                    t_model = glm::length(point - ray_model.origin());
+                    closest_hit.point = point;
+                    closest_hit.id = face;
+                    return true;
+                },
+                closest, t);
             if (hit)
             {
-                Pickable *closest_pick = world_->getComponent<Pickable>(closest);
+                Pickable *closest_pick = world_->getComponent<Pickable>(instances_[closest]);
                 closest_pick->picked = true;
-                closest_pick->point = closest_point;
-                closest_pick->triangle = closest_id;
+                closest_pick->point = closest_hit.point;
+                if (closest_pick->points != nullptr)
+                {
+                    closest_pick->point_index = closest_hit.id;
+                }
+                else
+                {
+                    closest_pick->triangle = closest_hit.id;
+                }
             }
         }
     }
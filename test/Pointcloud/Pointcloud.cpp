@@ -30,24 +30,25 @@ int main()
     }
 
     // Convert points to mesh for visualization
+    const float point_radius = 0.03f;
     size_t num_triangles_per_point;
-    TriangleMeshData pointcloudMesh = pointsToSpheres(pointcloud, 0.03f, num_triangles_per_point);
+    TriangleMeshData pointcloudMesh =
+        pointsToSpheres(pointcloud, point_radius, num_triangles_per_point);
     EntityHandle pc_entity = viewer.addSurface("pointcloud", pointcloudMesh);
     pc_entity.get<Material>()->albedo = glm::vec3(0.f, 0.8f, 0.5f);
 
-    // Make pointcloud pickable with mouse click
+    // Make pointcloud pickable with mouse click. Picking tests the points themselves, so the
+    // sphere mesh is only drawn and needs no BVH.
     pc_entity.add<viewer::Pickable>();
-    pc_entity.get<Drawable>()->mesh->updateBVH();
+    pc_entity.get<viewer::Pickable>()->points =
+        std::make_shared<PointSet>(pointcloud, point_radius);
 
     viewer.customGUI = [&](viewer::RCubeViewer &v) {
         ImGui::Begin("Pick");
         viewer::Pickable *pick_comp = pc_entity.get<viewer::Pickable>();
         if (pick_comp->picked)
         {
-            ImGui::Text(
-                "Picked triangle index %zd, which corresponds to pointcloud index %zd\n",
-                pick_comp->triangle,
-                (size_t)std::floor((double)pick_comp->triangle / (double)num_triangles_per_point));
+            ImGui::Text("Picked pointcloud index %zd\n", pick_comp->point_index);
         }
         ImGui::End();
     };
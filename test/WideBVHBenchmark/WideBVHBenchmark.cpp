@@ -0,0 +1,163 @@
+#include "RCube/Core/Accel/TriangleSoA.h"
+#include "RCube/Core/Accel/WideBVH.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <vector>
+
+// Compares ray queries on the binary BVH and on the 4-wide BVH collapsed from it, for every
+// build method. Usage: WideBVHBenchmark [grid resolution] [number of rays]
+
+using namespace rcube;
+
+namespace
+{
+
+double elapsedMs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const int resolution = argc > 1 ? std::atoi(argv[1]) : 700;
+    const size_t num_rays = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+
+    std::mt19937 gen(5);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+
+    // A wavy height field, a soup of small random triangles, and a stack of identical faces,
+    // whose coinciding centroids the builders must still split into small leaves
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+    for (int y = 0; y <= resolution; ++y)
+    {
+        for (int x = 0; x <= resolution; ++x)
+        {
+            const float u = 2.f * x / resolution - 1.f;
+            const float v = 2.f * y / resolution - 1.f;
+            positions.push_back(glm::vec3(u, v, 0.2f * std::sin(x * 0.05f) * std::cos(y * 0.07f)));
+        }
+    }
+    for (int y = 0; y < resolution; ++y)
+    {
+        for (int x = 0; x < resolution; ++x)
+        {
+            const unsigned int a = y * (resolution + 1) + x;
+            const unsigned int b = a + resolution + 1;
+            indices.insert(indices.end(), {a, a + 1, b + 1, a, b + 1, b});
+        }
+    }
+    for (int i = 0; i < 200000; ++i)
+    {
+        const glm::vec3 center(dist(gen), dist(gen), dist(gen));
+        const unsigned int first = static_cast<unsigned int>(positions.size());
+        for (int k = 0; k < 3; ++k)
+        {
+            positions.push_back(center + 0.01f * glm::vec3(dist(gen), dist(gen), dist(gen)));
+        }
+        indices.insert(indices.end(), {first, first + 1, first + 2});
+    }
+    for (int i = 0; i < 1000; ++i)
+    {
+        const unsigned int first = static_cast<unsigned int>(positions.size());
+        positions.insert(positions.end(), {glm::vec3(0.5f, 0.5f, 0.5f), glm::vec3(0.6f, 0.5f, 0.5f),
+                                           glm::vec3(0.5f, 0.6f, 0.5f)});
+        indices.insert(indices.end(), {first, first + 1, first + 2});
+    }
+
+    TriangleMeshView triangles;
+    triangles.positions = positions.data();
+    triangles.indices = indices.data();
+    triangles.num_faces = indices.size() / 3;
+    std::vector<AABB> bounds(triangles.num_faces);
+    std::vector<glm::vec3> centroids(triangles.num_faces);
+    for (size_t f = 0; f < triangles.num_faces; ++f)
+    {
+        glm::vec3 v0, v1, v2;
+        triangles.vertices(f, v0, v1, v2);
+        bounds[f] = AABB(glm::min(v0, glm::min(v1, v2)), glm::max(v0, glm::max(v1, v2)));
+        centroids[f] = (v0 + v1 + v2) / 3.f;
+    }
+
+    // Incoherent rays, a quarter of them short
+    std::vector<Ray> rays;
+    rays.reserve(num_rays);
+    for (size_t i = 0; i < num_rays; ++i)
+    {
+        const glm::vec3 origin = 1.5f * glm::vec3(dist(gen), dist(gen), dist(gen));
+        const glm::vec3 direction(dist(gen), dist(gen), dist(gen));
+        rays.emplace_back(origin, direction, 0.f,
+                          i % 4 == 0 ? 0.3f : std::numeric_limits<float>::infinity());
+    }
+
+    std::printf("%zu triangles, %zu rays\n", triangles.num_faces, rays.size());
+    const char *method_names[] = {"BinnedSAH", "LBVH", "TreeletLBVH"};
+    for (BVHBuildMethod method :
+         {BVHBuildMethod::BinnedSAH, BVHBuildMethod::LBVH, BVHBuildMethod::TreeletLBVH})
+    {
+        BVH bvh;
+        bvh.build(bounds, centroids, method);
+        TriangleSoA soa;
+        soa.build(triangles, bvh);
+        auto start = std::chrono::steady_clock::now();
+        WideBVH wide;
+        wide.build(bvh);
+        const double collapse_ms = elapsedMs(start);
+
+        std::vector<char> binary_hit(rays.size()), wide_hit(rays.size());
+        std::vector<float> binary_t(rays.size()), wide_t(rays.size());
+        uint32_t face;
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            binary_hit[i] = soa.rayIntersect(bvh, rays[i], face, binary_t[i]);
+        }
+        const double binary_closest_ms = elapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            wide_hit[i] = soa.rayIntersect(bvh, wide, rays[i], face, wide_t[i]);
+        }
+        const double wide_closest_ms = elapsedMs(start);
+        size_t binary_occluded = 0, wide_occluded = 0;
+        start = std::chrono::steady_clock::now();
+        for (const Ray &ray : rays)
+        {
+            binary_occluded += soa.occluded(bvh, ray);
+        }
+        const double binary_occluded_ms = elapsedMs(start);
+        start = std::chrono::steady_clock::now();
+        for (const Ray &ray : rays)
+        {
+            wide_occluded += soa.occluded(wide, ray);
+        }
+        const double wide_occluded_ms = elapsedMs(start);
+
+        size_t mismatches = binary_occluded != wide_occluded ? 1 : 0;
+        for (size_t i = 0; i < rays.size(); ++i)
+        {
+            if (binary_hit[i] != wide_hit[i] || (binary_hit[i] && binary_t[i] != wide_t[i]))
+            {
+                ++mismatches;
+            }
+        }
+        std::printf("%s: binary %zu nodes (%.1f MB), wide %zu nodes (%.1f MB), collapsed in "
+                    "%.1f ms\n",
+                    method_names[static_cast<int>(method)], bvh.nodes().size(),
+                    bvh.nodes().size() * sizeof(BVHNode) / 1e6, wide.nodes().size(),
+                    wide.nodes().size() * sizeof(WideBVHNode) / 1e6, collapse_ms);
+        std::printf("  closest hit: binary %.0f ms, wide %.0f ms\n", binary_closest_ms,
+                    wide_closest_ms);
+        std::printf("  occlusion:   binary %.0f ms, wide %.0f ms\n", binary_occluded_ms,
+                    wide_occluded_ms);
+        std::printf("  mismatches:  %zu\n", mismatches);
+    }
+    return 0;
+}